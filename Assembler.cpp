@@ -17,22 +17,147 @@
 #include "Lexer.h"
 #include "Parser.h"
 #include "CodeEmitter.h"
+#include "Optimizer.h"
+
+#include <algorithm>
+#include <cstring>
+
+// Parts of a large source are at least this long, and there are up to this
+// many of them for every thread, so that threads which finish early can take
+// over the rest
+static const size_t minimumPartSize = 1 << 20;
+static const size_t partsPerThread = 4;
+
+void Assembler::setThreadPool(ThreadPool *pool) {
+    _pool = pool;
+}
+
+void Assembler::setOptimization(bool optimizing) {
+    _optimizing = optimizing;
+}
+
+// Each line goes from the lexer through the parser to the emitter before the
+// next one is lexed, so neither tokens nor the syntax tree of the whole source
+// are ever kept. Errors are reported in the order of the source.
 
 std::vector<Word> Assembler::compile() {
-    Lexer lexer(_sourceStream);
-    TokenStream tokenStream = lexer.lex();
+    if(!_source) {
+        _source = SourceBuffer::fromStream(*_sourceStream);
+    }
+    if(_pool && _pool->size() > 1 && _source->size() >= parallelSourceSize) {
+        return compileParts();
+    }
+    Lexer lexer(_source);
+    Parser parser{lexer};
+    CodeEmitter codeGenerator;
+
+    Ast line;
+    while(parser.parseLine(line)) {
+        codeGenerator.emit(line);
+    }
+
+    return finish(codeGenerator);
+}
+
+Object Assembler::compileObject() {
+    if(!_source) {
+        _source = SourceBuffer::fromStream(*_sourceStream);
+    }
+    Lexer lexer(_source);
+    Parser parser{lexer};
+    CodeEmitter codeGenerator = CodeEmitter::part(CodeEmitter::NullSection);
 
-    //tokenStream.print(std::cout);
+    Ast line;
+    while(parser.parseLine(line)) {
+        codeGenerator.emit(line);
+    }
 
-    Parser parser{tokenStream};
-    Ast ast = parser.parse();
+    return codeGenerator.finishObject();
+}
 
-    //ast.print(std::cout);
+// The source is cut into parts at line boundaries. Lines of every part are
+// counted first, to number lines like the whole source would. Then every part
+// is lexed, parsed and emitted with symbols of its own, and the parts are
+// joined, in the order of the source, to the entry address.
 
-    CodeEmitter codeGenerator(ast);
-    std::vector<Word> program = codeGenerator.emitCode();
+std::vector<Word> Assembler::compileParts() {
+    const size_t size = _source->size();
+    const char *data = _source->data();
+    const size_t partCount = std::min(_pool->size() * partsPerThread, std::max<size_t>(size / minimumPartSize, 1));
+
+    std::vector<size_t> bounds{0};
+    for(size_t i = 1; i < partCount; ++i) {
+        size_t cut = std::max(size * i / partCount, bounds.back());
+        const char *newline = static_cast<const char *>(std::memchr(data + cut, '\n', size - cut));
+        if(!newline || static_cast<size_t>(newline + 1 - data) == size) {
+            break;
+        }
+        if(static_cast<size_t>(newline + 1 - data) > bounds.back()) {
+            bounds.push_back(newline + 1 - data);
+        }
+    }
+    bounds.push_back(size);
+    const size_t parts = bounds.size() - 1;
+
+    std::vector<int> linesBefore(parts + 1);
+    for(size_t i = 0; i < parts; ++i) {
+        _pool->submit([data, &bounds, &linesBefore, i]() {
+            linesBefore[i + 1] = std::count(data + bounds[i], data + bounds[i + 1], '\n');
+        });
+    }
+    _pool->wait();
+    for(size_t i = 0; i < parts; ++i) {
+        linesBefore[i + 1] += linesBefore[i];
+    }
+
+    std::vector<CodeEmitter> emitters;
+    for(size_t i = 0; i < parts; ++i) {
+        emitters.push_back(CodeEmitter::part());
+    }
+    std::vector<std::exception_ptr> errors(parts);
+    for(size_t i = 0; i < parts; ++i) {
+        _pool->submit([this, &bounds, &linesBefore, &emitters, &errors, i]() {
+            try {
+                Lexer lexer(_source, bounds[i], bounds[i + 1], linesBefore[i]);
+                Parser parser{lexer};
+                Ast line;
+                while(parser.parseLine(line)) {
+                    emitters[i].emit(line);
+                }
+            } catch(...) {
+                errors[i] = std::current_exception();
+            }
+        });
+    }
+    _pool->wait();
+
+    CodeEmitter codeGenerator;
+    codeGenerator.join(emitters, errors, *_pool);
+    return finish(codeGenerator);
+}
+
+std::vector<Word> Assembler::finish(CodeEmitter &codeGenerator) {
+    std::vector<Word> program = codeGenerator.finish();
+    _labels = codeGenerator.labels();
+    _lineNumbers = codeGenerator.lineNumbers();
+
+    if(_optimizing) {
+        Optimizer optimizer(std::move(program), std::move(_labels), std::move(_lineNumbers),
+                            codeGenerator.dataReferences());
+        program = optimizer.optimize();
+        _labels = optimizer.labels();
+        _lineNumbers = optimizer.lineNumbers();
+    }
 
     //printProgram(std::cout, program);
 
     return program;
 }
+
+const std::unordered_map<std::string, int> &Assembler::labels() const {
+    return _labels;
+}
+
+const std::vector<int> &Assembler::lineNumbers() const {
+    return _lineNumbers;
+}
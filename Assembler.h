@@ -16,16 +16,58 @@
 #define AGHSM_ASSEMBLER_H
 
 #include "CodeEmitter.h"
+#include "Image.h"
+#include "SourceBuffer.h"
+#include "ThreadPool.h"
 
 #include <istream>
+#include <memory>
+#include <string>
+#include <unordered_map>
 
 class Assembler {
-    std::istream &_sourceStream;
+    std::istream *_sourceStream = nullptr;
+    std::shared_ptr<const SourceBuffer> _source;
+    ThreadPool *_pool = nullptr;
+    bool _optimizing = false;
+    std::unordered_map<std::string, int> _labels;
+    std::vector<int> _lineNumbers;
 
 public:
-    Assembler(std::istream &sourceStream) : _sourceStream(sourceStream) {}
+    /// Changes whenever the same source may be assembled differently, which
+    /// invalidates cached programs.
+    static const int version = 1;
+
+    /// Sources at least this long are assembled in parts on the thread pool,
+    /// if there is one.
+    static const size_t parallelSourceSize = 2 << 20;
+
+    Assembler(std::istream &sourceStream) : _sourceStream(&sourceStream) {}
+
+    /// Assembles the source without copying it.
+    explicit Assembler(std::shared_ptr<const SourceBuffer> source) : _source(std::move(source)) {}
+
+    /// Lexes, parses and emits large sources on the threads of `pool`.
+    void setThreadPool(ThreadPool *pool);
+
+    /// Runs compiled programs through the Optimizer.
+    void setOptimization(bool optimizing);
 
     std::vector<Word> compile();
+
+    /// Assembles the source as a unit on its own, to be linked with others.
+    Object compileObject();
+
+    /// Word index of every label of the last compiled program.
+    const std::unordered_map<std::string, int> &labels() const;
+
+    /// Source line of every word of the last compiled program.
+    const std::vector<int> &lineNumbers() const;
+
+private:
+    std::vector<Word> compileParts();
+
+    std::vector<Word> finish(CodeEmitter &codeGenerator);
 };
 
 
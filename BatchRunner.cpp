@@ -0,0 +1,156 @@
+/// Copyright (c) 2015 Jakub Trzebiatowski
+///
+/// Licensed under the Apache License, Version 2.0 (the "License");
+/// you may not use this file except in compliance with the License.
+/// You may obtain a copy of the License at
+///
+///     http://www.apache.org/licenses/LICENSE-2.0
+///
+/// Unless required by applicable law or agreed to in writing, software
+/// distributed under the License is distributed on an "AS IS" BASIS,
+/// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+/// See the License for the specific language governing permissions and
+/// limitations under the License.
+
+#include "BatchRunner.h"
+#include "Assembler.h"
+#include "Image.h"
+
+BatchRunner::BatchRunner(std::vector<std::string> sourcePaths, VM::Engine engine, uint64_t quantum,
+                         size_t outputLimit)
+        : _sourcePaths(std::move(sourcePaths)), _results(_sourcePaths.size()), _engine(engine), _quantum(quantum),
+          _outputLimit(outputLimit) {}
+
+std::vector<std::string> BatchRunner::readManifest(std::istream &is) {
+    std::vector<std::string> paths;
+    for(std::string line; getline(is, line); ) {
+        size_t begin = line.find_first_not_of(" \t\r");
+        if(begin == std::string::npos || line[begin] == '#') {
+            continue;
+        }
+        size_t end = line.find_last_not_of(" \t\r");
+        paths.push_back(line.substr(begin, end - begin + 1));
+    }
+    return paths;
+}
+
+void BatchRunner::setLimits(VM::Limits limits) {
+    _limits = limits;
+}
+
+void BatchRunner::setCache(CompileCache *cache) {
+    _cache = cache;
+}
+
+void BatchRunner::run(ThreadPool &pool) {
+    Scheduler scheduler(pool, _quantum);
+    for(size_t i = 0; i < _sourcePaths.size(); ++i) {
+        pool.submit([this, i, &scheduler] { startJob(i, scheduler); });
+    }
+    scheduler.wait();
+}
+
+const std::vector<BatchResult> &BatchRunner::results() const {
+    return _results;
+}
+
+bool BatchRunner::allSucceeded() const {
+    for(const BatchResult &result : _results) {
+        if(result.status != BatchResult::OkStatus) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool BatchRunner::anyFailed() const {
+    for(const BatchResult &result : _results) {
+        if(result.status == BatchResult::FailedStatus) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void BatchRunner::printReport(std::ostream &os) const {
+    size_t failed = 0;
+    size_t stopped = 0;
+    for(size_t i = 0; i < _results.size(); ++i) {
+        const BatchResult &result = _results[i];
+        os << "=== " << _sourcePaths[i] << ": ";
+        if(result.status == BatchResult::OkStatus) {
+            os << "ok" << std::endl;
+        } else if(result.status == BatchResult::LimitStatus) {
+            os << "stopped: " << result.error << std::endl;
+            ++stopped;
+        } else {
+            os << "error: " << result.error << std::endl;
+            ++failed;
+        }
+        os << result.output;
+        if(result.truncated) {
+            if(!result.output.empty() && result.output.back() != '\n') {
+                os << std::endl;
+            }
+            os << "[output truncated]" << std::endl;
+        }
+    }
+    os << "=== " << _results.size() - failed - stopped << " ok, " << failed << " failed";
+    if(stopped) {
+        os << ", " << stopped << " stopped";
+    }
+    os << std::endl;
+}
+
+void BatchRunner::startJob(size_t index, Scheduler &scheduler) {
+    auto output = std::make_shared<StringSink>(_outputLimit);
+
+    try {
+        auto vm = std::make_shared<VM>();
+        vm->setEngine(_engine);
+        vm->setOutputSink(*output);
+        vm->setLimits(_limits);
+
+        // Images run in place and are kept until the job finishes
+        std::shared_ptr<Image> image;
+        if(Image::isImage(_sourcePaths[index])) {
+            image = std::make_shared<Image>(_sourcePaths[index]);
+            vm->load(image->words(), image->size());
+        } else if(_cache) {
+            image = _cache->compile(SourceBuffer::fromFile(_sourcePaths[index]));
+            vm->load(image->words(), image->size());
+        } else {
+            Assembler assembler(SourceBuffer::fromFile(_sourcePaths[index]));
+            vm->load(assembler.compile());
+        }
+        vm->reset();
+
+        scheduler.spawn(vm, [this, index, output, image](std::exception_ptr error) {
+            finishJob(index, *output, error);
+        });
+    } catch(...) {
+        finishJob(index, *output, std::current_exception());
+    }
+}
+
+void BatchRunner::finishJob(size_t index, StringSink &output, std::exception_ptr error) {
+    BatchResult &result = _results[index];
+
+    result.status = BatchResult::OkStatus;
+    if(error) {
+        result.status = BatchResult::FailedStatus;
+        try {
+            std::rethrow_exception(error);
+        } catch(VM::LimitException &e) {
+            result.error = e.what();
+            result.status = BatchResult::LimitStatus;
+        } catch(std::exception &e) {
+            result.error = e.what();
+        } catch(...) {
+            result.error = "unknown error";
+        }
+    }
+
+    result.output = output.str();
+    result.truncated = output.truncated();
+}
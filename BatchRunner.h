@@ -0,0 +1,91 @@
+/// Copyright (c) 2015 Jakub Trzebiatowski
+///
+/// Licensed under the Apache License, Version 2.0 (the "License");
+/// you may not use this file except in compliance with the License.
+/// You may obtain a copy of the License at
+///
+///     http://www.apache.org/licenses/LICENSE-2.0
+///
+/// Unless required by applicable law or agreed to in writing, software
+/// distributed under the License is distributed on an "AS IS" BASIS,
+/// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+/// See the License for the specific language governing permissions and
+/// limitations under the License.
+
+#ifndef AGHSM_BATCHRUNNER_H
+#define AGHSM_BATCHRUNNER_H
+
+#include "CompileCache.h"
+#include "OutputSink.h"
+#include "Scheduler.h"
+#include "ThreadPool.h"
+#include "VM.h"
+
+#include <exception>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
+
+struct BatchResult {
+    enum Status {
+        PendingStatus,
+        OkStatus,
+        FailedStatus,
+        LimitStatus, // stopped by one of the VM limits
+    };
+
+    Status status = PendingStatus;
+    std::string output;
+    bool truncated = false;
+    std::string error;
+};
+
+/// Assembles and runs many source files in parallel. Every job gets its own
+/// VM and output buffer and writes only its own result slot, so results are
+/// collected without locking. VMs are time-sliced by a Scheduler, so a
+/// program that never halts does not hold up the rest of the batch.
+class BatchRunner {
+public:
+    /// Output of a program past `outputLimit` bytes is dropped.
+    BatchRunner(std::vector<std::string> sourcePaths, VM::Engine engine,
+                uint64_t quantum = Scheduler::defaultQuantum,
+                size_t outputLimit = std::numeric_limits<size_t>::max());
+
+    /// Reads a manifest: one source path per line, blank lines and lines
+    /// starting with '#' are skipped.
+    static std::vector<std::string> readManifest(std::istream &is);
+
+    /// Limits applied to every program of the batch.
+    void setLimits(VM::Limits limits);
+
+    /// Sources are assembled through `cache`, nullptr turns caching off.
+    void setCache(CompileCache *cache);
+
+    void run(ThreadPool &pool);
+
+    const std::vector<BatchResult> &results() const;
+
+    bool allSucceeded() const;
+
+    /// True if a program failed for another reason than its limits.
+    bool anyFailed() const;
+
+    void printReport(std::ostream &os) const;
+
+private:
+    void startJob(size_t index, Scheduler &scheduler);
+
+    void finishJob(size_t index, StringSink &output, std::exception_ptr error);
+
+    std::vector<std::string> _sourcePaths;
+    std::vector<BatchResult> _results;
+    VM::Engine _engine;
+    uint64_t _quantum;
+    size_t _outputLimit;
+    VM::Limits _limits;
+    CompileCache *_cache = nullptr;
+};
+
+
+#endif //AGHSM_BATCHRUNNER_H
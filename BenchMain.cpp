@@ -0,0 +1,419 @@
+/// Copyright (c) 2015 Jakub Trzebiatowski
+///
+/// Licensed under the Apache License, Version 2.0 (the "License");
+/// you may not use this file except in compliance with the License.
+/// You may obtain a copy of the License at
+///
+///     http://www.apache.org/licenses/LICENSE-2.0
+///
+/// Unless required by applicable law or agreed to in writing, software
+/// distributed under the License is distributed on an "AS IS" BASIS,
+/// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+/// See the License for the specific language governing permissions and
+/// limitations under the License.
+
+#include "Assembler.h"
+#include "CodeEmitter.h"
+#include "Jit.h"
+#include "Lexer.h"
+#include "OutputSink.h"
+#include "Parser.h"
+#include "ProgramGenerator.h"
+#include "ThreadPool.h"
+#include "VM.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Every stage is timed on the same inputs: the loop from the README and
+// generated sources of increasing size, named by their instruction counts.
+// A repetition runs the stage enough times to take at least --min-time, so
+// tiny inputs are measured as precisely as large ones. Results are written to stdout as JSON.
+
+namespace {
+
+struct Options {
+	unsigned warmup = 2;
+	unsigned repetitions = 10;
+	std::chrono::milliseconds minTime{50};
+	bool quick = false;
+	const char *filter = "";
+};
+
+struct Input {
+	std::string name;
+	std::string source;
+};
+
+struct Result {
+	std::string name;
+	std::string stage;
+	std::string input;
+	size_t inputBytes = 0;
+	uint64_t iterations = 0; // per repetition
+	std::vector<double> samples; // nanoseconds per iteration
+	double work = 0; // per iteration, in units of `unit`
+	const char *unit = "";
+};
+
+}
+
+static const char readmeLoop[] =
+	".UNIT\n"
+	".DATA\n"
+	"a: .WORD, 3\n"
+	"cnt: .WORD, 5\n"
+	"res: .WORD, 0\n"
+	".CODE\n"
+	"loop: load, @A, (cnt)\n"
+	"jzero, end\n"
+	"load, @A, (res)\n"
+	"add, @A, (a)\n"
+	"store, @A, res\n"
+	"load, @A, (cnt)\n"
+	"sub, @A, 1\n"
+	"store, @A, cnt\n"
+	"jump, loop\n"
+	"end: print, (res)\n"
+	"dump\n"
+	"halt\n"
+	".END\n";
+
+// The README loop, counting down from `count`, without the final dump
+static std::string countingLoop(int count) {
+	std::string source = readmeLoop;
+	source.replace(source.find("cnt: .WORD, 5"), 13, "cnt: .WORD, " + std::to_string(count));
+	source.erase(source.find("dump\n"), 5);
+	return source;
+}
+
+// A loop using every addressing mode, multiplication, division and jumps
+// which go either way
+static std::string mixedLoop(int count) {
+	return ".UNIT\n"
+		".DATA\n"
+		"n: .WORD, " + std::to_string(count) + "\n"
+		"x: .WORD, 1\n"
+		"ptr: .WORD, x\n"
+		"limit: .WORD, 1000000\n"
+		"steps: .WORD, 0\n"
+		".CODE\n"
+		"loop: load, @A, (n)\n"
+		"jzero, end\n"
+		"load, @B, ((ptr))\n"
+		"mult, @B, 3\n"
+		"add, @B, 7\n"
+		"store, @B, x\n"
+		"sub, @B, (limit)\n"
+		"jneg, small\n"
+		"load, @B, (x)\n"
+		"div, @B, 97\n"
+		"store, @B, x\n"
+		"load, @B, (steps)\n"
+		"add, @B, 1\n"
+		"store, @B, steps\n"
+		"small: sub, @A, 1\n"
+		"store, @A, n\n"
+		"jump, loop\n"
+		"end: print, (x)\n"
+		"print, (steps)\n"
+		"halt\n"
+		".END\n";
+}
+
+// Assembly-only sources of `instructions` instructions, the largest ones
+// several megabytes long
+static std::string generatedSource(size_t instructions) {
+	ProgramGenerator::Options options;
+	options.words = instructions / 16;
+	options.multinumbers = instructions / 64;
+	options.labels = instructions / 8;
+	options.instructions = instructions;
+	return ProgramGenerator(options).generate();
+}
+
+// A program which runs long enough to be timed, with every kind of
+// instruction and some self-modifying code
+static std::string generatedProgram() {
+	ProgramGenerator::Options options;
+	options.instructions = 2000;
+	options.loopDepth = 3;
+	options.loopIterations = 40;
+	options.selfModifying = 0.05;
+	return ProgramGenerator(options).generate();
+}
+
+// Keeps the compiler from discarding the benchmarked work
+static volatile size_t sink;
+
+static Result measure(const Options &options, const std::string &stage, const std::string &input,
+                      const std::function<double()> &body) {
+	typedef std::chrono::steady_clock Clock;
+
+	Result result;
+	result.name = stage + "/" + input;
+	result.stage = stage;
+	result.input = input;
+
+	auto repetition = [&body, &result](uint64_t iterations) {
+		auto start = Clock::now();
+		for (uint64_t i = 0; i < iterations; ++i) {
+			result.work = body();
+		}
+		return std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+	};
+
+	// Grow the iteration count until a repetition takes long enough
+	const double minTime = std::chrono::duration<double, std::nano>(options.minTime).count();
+	uint64_t iterations = 1;
+	for (double elapsed = repetition(iterations); elapsed < minTime; elapsed = repetition(iterations)) {
+		double factor = elapsed > 0 ? 1.2 * minTime / elapsed : 10;
+		iterations = static_cast<uint64_t>(std::ceil(iterations * std::min(std::max(factor, 2.0), 10.0)));
+	}
+	result.iterations = iterations;
+
+	for (unsigned i = 0; i < options.warmup; ++i) {
+		repetition(iterations);
+	}
+	for (unsigned i = 0; i < options.repetitions; ++i) {
+		result.samples.push_back(repetition(iterations) / iterations);
+	}
+	return result;
+}
+
+static bool selected(const Options &options, const std::string &name) {
+	return name.find(options.filter) != std::string::npos;
+}
+
+static void printNumber(std::ostream &os, double value) {
+	os << (std::isfinite(value) ? value : 0);
+}
+
+static void printResult(std::ostream &os, const Options &options, const Result &result) {
+	std::vector<double> sorted = result.samples;
+	std::sort(sorted.begin(), sorted.end());
+	const size_t n = sorted.size();
+
+	double mean = 0;
+	for (double sample : sorted) {
+		mean += sample;
+	}
+	mean /= n;
+	double variance = 0;
+	for (double sample : sorted) {
+		variance += (sample - mean) * (sample - mean);
+	}
+	variance = n > 1 ? variance / (n - 1) : 0;
+	double median = n % 2 ? sorted[n / 2] : (sorted[n / 2 - 1] + sorted[n / 2]) / 2;
+
+	os << "    {\n";
+	os << "      \"name\": \"" << result.name << "\",\n";
+	os << "      \"stage\": \"" << result.stage << "\",\n";
+	os << "      \"input\": \"" << result.input << "\",\n";
+	os << "      \"input_bytes\": " << result.inputBytes << ",\n";
+	os << "      \"warmup\": " << options.warmup << ",\n";
+	os << "      \"repetitions\": " << n << ",\n";
+	os << "      \"iterations\": " << result.iterations << ",\n";
+	os << "      \"mean_ns\": "; printNumber(os, mean); os << ",\n";
+	os << "      \"median_ns\": "; printNumber(os, median); os << ",\n";
+	os << "      \"min_ns\": "; printNumber(os, sorted.front()); os << ",\n";
+	os << "      \"max_ns\": "; printNumber(os, sorted.back()); os << ",\n";
+	os << "      \"stddev_ns\": "; printNumber(os, std::sqrt(variance)); os << ",\n";
+	os << "      \"variance_ns2\": "; printNumber(os, variance); os << ",\n";
+	os << "      \"cv\": "; printNumber(os, std::sqrt(variance) / mean); os << ",\n";
+	os << "      \"throughput\": "; printNumber(os, result.work * 1e9 / median); os << ",\n";
+	os << "      \"throughput_unit\": \"" << result.unit << "\",\n";
+	os << "      \"samples_ns\": [";
+	for (size_t i = 0; i < result.samples.size(); ++i) {
+		os << (i ? ", " : "");
+		printNumber(os, result.samples[i]);
+	}
+	os << "]\n";
+	os << "    }";
+}
+
+static void usage() {
+	std::cerr << "Usage: aghsm_bench [--filter=SUBSTRING] [--warmup=N] [--repetitions=N] [--min-time=MS] [--quick]" << std::endl;
+}
+
+int main(int argc, char **argv) {
+	Options options;
+
+	for (int i = 1; i < argc; ++i) {
+		if (!std::strncmp(argv[i], "--filter=", 9)) {
+			options.filter = argv[i] + 9;
+		} else if (!std::strncmp(argv[i], "--warmup=", 9)) {
+			options.warmup = std::atoi(argv[i] + 9);
+		} else if (!std::strncmp(argv[i], "--repetitions=", 14)) {
+			options.repetitions = std::max(1, std::atoi(argv[i] + 14));
+		} else if (!std::strncmp(argv[i], "--min-time=", 11)) {
+			options.minTime = std::chrono::milliseconds(std::atoi(argv[i] + 11));
+		} else if (!std::strcmp(argv[i], "--quick")) {
+			options.quick = true;
+			options.warmup = 1;
+			options.repetitions = 3;
+			options.minTime = std::chrono::milliseconds(10);
+		} else {
+			usage();
+			return 1;
+		}
+	}
+
+	std::vector<Input> sources = {
+		{"readme", readmeLoop},
+		{"gen-4k", generatedSource(4 * 1024)},
+		{"gen-64k", generatedSource(64 * 1024)},
+	};
+	if (!options.quick) {
+		sources.push_back({"gen-512k", generatedSource(512 * 1024)});
+	}
+
+	std::vector<Input> programs = {
+		{"readme", readmeLoop},
+		{"loop-1m", countingLoop(1000000)},
+		{"mixed-1m", mixedLoop(1000000)},
+		{"generated", generatedProgram()},
+	};
+
+	std::vector<std::pair<const char *, VM::Engine>> engines = {
+		{"reference", VM::ReferenceEngine},
+		{"threaded", VM::ThreadedEngine},
+	};
+	if (AGHSM_JIT_SUPPORTED) {
+		engines.push_back({"jit", VM::JitEngine});
+	}
+
+	std::vector<Result> results;
+	auto add = [&results](Result result, size_t inputBytes, const char *unit) {
+		std::cerr << result.name << std::endl;
+		result.inputBytes = inputBytes;
+		result.unit = unit;
+		results.push_back(result);
+	};
+
+	try {
+		for (const Input &input : sources) {
+			std::istringstream ss(input.source);
+			TokenStream tokens = Lexer(ss).lex();
+			Ast ast = Parser(tokens).parse();
+			std::vector<Word> program = CodeEmitter(ast).emitCode();
+			const double megabytes = input.source.size() / 1e6;
+
+			if (selected(options, "lex/" + input.name)) {
+				add(measure(options, "lex", input.name, [&input, megabytes]() {
+					std::istringstream ss(input.source);
+					sink = Lexer(ss).lex().size();
+					return megabytes;
+				}), input.source.size(), "MB/s");
+			}
+			if (selected(options, "parse/" + input.name)) {
+				add(measure(options, "parse", input.name, [&tokens, megabytes]() {
+					sink = Parser(tokens).parse().statements.size();
+					return megabytes;
+				}), input.source.size(), "MB/s");
+			}
+			if (selected(options, "emit/" + input.name)) {
+				add(measure(options, "emit", input.name, [&ast, megabytes]() {
+					sink = CodeEmitter(ast).emitCode().size();
+					return megabytes;
+				}), input.source.size(), "MB/s");
+			}
+			if (selected(options, "assemble/" + input.name)) {
+				auto buffer = SourceBuffer::fromString(input.source);
+				add(measure(options, "assemble", input.name, [&buffer, megabytes]() {
+					sink = Assembler(buffer).compile().size();
+					return megabytes;
+				}), input.source.size(), "MB/s");
+			}
+			if (selected(options, "assemble-optimized/" + input.name)) {
+				auto buffer = SourceBuffer::fromString(input.source);
+				add(measure(options, "assemble-optimized", input.name, [&buffer, megabytes]() {
+					Assembler assembler(buffer);
+					assembler.setOptimization(true);
+					sink = assembler.compile().size();
+					return megabytes;
+				}), input.source.size(), "MB/s");
+			}
+			if (selected(options, "assemble-parallel/" + input.name) &&
+			    input.source.size() >= Assembler::parallelSourceSize) {
+				auto buffer = SourceBuffer::fromString(input.source);
+				ThreadPool pool;
+				add(measure(options, "assemble-parallel", input.name, [&buffer, &pool, megabytes]() {
+					Assembler assembler(buffer);
+					assembler.setThreadPool(&pool);
+					sink = assembler.compile().size();
+					return megabytes;
+				}), input.source.size(), "MB/s");
+			}
+			if (selected(options, "print/" + input.name)) {
+				add(measure(options, "print", input.name, [&program]() {
+					std::string text;
+					printProgram(text, program);
+					sink = text.size();
+					return program.size() / 1e6;
+				}), input.source.size(), "Mwords/s");
+			}
+		}
+
+		for (const Input &input : programs) {
+			std::istringstream ss(input.source);
+			TokenStream tokens = Lexer(ss).lex();
+			Ast ast = Parser(tokens).parse();
+			std::vector<Word> program = CodeEmitter(ast).emitCode();
+
+			for (const auto &engine : engines) {
+				std::string stage = std::string("run-") + engine.first;
+				if (!selected(options, stage + "/" + input.name)) {
+					continue;
+				}
+
+				// The output is not what is measured, keep only its beginning
+				StringSink output(4096);
+				VM vm;
+				vm.setEngine(engine.second);
+				vm.setOutputSink(output);
+				add(measure(options, stage, input.name, [&vm, &program]() {
+					vm.load(program);
+					vm.run();
+					return vm.instructionCount() / 1e6;
+				}), input.source.size(), "MIPS");
+			}
+		}
+	} catch (std::exception &e) {
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
+
+	std::cout << std::setprecision(10);
+	std::cout << "{\n";
+	std::cout << "  \"context\": {\n";
+#ifdef __VERSION__
+	std::cout << "    \"compiler\": \"" << __VERSION__ << "\",\n";
+#endif
+#ifdef __OPTIMIZE__
+	std::cout << "    \"optimized\": true,\n";
+#else
+	std::cout << "    \"optimized\": false,\n";
+#endif
+	std::cout << "    \"hardware_threads\": " << std::thread::hardware_concurrency() << ",\n";
+	std::cout << "    \"min_time_ms\": " << options.minTime.count() << "\n";
+	std::cout << "  },\n";
+	std::cout << "  \"benchmarks\": [\n";
+	for (size_t i = 0; i < results.size(); ++i) {
+		printResult(std::cout, options, results[i]);
+		std::cout << (i + 1 < results.size() ? ",\n" : "\n");
+	}
+	std::cout << "  ]\n";
+	std::cout << "}" << std::endl;
+	return 0;
+}
@@ -12,121 +12,597 @@
 /// See the License for the specific language governing permissions and
 /// limitations under the License.
 
-#include <iomanip>
+#include <algorithm>
+#include <atomic>
 #include <string>
 #include "CodeEmitter.h"
+#include "Image.h"
 #include "Language.h"
 
+// Appends `field` left-aligned in a column of `width` characters.
+static void appendColumn(std::string &text, const std::string &field, size_t width) {
+    text += field;
+    if(field.size() < width) {
+        text.append(width - field.size(), ' ');
+    }
+}
+
 void printProgram(std::ostream &os, const std::vector<Word> &words) {
-    const int numInstructions = sizeof(instructions) / sizeof(instructions[0]);
+    std::string text;
+    printProgram(text, words);
+    os << text << std::flush;
+}
+
+void printProgram(std::string &text, const std::vector<Word> &words) {
+    printProgram(text, words.data(), words.size());
+}
 
-    auto left = std::left;
+void printProgram(std::string &text, const Word *words, size_t size) {
+    for(size_t i = 0; i < size; ++i) {
+        printWord(text, static_cast<int>(i * 4), words[i]);
+    }
+}
 
-    int i = 0;
-    for(const Word &word : words) {
-        os << left << std::setw(6) << std::to_string(i * 4) + ":";
-        ++i;
+void printWord(std::string &text, int address, Word word) {
+    appendColumn(text, std::to_string(address) + ":", 6);
 
-        Instruction inst = word.instruction;
+    Instruction inst = word.instruction;
 
-        os << std::setw(6) << (inst.code < numInstructions ? instructions[inst.code] : "----");
+    appendColumn(text, inst.code < numInstructions ? isa[inst.code].name : "----", 6);
 
-        os << std::setw(3) << (std::string{} + "@" + (inst.acu ? 'B' : 'A'));
+    appendColumn(text, std::string{} + "@" + (inst.acu ? 'B' : 'A'), 3);
 
-        std::string p0, p1;
-        if(inst.mod == 0) {
-            p0 = "", p1 = "";
-        } else if(inst.mod == 1) {
-            p0 = "(", p1 = ")";
-        } else {
-            p0 = "((", p1 = "))";
-        }
+    std::string p0, p1;
+    if(inst.mod == 0) {
+        p0 = "", p1 = "";
+    } else if(inst.mod == 1) {
+        p0 = "(", p1 = ")";
+    } else {
+        p0 = "((", p1 = "))";
+    }
+
+    appendColumn(text, p0 + std::to_string(inst.adr) + p1, 8);
+
+    text += "[";
+    appendColumn(text, std::to_string(word.data), 10);
+    text += "]\n";
+}
 
-        os << std::setw(8) << p0 + std::to_string(inst.adr) + p1;
+CodeEmitter::CodeEmitter() {
+    Word main;
+    main.data = 0;
+    emitWord(main);
+}
 
-        os << "[" << std::setw(10) << std::to_string(word.data) << "]";
+CodeEmitter::CodeEmitter(const Ast &ast) : CodeEmitter() {
+    _ast = &ast;
+}
 
-        os << std::endl;
+CodeEmitter::CodeEmitter(Section section) : _currentSection(section), _mainLabel(-1) {
+}
+
+CodeEmitter CodeEmitter::part(Section section) {
+    return CodeEmitter(section);
+}
+
+// The error of a statement which does not belong in `section`
+
+const char *CodeEmitter::sectionError(Section section) {
+    switch(section) {
+        case NullSection:
+            return "code should start with .UNIT section";
+        case UnitSection:
+            return "data section should follow after .UNIT section";
+        case DataSection:
+            return "data section can contain only .WORD directives and references";
+        case CodeSection:
+            return "data section can contain only .WORD directives and labels";
+        case EndSection:
+            return "no code allowed after .END";
+        default:
+            return "critical error";
     }
 }
 
-CodeEmitter::CodeEmitter(const Ast &ast) : _ast(ast) {
-    int i = 0;
-    for(auto instruction : instructions) {
-        _opcodes[instruction] = i;
-        ++i;
+// The error the opening of a part would have caused in `section`, nullptr if
+// none. The part went on as if the directive ending its opening was right, so
+// if the opening is right in `section`, so is the rest of the part.
+
+const char *CodeEmitter::openingError(Section section, const Opening &opening) {
+    bool wrong;
+    switch(section) {
+        case NullSection:
+            wrong = opening.statements || (opening.directive >= 0 && opening.directive != UnitDirective);
+            break;
+        case UnitSection:
+            wrong = opening.statements || (opening.directive >= 0 && opening.directive != DataDirective);
+            break;
+        case DataSection:
+            wrong = opening.instructions || (opening.directive >= 0 && opening.directive != CodeDirective);
+            break;
+        case CodeSection:
+            wrong = opening.words || (opening.directive >= 0 && opening.directive != EndDirective);
+            break;
+        default:
+            wrong = opening.statements || opening.directive >= 0;
     }
+    return wrong ? sectionError(section) : nullptr;
 }
 
 #if 1
 
 std::vector<Word> CodeEmitter::emitCode() {
-    Word main;
-    main.data = 0;
-    emitWord(main);
+    emit(*_ast);
+    return finish();
+}
 
-    for(const AstNode node : _ast.rootNode.children) {
-        switch(_currentSection) {
-            case NullSection: {
-                if(node.type == AstNode::DirectiveNode && node.sValue == ".UNIT") {
-                    _currentSection = UnitSection;
-                } else {
-                    emitterError("code should start with .UNIT section");
-                }
-                break;
+void CodeEmitter::emit(const Ast &ast) {
+    _ast = &ast;
+    _symbols = ast.symbols;
+    for(const AstNode &statement : ast.statements) {
+        emitNode(statement);
+    }
+}
+
+void CodeEmitter::emitNode(const AstNode &node) {
+    _currentLine = node.lineNumber;
+
+    switch(_currentSection) {
+        case NullSection: {
+            if(node.type == AstNode::DirectiveNode && node.aValue == UnitDirective) {
+                enterSection(UnitSection);
+            } else {
+                emitterError(sectionError(_currentSection));
             }
-            case UnitSection: {
-                if(node.type == AstNode::DirectiveNode && node.sValue == ".DATA") {
-                    _currentSection = DataSection;
-                } else {
-                    emitterError("data section should follow after .UNIT section");
+            break;
+        }
+        case UnitSection: {
+            if(node.type == AstNode::DirectiveNode && node.aValue == DataDirective) {
+                enterSection(DataSection);
+            } else {
+                emitterError(sectionError(_currentSection));
+            }
+            break;
+        }
+        case DataSection: {
+            if(node.type == AstNode::DirectiveNode && node.aValue == CodeDirective) {
+                _mainLabel = _words.size();
+                enterSection(CodeSection);
+            } else if(node.type == AstNode::LabelNode) {
+                defineLabel(node.aValue);
+            } else if(node.type == AstNode::DirectiveNode && node.aValue == WordDirective) {
+                emitDataWords(_ast->children(node));
+            } else {
+                emitterError(sectionError(_currentSection));
+            }
+            break;
+        }
+        case CodeSection: {
+            if(node.type == AstNode::DirectiveNode && node.aValue == EndDirective) {
+                enterSection(EndSection);
+            } else if(node.type == AstNode::LabelNode) {
+                defineLabel(node.aValue);
+            } else if(node.type == AstNode::InstructionNode) {
+                emitInstruction(node);
+            } else {
+                emitterError(sectionError(_currentSection));
+            }
+            break;
+        }
+        case EndSection: {
+            emitterError(sectionError(_currentSection));
+            break;
+        }
+        case UnknownSection: {
+            emitOpening(node);
+            break;
+        }
+        default: {
+            emitterError("critical error");
+        }
+    }
+}
+
+// Until its first section directive, a part takes any statement some section
+// would, and notes what it took for join() to check. The directive is then
+// assumed to be right, which join() checks too.
+
+void CodeEmitter::emitOpening(const AstNode &node) {
+    if(node.type == AstNode::DirectiveNode && node.aValue != WordDirective) {
+        _opening.directive = node.aValue;
+        if(node.aValue == UnitDirective) {
+            enterSection(UnitSection);
+        } else if(node.aValue == DataDirective) {
+            enterSection(DataSection);
+        } else if(node.aValue == CodeDirective) {
+            _mainLabel = _words.size();
+            enterSection(CodeSection);
+        } else {
+            enterSection(EndSection);
+        }
+        return;
+    }
+
+    _opening.statements = true;
+    if(node.type == AstNode::LabelNode) {
+        defineLabel(node.aValue);
+    } else if(node.type == AstNode::DirectiveNode) {
+        _opening.words = true;
+        emitDataWords(_ast->children(node));
+    } else {
+        _opening.instructions = true;
+        emitInstruction(node);
+    }
+}
+
+// Parts are checked in order, each in the section the one before it ended in,
+// so the first error is the one emitting them one after another would have
+// thrown. A wrong opening comes before anything else that stopped a part.
+// Labels are merged in order too, a later definition replacing an earlier
+// one. Then every part is copied into place and its references resolved in a
+// task of its own.
+
+void CodeEmitter::join(std::vector<CodeEmitter> &parts, const std::vector<std::exception_ptr> &errors,
+                       ThreadPool &pool) {
+    auto symbols = std::make_shared<SymbolTable>();
+    for(uint32_t symbol = 0; _symbols && symbol < _symbols->size(); ++symbol) {
+        symbols->intern(_symbols->name(symbol));
+    }
+
+    std::vector<size_t> bases(parts.size());
+    std::vector<std::vector<uint32_t>> partSymbols(parts.size()); // symbol in `symbols` of every symbol of a part
+    size_t size = _words.size();
+    for(size_t i = 0; i < parts.size(); ++i) {
+        CodeEmitter &part = parts[i];
+        const char *error = openingError(_currentSection, part._opening);
+        if(error) {
+            emitterError(error);
+        }
+        if(errors[i]) {
+            std::rethrow_exception(errors[i]);
+        }
+
+        if(part._currentSection != UnknownSection) {
+            _currentSection = part._currentSection;
+        }
+        _sections.insert(_sections.end(), part._sections.begin(), part._sections.end());
+        if(part._mainLabel >= 0) {
+            _mainLabel = size + part._mainLabel;
+        }
+        bases[i] = size;
+        size += part._words.size();
+
+        std::vector<uint32_t> &partSymbol = partSymbols[i];
+        partSymbol.resize(part._symbols ? part._symbols->size() : 0);
+        for(uint32_t symbol = 0; symbol < partSymbol.size(); ++symbol) {
+            partSymbol[symbol] = symbols->intern(part._symbols->name(symbol));
+        }
+        for(uint32_t symbol = 0; symbol < part._labels.size(); ++symbol) {
+            if(part._labels[symbol] >= 0) {
+                uint32_t label = partSymbol[symbol];
+                if(label >= _labels.size()) {
+                    _labels.resize(label + 1, -1);
+                    _definitionCounts.resize(label + 1, 0);
                 }
-                break;
+                _labels[label] = bases[i] + part._labels[symbol];
+                _definitionCounts[label] += part._definitionCounts[symbol];
             }
-            case DataSection: {
-                if(node.type == AstNode::DirectiveNode && node.sValue == ".CODE") {
-                    _mainLabel = _words.size();
-                    _currentSection = CodeSection;
-                } else if(node.type == AstNode::LabelNode) {
-                    _labels[node.sValue] = _words.size();
-                } else if(node.type == AstNode::DirectiveNode && node.sValue == ".WORD") {
-                    emitDataWords(node.children);
+        }
+        for(auto definition : part._definitions) {
+            _definitions.push_back({definition.first, partSymbol[definition.second]});
+        }
+    }
+    _symbols = symbols;
+
+    _words.resize(size);
+    _lineNumbers.resize(size);
+    std::atomic<bool> unresolvedData(false);
+    std::atomic<bool> unresolved(false);
+    for(size_t i = 0; i < parts.size(); ++i) {
+        pool.submit([this, &parts, &bases, &partSymbols, &unresolvedData, &unresolved, i]() {
+            CodeEmitter &part = parts[i];
+            const std::vector<uint32_t> &partSymbol = partSymbols[i];
+            std::copy(part._words.begin(), part._words.end(), _words.begin() + bases[i]);
+            std::copy(part._lineNumbers.begin(), part._lineNumbers.end(), _lineNumbers.begin() + bases[i]);
+
+            for(auto p : part._dataReferences) {
+                uint32_t dataReference = partSymbol[p.first];
+                if(dataReference >= _labels.size() || _labels[dataReference] < 0) {
+                    unresolvedData = true;
                 } else {
-                    emitterError("data section can contain only .WORD directives and references");
+                    _words[bases[i] + p.second].data = _labels[dataReference] * 4;
                 }
-                break;
             }
-            case CodeSection: {
-                if(node.type == AstNode::DirectiveNode && node.sValue == ".END") {
-                    _currentSection = EndSection;
-                } else if(node.type == AstNode::LabelNode) {
-                    _labels[node.sValue] = _words.size();
-                } else if(node.type == AstNode::InstructionNode) {
-                    emitInstruction(node);
+            for(auto p : part._references) {
+                uint32_t reference = partSymbol[p.first];
+                if(reference >= _labels.size() || _labels[reference] < 0) {
+                    unresolved = true;
                 } else {
-                    emitterError("data section can contain only .WORD directives and labels");
+                    _words[bases[i] + p.second].instruction.adr = _labels[reference] * 4;
                 }
-                break;
             }
-            case EndSection: {
-                emitterError("no code allowed after .END");
-                break;
+
+            part = CodeEmitter(UnknownSection); // frees it
+        });
+    }
+    pool.wait();
+
+    if(unresolvedData) {
+        emitterError("unresolved data reference");
+    } else if(unresolved) {
+        emitterError("unresolved reference");
+    }
+}
+
+void CodeEmitter::enterSection(Section section) {
+    _currentSection = section;
+    _sections.push_back({_currentLine, section});
+}
+
+std::vector<Word> CodeEmitter::finish() {
+    resolveReferences();
+
+    _words[0].data = _mainLabel * 4;
+
+    _labelsByName.clear();
+    for(uint32_t symbol = 0; symbol < _labels.size(); ++symbol) {
+        if(_labels[symbol] >= 0) {
+            _labelsByName[_symbols->name(symbol).str()] = _labels[symbol];
+        }
+    }
+
+    return _words;
+}
+
+// References to labels of the unit are resolved like in finish(), but from
+// the start of the unit, and are relocated when it is linked. Every other
+// symbol is imported once, unless it is local to the unit.
+
+Object CodeEmitter::finishObject() {
+    Object object;
+    std::vector<int> imports(_symbols ? _symbols->size() : 0, -1); // by symbol
+    auto relocate = [this, &object, &imports](uint32_t symbol, int word, bool data) {
+        Object::Relocation relocation = {static_cast<uint32_t>(word), data, -1};
+        int address = 0;
+        if(symbol < _labels.size() && _labels[symbol] >= 0) {
+            address = _labels[symbol] * 4;
+        } else if(_symbols->name(symbol)[0] == '.') {
+            emitterError(data ? "unresolved data reference" : "unresolved reference");
+        } else {
+            if(imports[symbol] < 0) {
+                imports[symbol] = object.imports.size();
+                object.imports.push_back(_symbols->name(symbol).str());
             }
-            default: {
-                emitterError("critical error");
+            relocation.import = imports[symbol];
+        }
+        if(data) {
+            _words[word].data = address;
+        } else {
+            _words[word].instruction.adr = address;
+        }
+        object.relocations.push_back(relocation);
+    };
+    for(auto p : _dataReferences) {
+        relocate(p.first, p.second, true);
+    }
+    for(auto p : _references) {
+        relocate(p.first, p.second, false);
+    }
+
+    for(uint32_t symbol = 0; symbol < _labels.size(); ++symbol) {
+        if(_labels[symbol] >= 0 && _symbols->name(symbol)[0] != '.') {
+            object.exports[_symbols->name(symbol).str()] = _labels[symbol];
+        }
+    }
+    object.codeStart = _mainLabel;
+    object.words = _words;
+    object.lineNumbers = _lineNumbers;
+    return object;
+}
+
+CodeEmitter::Section CodeEmitter::sectionAt(int line) const {
+    Section section = NullSection;
+    for(auto entered : _sections) {
+        if(entered.first >= line) {
+            break;
+        }
+        section = entered.second;
+    }
+    return section;
+}
+
+// Replaces [first, end) of `items` with `replacement`
+template<typename T>
+static void replaceRange(std::vector<T> &items, size_t first, size_t end, const std::vector<T> &replacement) {
+    items.erase(items.begin() + first, items.begin() + end);
+    items.insert(items.begin() + first, replacement.begin(), replacement.end());
+}
+
+// First of `items`, sorted by `key`, whose key is at least `value`
+template<typename T, typename Key>
+static size_t lowerBound(const std::vector<T> &items, size_t first, int value, Key key) {
+    return std::lower_bound(items.begin() + first, items.end(), value, [&key](const T &item, int value) {
+        return key(item) < value;
+    }) - items.begin();
+}
+
+// Puts `partReferences` in place of the references of words [firstWord,
+// endWord), moving the ones after them by `wordDelta`. Then resolves the new
+// ones, and the ones to labels in `moved` unless it is null. Returns false if
+// any of them is left unresolved.
+
+template<typename Resolve>
+static bool spliceReferences(std::vector<std::pair<uint32_t, int>> &references,
+                             std::vector<std::pair<uint32_t, int>> &partReferences, size_t firstWord,
+                             size_t endWord, int wordDelta, const std::vector<int> &labels,
+                             const std::vector<bool> *moved, Resolve resolve) {
+    auto wordOf = [](const std::pair<uint32_t, int> &reference) { return reference.second; };
+    size_t first = lowerBound(references, 0, firstWord, wordOf);
+    size_t end = lowerBound(references, first, endWord, wordOf);
+    for(size_t i = end; i < references.size(); ++i) {
+        references[i].second += wordDelta;
+    }
+    for(auto &reference : partReferences) {
+        reference.second += firstWord;
+    }
+    replaceRange(references, first, end, partReferences);
+    end = first + partReferences.size();
+
+    bool resolved = true;
+    for(size_t i = moved ? 0 : first; i < (moved ? references.size() : end); ++i) {
+        uint32_t symbol = references[i].first;
+        if((i < first || i >= end) && (symbol >= moved->size() || !(*moved)[symbol])) {
+            continue;
+        }
+        if(symbol >= labels.size() || labels[symbol] < 0) {
+            resolved = false;
+        } else {
+            resolve(references[i].second, labels[symbol]);
+        }
+    }
+    return resolved;
+}
+
+// Words, references, labels and sections are all kept in the order of the
+// source, so the ones of the replaced lines are found by binary search. The
+// ones after them move with plain passes over integers; the source of the
+// rest of the program is never looked at again.
+
+bool CodeEmitter::splice(int firstLine, int lastLine, int lineDelta, CodeEmitter &part) {
+    if(part._currentSection != sectionAt(lastLine + 1)) {
+        return false;
+    }
+
+    auto lineOf = [](const std::pair<int, uint32_t> &definition) { return definition.first; };
+    size_t firstDefinition = lowerBound(_definitions, 0, firstLine, lineOf);
+    size_t endDefinition = lowerBound(_definitions, firstDefinition, lastLine + 1, lineOf);
+
+    // A label defined more than once is where its last definition is, and
+    // finding that takes emitting everything again
+    for(size_t i = firstDefinition; i < endDefinition; ++i) {
+        if(_definitionCounts[_definitions[i].second] > 1) {
+            return false;
+        }
+    }
+    for(size_t i = firstDefinition; i < endDefinition; ++i) {
+        --_definitionCounts[_definitions[i].second];
+    }
+    for(auto definition : part._definitions) {
+        uint32_t symbol = definition.second;
+        int count = symbol < _definitionCounts.size() ? _definitionCounts[symbol] : 0;
+        if(count + part._definitionCounts[symbol] > 1) {
+            for(size_t i = firstDefinition; i < endDefinition; ++i) {
+                ++_definitionCounts[_definitions[i].second];
             }
+            return false;
         }
     }
 
-    resolveReferences();
+    auto lineOfWord = [](int line) { return line; };
+    size_t firstWord = lowerBound(_lineNumbers, 1, firstLine, lineOfWord);
+    size_t endWord = lowerBound(_lineNumbers, firstWord, lastLine + 1, lineOfWord);
+    int wordDelta = static_cast<int>(part._words.size()) - static_cast<int>(endWord - firstWord);
 
+    bool mainMoves = false;
+    for(auto entered : _sections) {
+        mainMoves = mainMoves || (entered.second == CodeSection && entered.first > lastLine);
+    }
+
+    // Labels of the replaced lines are gone, the ones after them move
+    if(part._labels.size() > _labels.size()) {
+        _labels.resize(part._labels.size(), -1);
+        _definitionCounts.resize(part._labels.size(), 0);
+    }
+    std::vector<bool> moved(_labels.size());
+    bool anyMoved = false;
+    for(size_t i = firstDefinition; i < endDefinition; ++i) {
+        _labels[_definitions[i].second] = -1;
+        moved[_definitions[i].second] = true;
+        anyMoved = true;
+    }
+    for(size_t i = endDefinition; i < _definitions.size(); ++i) {
+        _definitions[i].first += lineDelta;
+        if(wordDelta && !moved[_definitions[i].second]) {
+            _labels[_definitions[i].second] += wordDelta;
+            moved[_definitions[i].second] = true;
+            anyMoved = true;
+        }
+    }
+    for(uint32_t symbol = 0; symbol < part._labels.size(); ++symbol) {
+        if(part._labels[symbol] >= 0) {
+            _labels[symbol] = firstWord + part._labels[symbol];
+            _definitionCounts[symbol] += part._definitionCounts[symbol];
+            moved[symbol] = true;
+            anyMoved = true;
+        }
+    }
+    replaceRange(_definitions, firstDefinition, endDefinition, part._definitions);
+
+    auto lineOfSection = [](const std::pair<int, Section> &entered) { return entered.first; };
+    size_t firstSection = lowerBound(_sections, 0, firstLine, lineOfSection);
+    size_t endSection = lowerBound(_sections, firstSection, lastLine + 1, lineOfSection);
+    for(size_t i = endSection; i < _sections.size(); ++i) {
+        _sections[i].first += lineDelta;
+    }
+    replaceRange(_sections, firstSection, endSection, part._sections);
+
+    replaceRange(_words, firstWord, endWord, part._words);
+    replaceRange(_lineNumbers, firstWord, endWord, part._lineNumbers);
+    if(lineDelta) {
+        for(size_t i = firstWord + part._words.size(); i < _lineNumbers.size(); ++i) {
+            _lineNumbers[i] += lineDelta;
+        }
+    }
+
+    if(part._mainLabel >= 0) {
+        _mainLabel = firstWord + part._mainLabel;
+    } else if(mainMoves) {
+        _mainLabel += wordDelta;
+    }
     _words[0].data = _mainLabel * 4;
 
+    // References of the new lines are resolved, and the ones to labels which
+    // moved. Data references are checked first, like in finish().
+    const std::vector<bool> *movedLabels = anyMoved ? &moved : nullptr;
+    bool dataResolved = spliceReferences(_dataReferences, part._dataReferences, firstWord, endWord, wordDelta,
+                                         _labels, movedLabels, [this](int word, int label) {
+                _words[word].data = label * 4;
+            });
+    bool resolved = spliceReferences(_references, part._references, firstWord, endWord, wordDelta,
+                                     _labels, movedLabels, [this](int word, int label) {
+                _words[word].instruction.adr = label * 4;
+            });
+
+    if(!dataResolved) {
+        emitterError("unresolved data reference");
+    } else if(!resolved) {
+        emitterError("unresolved reference");
+    }
+    return true;
+}
+
+const std::vector<Word> &CodeEmitter::words() const {
     return _words;
 }
 
 #endif
 
+const std::unordered_map<std::string, int> &CodeEmitter::labels() const {
+    return _labelsByName;
+}
+
+const std::vector<int> &CodeEmitter::lineNumbers() const {
+    return _lineNumbers;
+}
+
+std::vector<int> CodeEmitter::dataReferences() const {
+    std::vector<int> indices;
+    for(auto p : _dataReferences) {
+        indices.push_back(p.second);
+    }
+    return indices;
+}
+
 void CodeEmitter::emitterError(std::string errorMessage) {
     std::stringstream ss;
     ss << "Code emitter error: " << errorMessage;
@@ -135,11 +611,12 @@ void CodeEmitter::emitterError(std::string errorMessage) {
 
 void CodeEmitter::emitWord(Word word) {
     _words.push_back(word);
+    _lineNumbers.push_back(_currentLine);
 }
 
-void CodeEmitter::emitDataWords(std::vector<AstNode> words) {
+void CodeEmitter::emitDataWords(AstNodeRange words) {
     Word word;
-    for(AstNode node : words) {
+    for(const AstNode &node : words) {
         if(node.type == AstNode::NumberNode) {
             word.data = node.aValue;
             emitWord(word);
@@ -149,7 +626,7 @@ void CodeEmitter::emitDataWords(std::vector<AstNode> words) {
                 emitWord(word);
             }
         } else if(node.type == AstNode::ReferenceNode) {
-            markDataReference(node.sValue);
+            markDataReference(node.aValue);
             word.data = -2;
             emitWord(word);
         } else {
@@ -159,25 +636,25 @@ void CodeEmitter::emitDataWords(std::vector<AstNode> words) {
 
 }
 
-void CodeEmitter::emitValue(AstNode valueNode, Word word) {
+void CodeEmitter::emitValue(const AstNode &valueNode, Word word) {
     if(valueNode.type == AstNode::ReferenceNode) {
         word.instruction.mod = 0;
         word.instruction.adr = -1;
-        markReference(valueNode.sValue);
+        markReference(valueNode.aValue);
         emitWord(word);
     } else if(valueNode.type == AstNode::ParenNode) {
         word.instruction.adr = -1;
 
-        if(valueNode.children.front().type == AstNode::ReferenceNode) {
-            AstNode referenceNode = valueNode.children.front();
+        if(_ast->children(valueNode).front().type == AstNode::ReferenceNode) {
+            const AstNode &referenceNode = _ast->children(valueNode).front();
             word.instruction.mod = 1;
-            markReference(referenceNode.sValue);
-        } else if(valueNode.children.front().type == AstNode::ParenNode) {
-            AstNode secondParenNode = valueNode.children.front();
-            if(secondParenNode.children.front().type == AstNode::ReferenceNode) {
-                AstNode referenceNode = secondParenNode.children.front();
+            markReference(referenceNode.aValue);
+        } else if(_ast->children(valueNode).front().type == AstNode::ParenNode) {
+            const AstNode &secondParenNode = _ast->children(valueNode).front();
+            if(_ast->children(secondParenNode).front().type == AstNode::ReferenceNode) {
+                const AstNode &referenceNode = _ast->children(secondParenNode).front();
                 word.instruction.mod = 2;
-                markReference(referenceNode.sValue);
+                markReference(referenceNode.aValue);
             } else {
                 emitterError("wrong paren content");
             }
@@ -197,38 +674,40 @@ void CodeEmitter::emitValue(AstNode valueNode, Word word) {
 
 #if 1
 
-void CodeEmitter::emitInstruction(AstNode node) {
-    std::string name = node.sValue;
+void CodeEmitter::emitInstruction(const AstNode &node) {
+    int opcode = node.aValue;
+    OperandForm form = isa[opcode].form;
+    AstNodeRange arguments = _ast->children(node);
     Word word;
     word.data = 0;
-    word.instruction.code = _opcodes[name];
+    word.instruction.code = opcode;
 
-    if(name == "null" || name == "halt" || name == "dump") {
+    if(form == NoOperand) {
         emitWord(word);
-    } else if(name[0] == 'j') {
-        if(node.children.size() == 1 && node.children.front().type == AstNode::ReferenceNode) {
-            markReference(node.children.front().sValue);
+    } else if(form == LabelOperand) {
+        if(arguments.size() == 1 && arguments.front().type == AstNode::ReferenceNode) {
+            markReference(arguments.front().aValue);
             word.instruction.adr = -1;
             emitWord(word);
         } else {
             emitterError("wrong jump arguments");
         }
-    } else if(name == "print") {
-        if(node.children.size() == 1) {
-            if(node.children.front().type == AstNode::RegisterNode) {
-                word.instruction.acu = node.children.front().sValue == "B" ? 1 : 0;
+    } else if(form == RegisterOrValueOperand) {
+        if(arguments.size() == 1) {
+            if(arguments.front().type == AstNode::RegisterNode) {
+                word.instruction.acu = arguments.front().sValue == "B" ? 1 : 0;
                 word.instruction.usr = 0;
                 emitWord(word);
             } else {
                 word.instruction.usr = 1;
-                emitValue(node.children.front(), word);
+                emitValue(arguments.front(), word);
             }
         } else {
             emitterError("too many print arguments");
         }
     } else {
-        if(node.children.size() == 2 && node.children.front().type == AstNode::RegisterNode) {
-            AstNode registerNode = node.children.front();
+        if(arguments.size() == 2 && arguments.front().type == AstNode::RegisterNode) {
+            const AstNode &registerNode = arguments.front();
 
             if (registerNode.sValue != "A" && registerNode.sValue != "B") {
                 emitterError("wrong register name");
@@ -236,7 +715,7 @@ void CodeEmitter::emitInstruction(AstNode node) {
 
             word.instruction.acu = registerNode.sValue == "B" ? 1 : 0;
 
-            AstNode valueNode = node.children.back();
+            const AstNode &valueNode = arguments.back();
 
             emitValue(valueNode, word);
         } else {
@@ -247,38 +726,46 @@ void CodeEmitter::emitInstruction(AstNode node) {
 
 #endif
 
-void CodeEmitter::markDataReference(std::string reference) {
-    _dataReferences.push_back({reference, _words.size()});
+void CodeEmitter::defineLabel(uint32_t symbol) {
+    if(symbol >= _labels.size()) {
+        _labels.resize(symbol + 1, -1);
+        _definitionCounts.resize(symbol + 1, 0);
+    }
+    _labels[symbol] = _words.size();
+    ++_definitionCounts[symbol];
+    _definitions.push_back({_currentLine, symbol});
+}
+
+void CodeEmitter::markDataReference(uint32_t symbol) {
+    _dataReferences.push_back({symbol, _words.size()});
 }
 
-void CodeEmitter::markReference(std::string reference) {
-    //std::cout << "marking reference: " << reference << ' ' << _words.size() * 4 << std::endl;
-    _references.push_back({reference, _words.size()});
+void CodeEmitter::markReference(uint32_t symbol) {
+    //std::cout << "marking reference: " << symbol << ' ' << _words.size() * 4 << std::endl;
+    _references.push_back({symbol, _words.size()});
 }
 
 #if 1
 
 void CodeEmitter::resolveReferences() {
     for(auto p : _dataReferences) {
-        std::string dataReference = p.first;
+        uint32_t dataReference = p.first;
         int referenceWordIndex = p.second;
-        auto it = _labels.find(dataReference);
-        if(it == _labels.end()) {
+        if(dataReference >= _labels.size() || _labels[dataReference] < 0) {
             emitterError("unresolved data reference");
         } else {
-            int labelWordIndex = it->second;
+            int labelWordIndex = _labels[dataReference];
             _words[referenceWordIndex].data = labelWordIndex * 4;
             //std::cout << "resolving data reference: " << reference << ' ' << referenceWordIndex * 4 << ' ' << labelWordIndex * 4 << std::endl;
         }
     }
     for(auto p : _references) {
-        std::string reference = p.first;
+        uint32_t reference = p.first;
         int referenceWordIndex = p.second;
-        auto it = _labels.find(reference);
-        if(it == _labels.end()) {
+        if(reference >= _labels.size() || _labels[reference] < 0) {
             emitterError("unresolved reference");
         } else {
-            int labelWordIndex = it->second;
+            int labelWordIndex = _labels[reference];
             _words[referenceWordIndex].instruction.adr = labelWordIndex * 4;
             //std::cout << "resolving reference: " << reference << ' ' << referenceWordIndex * 4 << ' ' << labelWordIndex * 4 << std::endl;
         }
@@ -17,7 +17,9 @@
 
 
 #include "Parser.h"
+#include "ThreadPool.h"
 
+#include <exception>
 #include <unordered_map>
 
 struct Instruction {
@@ -39,8 +41,18 @@ union Word {
 
 void printProgram(std::ostream &os, const std::vector<Word> &words);
 
+/// Appends a single line of the listing printed by printProgram.
+void printWord(std::string &text, int address, Word word);
+
+/// Same as above, appending the listing to `text`.
+void printProgram(std::string &text, const std::vector<Word> &words);
+
+void printProgram(std::string &text, const Word *words, size_t size);
+
 // static_assert(sizeof(Word) == 4, "sizeof(Word) != 32 bits");
 
+struct Object;
+
 class CodeEmitter {
 public:
     class CodeEmitterError : public std::logic_error {
@@ -55,38 +67,125 @@ public:
         UnitSection,
         DataSection,
         CodeSection,
-        EndSection
+        EndSection,
+        UnknownSection
     };
 
+    /// Emits trees passed to emit().
+    CodeEmitter();
+
+    /// Emits a part of a program cut out of the middle of the source, to be
+    /// joined to the other parts or spliced into a program. It has no entry
+    /// address. The section it starts in may only be known when parts are
+    /// joined.
+    static CodeEmitter part(Section section = UnknownSection);
+
     CodeEmitter(const Ast &ast);
 
     std::vector<Word> emitCode();
 
+    /// Emits the statements of `ast`, which may be one line of a program.
+    /// Labels may be referenced before they are defined, so addresses are
+    /// only filled in by finish().
+    void emit(const Ast &ast);
+
+    /// Appends `parts`, the rest of the source in order, on the threads of
+    /// `pool`. `errors[i]` is whatever stopped parts[i] early, if anything.
+    /// Throws the error the parts would have thrown if they had been emitted
+    /// as one, otherwise finish() then resolves references across parts.
+    void join(std::vector<CodeEmitter> &parts, const std::vector<std::exception_ptr> &errors, ThreadPool &pool);
+
+    /// Resolves references and returns the program.
+    std::vector<Word> finish();
+
+    /// Finishes a part which is a whole unit as an object, to be linked with
+    /// other units. References to labels the unit does not define are
+    /// imported instead of being errors.
+    Object finishObject();
+
+    /// Replaces what source lines [firstLine, lastLine] of a finished program
+    /// emitted with `part`, emitted from the lines which replace them and
+    /// starting in sectionAt(firstLine). The lines after them are renumbered
+    /// by `lineDelta`. Only references to labels which move are resolved
+    /// again.
+    ///
+    /// Returns false, changing nothing, if the part ends in a section other
+    /// than the lines it replaces, or changes a label defined more than
+    /// once; the source then has to be emitted again. Throws, leaving the
+    /// program to be emitted again too, if a reference is left unresolved.
+    bool splice(int firstLine, int lastLine, int lineDelta, CodeEmitter &part);
+
+    /// The section source line `line` starts in.
+    Section sectionAt(int line) const;
+
+    /// Valid after finish() or splice().
+    const std::vector<Word> &words() const;
+
+    /// Word index of every label, valid after emitCode() or finish(), but
+    /// not updated by splice().
+    const std::unordered_map<std::string, int> &labels() const;
+
+    /// Source line of every word, 0 for the entry address. Valid after emitCode().
+    const std::vector<int> &lineNumbers() const;
+
+    /// Index of every .WORD holding the address of a label.
+    std::vector<int> dataReferences() const;
+
 private:
+    // What a part emitted in UnknownSection, before its first section
+    // directive
+    struct Opening {
+        bool statements = false;
+        bool words = false;
+        bool instructions = false;
+        int directive = -1; // DirectiveCode which ends it, -1 if none
+    };
+
+    explicit CodeEmitter(Section section);
+
+    static const char *sectionError(Section section);
+
+    static const char *openingError(Section section, const Opening &opening);
+
     void emitterError(std::string errorMessage);
 
     void emitWord(Word word);
 
-    void emitDataWords(std::vector<AstNode> words);
+    void emitNode(const AstNode &node);
+
+    void enterSection(Section section);
+
+    void emitOpening(const AstNode &node);
+
+    void emitDataWords(AstNodeRange words);
+
+    void emitValue(const AstNode &valueNode, Word word);
 
-    void emitValue(AstNode valueNode, Word word);
+    void emitInstruction(const AstNode &node);
 
-    void emitInstruction(AstNode node);
+    void defineLabel(uint32_t symbol);
 
-    void markDataReference(std::string);
+    void markDataReference(uint32_t symbol);
 
-    void markReference(std::string);
+    void markReference(uint32_t symbol);
 
     void resolveReferences();
 
-    std::unordered_map<std::string, int> _opcodes;
-    const Ast &_ast;
+    const Ast *_ast = nullptr; // being emitted
+    std::shared_ptr<const SymbolTable> _symbols;
     std::vector<Word> _words;
+    std::vector<int> _lineNumbers;
+    int _currentLine = 0;
     Section _currentSection = NullSection;
-    std::unordered_map<std::string, int> _labels;
-    int _mainLabel = 0;
-    std::vector<std::pair<std::string, int>> _dataReferences;
-    std::vector<std::pair<std::string, int>> _references;
+    std::vector<std::pair<int, Section>> _sections; // line of every section directive and the section it enters
+    Opening _opening;
+    std::vector<int> _labels; // word index by symbol, -1 for symbols which are not labels
+    std::vector<int> _definitionCounts; // by symbol
+    std::vector<std::pair<int, uint32_t>> _definitions; // line and symbol of every label
+    std::unordered_map<std::string, int> _labelsByName;
+    int _mainLabel = 0; // -1 in a part without .CODE
+    std::vector<std::pair<uint32_t, int>> _dataReferences; // symbol and word index
+    std::vector<std::pair<uint32_t, int>> _references;
 };
 
 
@@ -0,0 +1,281 @@
+/// Copyright (c) 2015 Jakub Trzebiatowski
+///
+/// Licensed under the Apache License, Version 2.0 (the "License");
+/// you may not use this file except in compliance with the License.
+/// You may obtain a copy of the License at
+///
+///     http://www.apache.org/licenses/LICENSE-2.0
+///
+/// Unless required by applicable law or agreed to in writing, software
+/// distributed under the License is distributed on an "AS IS" BASIS,
+/// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+/// See the License for the specific language governing permissions and
+/// limitations under the License.
+
+#include "CompileCache.h"
+#include "Assembler.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define AGHSM_CACHE_SUPPORTED 1
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+#else
+#define AGHSM_CACHE_SUPPORTED 0
+#endif
+
+static const char entrySuffix[] = ".img";
+static const char optimizedSuffix[] = ".opt.img"; // also ends like entrySuffix
+static const char objectSuffix[] = ".obj";
+static const char temporarySuffix[] = ".tmp";
+
+// Temporary files older than this were left by writers which died
+static const time_t staleTemporaryAge = 60 * 60;
+
+static uint64_t rotl(uint64_t x, int r) {
+    return x << r | x >> (64 - r);
+}
+
+static uint64_t fmix(uint64_t k) {
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return k;
+}
+
+// MurmurHash3 x64 128
+
+static void hash128(const char *data, size_t size, uint32_t seed, uint64_t out[2]) {
+    const uint8_t *bytes = reinterpret_cast<const uint8_t *>(data);
+    const uint64_t c1 = 0x87c37b91114253d5ULL;
+    const uint64_t c2 = 0x4cf5ad432745937fULL;
+    uint64_t h1 = seed;
+    uint64_t h2 = seed;
+
+    auto load = [bytes](size_t i, size_t n) {
+        uint64_t k = 0;
+        for(size_t j = 0; j < n; ++j) {
+            k |= static_cast<uint64_t>(bytes[i + j]) << (8 * j);
+        }
+        return k;
+    };
+
+    size_t i = 0;
+    for(; i + 16 <= size; i += 16) {
+        uint64_t k1 = load(i, 8);
+        uint64_t k2 = load(i + 8, 8);
+        h1 ^= rotl(k1 * c1, 31) * c2;
+        h1 = (rotl(h1, 27) + h2) * 5 + 0x52dce729;
+        h2 ^= rotl(k2 * c2, 33) * c1;
+        h2 = (rotl(h2, 31) + h1) * 5 + 0x38495ab5;
+    }
+
+    size_t tail = size - i;
+    if(tail > 8) {
+        h2 ^= rotl(load(i + 8, tail - 8) * c2, 33) * c1;
+    }
+    if(tail) {
+        h1 ^= rotl(load(i, std::min<size_t>(tail, 8)) * c1, 31) * c2;
+    }
+
+    h1 ^= size;
+    h2 ^= size;
+    h1 += h2;
+    h2 += h1;
+    h1 = fmix(h1);
+    h2 = fmix(h2);
+    h1 += h2;
+    h2 += h1;
+    out[0] = h1;
+    out[1] = h2;
+}
+
+static bool endsWith(const std::string &s, const char *suffix) {
+    size_t n = std::strlen(suffix);
+    return s.size() >= n && !s.compare(s.size() - n, n, suffix);
+}
+
+CompileCache::CompileCache(std::string directory, uint64_t maxSize)
+        : _directory(std::move(directory)), _maxSize(maxSize) {
+#if AGHSM_CACHE_SUPPORTED
+    // Like mkdir -p
+    for(size_t slash = _directory.find('/', 1); ; slash = _directory.find('/', slash + 1)) {
+        mkdir(_directory.substr(0, slash).c_str(), 0777);
+        if(slash == std::string::npos) {
+            break;
+        }
+    }
+
+    evict();
+#endif
+}
+
+std::string CompileCache::defaultDirectory() {
+    const char *cacheHome = std::getenv("XDG_CACHE_HOME");
+    if(cacheHome && *cacheHome) {
+        return std::string(cacheHome) + "/aghsm";
+    }
+    const char *home = std::getenv("HOME");
+    return std::string(home ? home : ".") + "/.cache/aghsm";
+}
+
+std::unique_ptr<Image> CompileCache::compile(std::shared_ptr<const SourceBuffer> source) {
+    std::string path = entryPath(*source, _optimizing ? optimizedSuffix : entrySuffix);
+
+#if AGHSM_CACHE_SUPPORTED
+    // Anything wrong with an entry makes it a miss, and it gets replaced
+    try {
+        std::unique_ptr<Image> image(new Image(path));
+        utimes(path.c_str(), nullptr);
+        ++_hits;
+        return image;
+    } catch(ImageException &) {
+    }
+#endif
+    ++_misses;
+
+    Assembler assembler(std::move(source));
+    assembler.setOptimization(_optimizing);
+    std::vector<Word> program = assembler.compile();
+    store(path, [&](const std::string &temporary) {
+        Image::write(temporary, program, assembler.labels(), assembler.lineNumbers());
+    });
+    return std::unique_ptr<Image>(new Image(std::move(program), assembler.labels(), assembler.lineNumbers()));
+}
+
+void CompileCache::setOptimization(bool optimizing) {
+    _optimizing = optimizing;
+}
+
+std::shared_ptr<const Object> CompileCache::compileObject(std::shared_ptr<const SourceBuffer> source) {
+    std::string path = entryPath(*source, objectSuffix);
+
+#if AGHSM_CACHE_SUPPORTED
+    try {
+        std::shared_ptr<const Object> object = std::make_shared<Object>(Object::read(path));
+        utimes(path.c_str(), nullptr);
+        ++_hits;
+        return object;
+    } catch(ImageException &) {
+    }
+#endif
+    ++_misses;
+
+    Assembler assembler(std::move(source));
+    std::shared_ptr<const Object> object = std::make_shared<Object>(assembler.compileObject());
+    store(path, [&](const std::string &temporary) {
+        object->write(temporary);
+    });
+    return object;
+}
+
+uint64_t CompileCache::hits() const {
+    return _hits;
+}
+
+uint64_t CompileCache::misses() const {
+    return _misses;
+}
+
+std::string CompileCache::entryPath(const SourceBuffer &source, const char *suffix) const {
+    uint64_t hash[2];
+    hash128(source.data(), source.size(), Assembler::version, hash);
+
+    char name[33];
+    std::snprintf(name, sizeof(name), "%016llx%016llx",
+                  static_cast<unsigned long long>(hash[0]), static_cast<unsigned long long>(hash[1]));
+    return _directory + "/" + name + suffix;
+}
+
+// The cache is only an optimization, so failing to store an entry is not an
+// error
+
+void CompileCache::store(const std::string &path, const std::function<void(const std::string &)> &write) {
+#if AGHSM_CACHE_SUPPORTED
+    static std::atomic<unsigned> counter{0};
+    std::string temporary = path + "." + std::to_string(getpid()) + "." + std::to_string(counter++) + temporarySuffix;
+
+    struct stat status;
+    try {
+        write(temporary);
+    } catch(ImageException &) {
+        std::remove(temporary.c_str());
+        return;
+    }
+    if(stat(temporary.c_str(), &status) || std::rename(temporary.c_str(), path.c_str())) {
+        std::remove(temporary.c_str());
+        return;
+    }
+
+    // Only the running total is checked, the directory is read again once
+    // it crosses the size
+    if((_size += status.st_size) > _maxSize) {
+        evict();
+    }
+#endif
+}
+
+// Removes the least recently used entries until the cache fits in its size,
+// and restarts the running total from what is left. Other processes may be
+// evicting at the same time, so entries may disappear while the directory is
+// read.
+
+void CompileCache::evict() {
+#if AGHSM_CACHE_SUPPORTED
+    struct Entry {
+        std::string path;
+        time_t used;
+        uint64_t size;
+    };
+
+    DIR *dir = opendir(_directory.c_str());
+    if(!dir) {
+        return;
+    }
+
+    std::vector<Entry> entries;
+    uint64_t total = 0;
+    time_t now = std::time(nullptr);
+    while(dirent *file = readdir(dir)) {
+        std::string name = file->d_name;
+        std::string path = _directory + "/" + name;
+        struct stat status;
+        if(stat(path.c_str(), &status)) {
+            continue;
+        }
+        if(endsWith(name, temporarySuffix) && now - status.st_mtime > staleTemporaryAge) {
+            std::remove(path.c_str());
+        } else if(endsWith(name, entrySuffix) || endsWith(name, objectSuffix)) {
+            entries.push_back({path, status.st_mtime, static_cast<uint64_t>(status.st_size)});
+            total += status.st_size;
+        }
+    }
+    closedir(dir);
+
+    if(total <= _maxSize) {
+        _size = total;
+        return;
+    }
+    std::sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b) {
+        return a.used < b.used;
+    });
+    for(const Entry &entry : entries) {
+        if(total <= _maxSize) {
+            break;
+        }
+        std::remove(entry.path.c_str());
+        total -= entry.size;
+    }
+    _size = total;
+#endif
+}
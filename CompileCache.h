@@ -0,0 +1,78 @@
+/// Copyright (c) 2015 Jakub Trzebiatowski
+///
+/// Licensed under the Apache License, Version 2.0 (the "License");
+/// you may not use this file except in compliance with the License.
+/// You may obtain a copy of the License at
+///
+///     http://www.apache.org/licenses/LICENSE-2.0
+///
+/// Unless required by applicable law or agreed to in writing, software
+/// distributed under the License is distributed on an "AS IS" BASIS,
+/// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+/// See the License for the specific language governing permissions and
+/// limitations under the License.
+
+#ifndef AGHSM_COMPILECACHE_H
+#define AGHSM_COMPILECACHE_H
+
+#include "Image.h"
+#include "SourceBuffer.h"
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+
+/// On-disk cache of assembled programs, keyed by a 128-bit hash of the
+/// source and Assembler::version.
+///
+/// Entries are images, so a hit maps the program without lexing, parsing or
+/// emitting anything. Entries are written to a temporary file and renamed,
+/// and a process only ever sees complete entries, so one cache directory can
+/// be shared by any number of threads and processes. Every hit marks its
+/// entry as used; when the cache grows past its size, the least recently
+/// used entries are removed.
+class CompileCache {
+public:
+    static const uint64_t defaultMaxSize = 256 * 1024 * 1024;
+
+    /// Keeps at most about `maxSize` bytes of programs in `directory`, which
+    /// is created if it does not exist.
+    explicit CompileCache(std::string directory, uint64_t maxSize = defaultMaxSize);
+
+    /// $XDG_CACHE_HOME/aghsm or ~/.cache/aghsm.
+    static std::string defaultDirectory();
+
+    /// Assembles `source`, or loads the program assembled from the same
+    /// source before. Errors in the source are thrown and not cached.
+    std::unique_ptr<Image> compile(std::shared_ptr<const SourceBuffer> source);
+
+    /// Assembles programs with Assembler::setOptimization(), cached apart
+    /// from the others.
+    void setOptimization(bool optimizing);
+
+    /// Like compile(), for a unit to be linked with others.
+    std::shared_ptr<const Object> compileObject(std::shared_ptr<const SourceBuffer> source);
+
+    uint64_t hits() const;
+
+    uint64_t misses() const;
+
+private:
+    std::string entryPath(const SourceBuffer &source, const char *suffix) const;
+
+    void store(const std::string &path, const std::function<void(const std::string &)> &write);
+
+    void evict();
+
+    std::string _directory;
+    uint64_t _maxSize;
+    bool _optimizing = false;
+    std::atomic<uint64_t> _size{0}; // bytes of entries at the last scan, plus those stored since
+    std::atomic<uint64_t> _hits{0};
+    std::atomic<uint64_t> _misses{0};
+};
+
+
+#endif //AGHSM_COMPILECACHE_H
@@ -0,0 +1,78 @@
+/// Copyright (c) 2015 Jakub Trzebiatowski
+///
+/// Licensed under the Apache License, Version 2.0 (the "License");
+/// you may not use this file except in compliance with the License.
+/// You may obtain a copy of the License at
+///
+///     http://www.apache.org/licenses/LICENSE-2.0
+///
+/// Unless required by applicable law or agreed to in writing, software
+/// distributed under the License is distributed on an "AS IS" BASIS,
+/// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+/// See the License for the specific language governing permissions and
+/// limitations under the License.
+
+#include "ProgramGenerator.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+static void usage() {
+	std::cerr << "Usage: aghsm_gen [--words=N] [--multinumbers=N] [--multinumber-size=N] [--labels=N]" << std::endl;
+	std::cerr << "                 [--instructions=N] [--branch-density=F] [--loop-depth=N] [--loop-iterations=N]" << std::endl;
+	std::cerr << "                 [--self-modifying=F] [--seed=N] [output]" << std::endl;
+}
+
+int main(int argc, char **argv) {
+	ProgramGenerator::Options options;
+	const char *outputPath = nullptr;
+
+	for (int i = 1; i < argc; ++i) {
+		if (!std::strncmp(argv[i], "--words=", 8)) {
+			options.words = std::strtoull(argv[i] + 8, nullptr, 10);
+		} else if (!std::strncmp(argv[i], "--multinumbers=", 15)) {
+			options.multinumbers = std::strtoull(argv[i] + 15, nullptr, 10);
+		} else if (!std::strncmp(argv[i], "--multinumber-size=", 19)) {
+			options.maxMultinumberSize = std::strtoull(argv[i] + 19, nullptr, 10);
+		} else if (!std::strncmp(argv[i], "--labels=", 9)) {
+			options.labels = std::strtoull(argv[i] + 9, nullptr, 10);
+		} else if (!std::strncmp(argv[i], "--instructions=", 15)) {
+			options.instructions = std::strtoull(argv[i] + 15, nullptr, 10);
+		} else if (!std::strncmp(argv[i], "--branch-density=", 17)) {
+			options.branchDensity = std::strtod(argv[i] + 17, nullptr);
+		} else if (!std::strncmp(argv[i], "--loop-depth=", 13)) {
+			options.loopDepth = std::atoi(argv[i] + 13);
+		} else if (!std::strncmp(argv[i], "--loop-iterations=", 18)) {
+			options.loopIterations = std::atoi(argv[i] + 18);
+		} else if (!std::strncmp(argv[i], "--self-modifying=", 17)) {
+			options.selfModifying = std::strtod(argv[i] + 17, nullptr);
+		} else if (!std::strncmp(argv[i], "--seed=", 7)) {
+			options.seed = std::strtoul(argv[i] + 7, nullptr, 10);
+		} else if (argv[i][0] == '-' || outputPath) {
+			usage();
+			return 1;
+		} else {
+			outputPath = argv[i];
+		}
+	}
+
+	ProgramGenerator generator(options);
+	if (outputPath) {
+		std::ofstream ofs(outputPath);
+		if (!ofs.good()) {
+			std::cerr << "Unable to open file" << std::endl;
+			return 1;
+		}
+		generator.generate(ofs);
+	} else {
+		generator.generate(std::cout);
+	}
+
+	if (generator.wordCount() > ProgramGenerator::maxRunnableWords) {
+		std::cerr << "Warning: the program has " << generator.wordCount() << " words, only "
+		          << ProgramGenerator::maxRunnableWords << " can be addressed. It can be assembled, but not run." << std::endl;
+	}
+	return 0;
+}
@@ -0,0 +1,403 @@
+/// Copyright (c) 2015 Jakub Trzebiatowski
+///
+/// Licensed under the Apache License, Version 2.0 (the "License");
+/// you may not use this file except in compliance with the License.
+/// You may obtain a copy of the License at
+///
+///     http://www.apache.org/licenses/LICENSE-2.0
+///
+/// Unless required by applicable law or agreed to in writing, software
+/// distributed under the License is distributed on an "AS IS" BASIS,
+/// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+/// See the License for the specific language governing permissions and
+/// limitations under the License.
+
+#include "Image.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <map>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define AGHSM_IMAGE_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#define AGHSM_IMAGE_MMAP 0
+#endif
+
+static const char imageMagic[8] = {'A', 'G', 'H', 'S', 'M', 'I', 'M', '1'};
+static const size_t headerSize = 80;
+
+static void putUint(uint8_t *out, uint64_t value, int bytes) {
+    for(int i = 0; i < bytes; ++i) {
+        out[i] = static_cast<uint8_t>(value >> (8 * i));
+    }
+}
+
+static uint64_t getUint(const uint8_t *in, int bytes) {
+    uint64_t value = 0;
+    for(int i = 0; i < bytes; ++i) {
+        value |= static_cast<uint64_t>(in[i]) << (8 * i);
+    }
+    return value;
+}
+
+// A word with every field set to a different value, so that images written
+// with another bit field order or byte order do not match
+
+static Word layoutProbe() {
+    Word word;
+    word.data = 0;
+    word.instruction.code = 0x5a;
+    word.instruction.usr = 1;
+    word.instruction.acu = 0;
+    word.instruction.mod = 2;
+    word.instruction.adr = -1234;
+    return word;
+}
+
+void Image::write(const std::string &path, const std::vector<Word> &program,
+                  const std::unordered_map<std::string, int> &labels,
+                  const std::vector<int> &lineNumbers) {
+    if(program.empty()) {
+        throw ImageException{"empty program"};
+    }
+
+    uint32_t entry = static_cast<uint32_t>(program[0].data);
+    uint32_t codeStart = std::min<uint32_t>(entry / 4, program.size());
+
+    // Ordered by name, so the same program always gives the same file
+    std::map<std::string, int> symbols(labels.begin(), labels.end());
+    uint64_t memoryOffset = headerSize;
+    uint64_t symbolsOffset = symbols.empty() ? 0 : memoryOffset + program.size() * sizeof(Word);
+    uint64_t linesOffset = memoryOffset + program.size() * sizeof(Word);
+    for(const auto &symbol : symbols) {
+        linesOffset += 8 + symbol.first.size();
+    }
+    if(lineNumbers.empty()) {
+        linesOffset = 0;
+    }
+
+    uint8_t header[headerSize] = {};
+    std::memcpy(&header[0], imageMagic, sizeof(imageMagic));
+    putUint(&header[8], headerSize, 4);
+    Word probe = layoutProbe();
+    std::memcpy(&header[12], &probe, sizeof(probe));
+    putUint(&header[16], entry, 4);
+    putUint(&header[20], program.size(), 4);
+    putUint(&header[24], 4, 4);
+    putUint(&header[28], codeStart ? codeStart - 1 : 0, 4);
+    putUint(&header[32], codeStart * 4, 4);
+    putUint(&header[36], program.size() - codeStart, 4);
+    putUint(&header[40], memoryOffset, 8);
+    putUint(&header[48], symbolsOffset, 8);
+    putUint(&header[56], symbols.size(), 4);
+    putUint(&header[64], linesOffset, 8);
+
+    std::ofstream ofs(path, std::ios::binary);
+    if(!ofs.good()) {
+        throw ImageException{"Unable to open image file " + path};
+    }
+    ofs.write(reinterpret_cast<const char *>(header), sizeof(header));
+    ofs.write(reinterpret_cast<const char *>(program.data()), program.size() * sizeof(Word));
+    for(const auto &symbol : symbols) {
+        uint8_t entryHeader[8];
+        putUint(&entryHeader[0], symbol.second, 4);
+        putUint(&entryHeader[4], symbol.first.size(), 4);
+        ofs.write(reinterpret_cast<const char *>(entryHeader), sizeof(entryHeader));
+        ofs.write(symbol.first.data(), symbol.first.size());
+    }
+    if(!lineNumbers.empty()) {
+        std::vector<uint8_t> lines(program.size() * 4);
+        for(size_t i = 0; i < program.size() && i < lineNumbers.size(); ++i) {
+            putUint(&lines[i * 4], lineNumbers[i], 4);
+        }
+        ofs.write(reinterpret_cast<const char *>(lines.data()), lines.size());
+    }
+    if(!ofs.flush()) {
+        throw ImageException{"Unable to write image file " + path};
+    }
+}
+
+bool Image::isImage(const std::string &path) {
+    std::ifstream ifs(path, std::ios::binary);
+    char magic[sizeof(imageMagic)];
+    return ifs.read(magic, sizeof(magic)) && !std::memcmp(magic, imageMagic, sizeof(magic));
+}
+
+Image::Image(const std::string &path) {
+    const uint8_t *file = nullptr;
+    size_t fileSize = 0;
+
+#if AGHSM_IMAGE_MMAP
+    int fd = open(path.c_str(), O_RDONLY);
+    if(fd < 0) {
+        throw ImageException{"Unable to open image file " + path};
+    }
+    struct stat status;
+    if(fstat(fd, &status) == 0 && status.st_size > 0) {
+        _mappingSize = static_cast<size_t>(status.st_size);
+        _mapping = mmap(nullptr, _mappingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if(!_mapping || _mapping == MAP_FAILED) {
+        _mapping = nullptr;
+        throw ImageException{"Unable to map image file " + path};
+    }
+    file = static_cast<const uint8_t *>(_mapping);
+    fileSize = _mappingSize;
+#else
+    std::ifstream ifs(path, std::ios::binary);
+    if(!ifs.good()) {
+        throw ImageException{"Unable to open image file " + path};
+    }
+    _buffer.assign(std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>());
+    file = _buffer.data();
+    fileSize = _buffer.size();
+#endif
+
+    try {
+        if(fileSize < headerSize || std::memcmp(file, imageMagic, sizeof(imageMagic))) {
+            throw ImageException{"not an image file"};
+        }
+        if(getUint(&file[8], 4) != headerSize) {
+            throw ImageException{"unsupported image version"};
+        }
+        Word probe = layoutProbe();
+        if(std::memcmp(&file[12], &probe, sizeof(probe))) {
+            throw ImageException{"image was written with another word layout"};
+        }
+
+        _entry = static_cast<int32_t>(getUint(&file[16], 4));
+        _size = getUint(&file[20], 4);
+        uint64_t memoryOffset = getUint(&file[40], 8);
+        uint64_t symbolsOffset = getUint(&file[48], 8);
+        uint64_t symbolCount = getUint(&file[56], 4);
+        uint64_t linesOffset = getUint(&file[64], 8);
+
+        if(!_size || memoryOffset % sizeof(Word) || memoryOffset > fileSize ||
+           _size > (fileSize - memoryOffset) / sizeof(Word)) {
+            throw ImageException{"truncated image memory"};
+        }
+        // Not const: programs run and store in place
+        _words = reinterpret_cast<Word *>(const_cast<uint8_t *>(file) + memoryOffset);
+        if(_words[0].data != _entry) {
+            throw ImageException{"image entry point does not match its memory"};
+        }
+
+        size_t position = symbolsOffset;
+        for(uint64_t i = 0; i < symbolCount; ++i) {
+            if(position > fileSize || fileSize - position < 8) {
+                throw ImageException{"truncated image symbol table"};
+            }
+            int index = static_cast<int>(getUint(&file[position], 4));
+            size_t length = getUint(&file[position + 4], 4);
+            position += 8;
+            if(fileSize - position < length) {
+                throw ImageException{"truncated image symbol table"};
+            }
+            _labels[std::string(reinterpret_cast<const char *>(&file[position]), length)] = index;
+            position += length;
+        }
+
+        if(linesOffset) {
+            if(linesOffset > fileSize || (fileSize - linesOffset) / 4 < _size) {
+                throw ImageException{"truncated image line table"};
+            }
+            _lineNumbers.resize(_size);
+            for(size_t i = 0; i < _size; ++i) {
+                _lineNumbers[i] = static_cast<int>(getUint(&file[linesOffset + i * 4], 4));
+            }
+        }
+    } catch(...) {
+#if AGHSM_IMAGE_MMAP
+        munmap(_mapping, _mappingSize);
+#endif
+        throw;
+    }
+}
+
+Image::Image(std::vector<Word> program, std::unordered_map<std::string, int> labels,
+             std::vector<int> lineNumbers)
+        : _program(std::move(program)), _labels(std::move(labels)), _lineNumbers(std::move(lineNumbers)) {
+    if(_program.empty()) {
+        throw ImageException{"empty program"};
+    }
+    _words = _program.data();
+    _size = _program.size();
+    _entry = _words[0].data;
+}
+
+Image::~Image() {
+#if AGHSM_IMAGE_MMAP
+    if(_mapping) {
+        munmap(_mapping, _mappingSize);
+    }
+#endif
+}
+
+Word *Image::words() {
+    return _words;
+}
+
+size_t Image::size() const {
+    return _size;
+}
+
+int32_t Image::entry() const {
+    return _entry;
+}
+
+const std::unordered_map<std::string, int> &Image::labels() const {
+    return _labels;
+}
+
+const std::vector<int> &Image::lineNumbers() const {
+    return _lineNumbers;
+}
+
+static const char objectMagic[8] = {'A', 'G', 'H', 'S', 'M', 'O', 'B', '1'};
+static const size_t objectHeaderSize = 40;
+static const uint32_t noIndex = 0xffffffff;
+
+static void putName(std::string &out, const std::string &name) {
+    uint8_t length[4];
+    putUint(length, name.size(), 4);
+    out.append(reinterpret_cast<const char *>(length), sizeof(length));
+    out += name;
+}
+
+void Object::write(const std::string &path) const {
+    uint8_t header[objectHeaderSize] = {};
+    std::memcpy(&header[0], objectMagic, sizeof(objectMagic));
+    putUint(&header[8], objectHeaderSize, 4);
+    Word probe = layoutProbe();
+    std::memcpy(&header[12], &probe, sizeof(probe));
+    putUint(&header[16], codeStart >= 0 ? static_cast<uint32_t>(codeStart) : noIndex, 4);
+    putUint(&header[20], words.size(), 4);
+    putUint(&header[24], exports.size(), 4);
+    putUint(&header[28], imports.size(), 4);
+    putUint(&header[32], relocations.size(), 4);
+
+    std::string text(reinterpret_cast<const char *>(header), sizeof(header));
+    text.append(reinterpret_cast<const char *>(words.data()), words.size() * sizeof(Word));
+    uint8_t field[12];
+    for(size_t i = 0; i < words.size(); ++i) {
+        putUint(field, i < lineNumbers.size() ? lineNumbers[i] : 0, 4);
+        text.append(reinterpret_cast<const char *>(field), 4);
+    }
+    // Ordered by name, so the same unit always gives the same file
+    std::map<std::string, int> sortedExports(exports.begin(), exports.end());
+    for(const auto &symbol : sortedExports) {
+        putUint(field, symbol.second, 4);
+        text.append(reinterpret_cast<const char *>(field), 4);
+        putName(text, symbol.first);
+    }
+    for(const std::string &name : imports) {
+        putName(text, name);
+    }
+    for(const Relocation &relocation : relocations) {
+        putUint(&field[0], relocation.word, 4);
+        putUint(&field[4], relocation.data ? 1 : 0, 4);
+        putUint(&field[8], relocation.import >= 0 ? static_cast<uint32_t>(relocation.import) : noIndex, 4);
+        text.append(reinterpret_cast<const char *>(field), 12);
+    }
+
+    std::ofstream ofs(path, std::ios::binary);
+    if(!ofs.good()) {
+        throw ImageException{"Unable to open object file " + path};
+    }
+    if(!ofs.write(text.data(), text.size()).flush()) {
+        throw ImageException{"Unable to write object file " + path};
+    }
+}
+
+bool Object::isObject(const std::string &path) {
+    std::ifstream ifs(path, std::ios::binary);
+    char magic[sizeof(objectMagic)];
+    return ifs.read(magic, sizeof(magic)) && !std::memcmp(magic, objectMagic, sizeof(magic));
+}
+
+Object Object::read(const std::string &path) {
+    std::ifstream ifs(path, std::ios::binary);
+    if(!ifs.good()) {
+        throw ImageException{"Unable to open object file " + path};
+    }
+    std::string text{std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>()};
+    const uint8_t *file = reinterpret_cast<const uint8_t *>(text.data());
+    size_t position = 0;
+
+    // Bytes at `position`, which moves past them
+    auto take = [&text, &position](size_t bytes) {
+        if(text.size() - position < bytes) {
+            throw ImageException{"truncated object file"};
+        }
+        position += bytes;
+        return reinterpret_cast<const uint8_t *>(text.data()) + position - bytes;
+    };
+    auto takeName = [&take]() {
+        size_t length = getUint(take(4), 4);
+        return std::string(reinterpret_cast<const char *>(take(length)), length);
+    };
+
+    if(text.size() < objectHeaderSize || std::memcmp(file, objectMagic, sizeof(objectMagic))) {
+        throw ImageException{"not an object file"};
+    }
+    if(getUint(&file[8], 4) != objectHeaderSize) {
+        throw ImageException{"unsupported object file version"};
+    }
+    Word probe = layoutProbe();
+    if(std::memcmp(&file[12], &probe, sizeof(probe))) {
+        throw ImageException{"object file was written with another word layout"};
+    }
+
+    Object object;
+    uint32_t codeStart = getUint(&file[16], 4);
+    size_t wordCount = getUint(&file[20], 4);
+    size_t exportCount = getUint(&file[24], 4);
+    size_t importCount = getUint(&file[28], 4);
+    size_t relocationCount = getUint(&file[32], 4);
+    position = objectHeaderSize;
+
+    if(wordCount > text.size() / sizeof(Word)) {
+        throw ImageException{"truncated object file"};
+    }
+    object.codeStart = codeStart == noIndex ? -1 : static_cast<int>(codeStart);
+    object.words.resize(wordCount);
+    std::memcpy(object.words.data(), take(wordCount * sizeof(Word)), wordCount * sizeof(Word));
+    object.lineNumbers.resize(wordCount);
+    for(size_t i = 0; i < wordCount; ++i) {
+        object.lineNumbers[i] = static_cast<int>(getUint(take(4), 4));
+    }
+    for(size_t i = 0; i < exportCount; ++i) {
+        size_t index = getUint(take(4), 4);
+        if(index > wordCount) {
+            throw ImageException{"object file symbol out of range"};
+        }
+        object.exports[takeName()] = static_cast<int>(index);
+    }
+    for(size_t i = 0; i < importCount; ++i) {
+        object.imports.push_back(takeName());
+    }
+    for(size_t i = 0; i < relocationCount; ++i) {
+        const uint8_t *field = take(12);
+        Relocation relocation;
+        relocation.word = getUint(&field[0], 4);
+        relocation.data = getUint(&field[4], 4) & 1;
+        uint32_t import = getUint(&field[8], 4);
+        relocation.import = import == noIndex ? -1 : static_cast<int32_t>(import);
+        if(relocation.word >= wordCount || (import != noIndex && import >= importCount)) {
+            throw ImageException{"object file relocation out of range"};
+        }
+        object.relocations.push_back(relocation);
+    }
+    if(object.codeStart > static_cast<int>(wordCount)) {
+        throw ImageException{"object file code segment out of range"};
+    }
+    return object;
+}
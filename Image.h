@@ -0,0 +1,158 @@
+/// Copyright (c) 2015 Jakub Trzebiatowski
+///
+/// Licensed under the Apache License, Version 2.0 (the "License");
+/// you may not use this file except in compliance with the License.
+/// You may obtain a copy of the License at
+///
+///     http://www.apache.org/licenses/LICENSE-2.0
+///
+/// Unless required by applicable law or agreed to in writing, software
+/// distributed under the License is distributed on an "AS IS" BASIS,
+/// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+/// See the License for the specific language governing permissions and
+/// limitations under the License.
+
+#ifndef AGHSM_IMAGE_H
+#define AGHSM_IMAGE_H
+
+#include "CodeEmitter.h"
+
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Image file layout, integers little-endian:
+//
+//   0  magic "AGHSMIM1"
+//   8  header size (80)
+//  12  layout probe: a known Word as stored by the writer
+//  16  entry point, a byte address
+//  20  memory size in words
+//  24  data segment: byte address, size in words
+//  32  code segment: byte address, size in words
+//  40  offset of memory in the file (64-bit)
+//  48  offset of the symbol table in the file, 0 if there is none (64-bit)
+//  56  number of symbols
+//  60  reserved
+//  64  offset of the line table in the file, 0 if there is none (64-bit)
+//  72  reserved (64-bit)
+//
+// Memory follows as raw Words, word 0 holding the entry point and followed
+// by the data and the code segments. Words are stored as they are laid out
+// in memory, so they can be mapped and executed in place; the layout probe
+// rejects images written by a build with another Word layout. Every symbol
+// is a word index, the length of its name and the name. The line table has
+// the source line of every word of memory.
+
+// Object file layout, integers little-endian:
+//
+//   0  magic "AGHSMOB1"
+//   8  header size (40)
+//  12  layout probe, like in images
+//  16  word index of the code segment, 0xffffffff if there is none
+//  20  number of words
+//  24  number of exports
+//  28  number of imports
+//  32  number of relocations
+//  36  reserved
+//
+// The header is followed by the words, the source line of every word, the
+// exports (a word index, the length of the name and the name), the imports
+// (the length of the name and the name) and the relocations (a word index,
+// flags with bit 0 set for data words, and an import index or 0xffffffff).
+
+class ImageException : public std::logic_error {
+public:
+    ImageException(std::string errorMessage)
+            : std::logic_error(errorMessage)
+    {}
+};
+
+/// An assembled program loaded from an image file.
+///
+/// The file is mapped into memory privately: programs run directly in the
+/// mapping, and their stores never reach the file.
+class Image {
+public:
+    /// Writes `program` to `path`, with a symbol table unless `labels` is
+    /// empty and with a line table unless `lineNumbers` is empty.
+    static void write(const std::string &path, const std::vector<Word> &program,
+                      const std::unordered_map<std::string, int> &labels,
+                      const std::vector<int> &lineNumbers = {});
+
+    /// True if the file at `path` starts like an image.
+    static bool isImage(const std::string &path);
+
+    explicit Image(const std::string &path);
+
+    /// An image of a program assembled in this process.
+    Image(std::vector<Word> program, std::unordered_map<std::string, int> labels,
+          std::vector<int> lineNumbers);
+
+    Image(const Image &) = delete;
+
+    Image &operator=(const Image &) = delete;
+
+    ~Image();
+
+    Word *words();
+
+    /// Memory size in words.
+    size_t size() const;
+
+    int32_t entry() const;
+
+    /// Word index of every symbol, empty if the image has no symbol table.
+    const std::unordered_map<std::string, int> &labels() const;
+
+    /// Source line of every word, empty if the image has no line table.
+    const std::vector<int> &lineNumbers() const;
+
+private:
+    void *_mapping = nullptr;
+    size_t _mappingSize = 0;
+    std::vector<uint8_t> _buffer; // the file, where it cannot be mapped
+    std::vector<Word> _program; // memory of images not read from a file
+
+    Word *_words = nullptr;
+    size_t _size = 0;
+    int32_t _entry = 0;
+    std::unordered_map<std::string, int> _labels;
+    std::vector<int> _lineNumbers;
+};
+
+
+/// A unit assembled on its own, to be linked with other units by Linker.
+///
+/// Words are laid out from the start of the unit, without an entry point.
+/// Every reference has a relocation: a reference to a label of the unit holds
+/// its address in the unit, which moves with the unit, and a reference to a
+/// label of another unit is an import, filled in when linking. Labels whose
+/// names start with '.' are local to the unit and never exported.
+struct Object {
+    struct Relocation {
+        uint32_t word;
+        bool data; // the reference is a whole .WORD, not the address of an instruction
+        int32_t import; // index in imports, -1 for a label of the unit
+    };
+
+    /// Reads an object file. Throws ImageException if it is not one.
+    static Object read(const std::string &path);
+
+    /// True if the file at `path` starts like an object file.
+    static bool isObject(const std::string &path);
+
+    void write(const std::string &path) const;
+
+    std::vector<Word> words;
+    std::vector<int> lineNumbers;
+    int codeStart = -1; // word index of .CODE, -1 if the unit has none
+    std::unordered_map<std::string, int> exports; // word index of every label which is not local
+    std::vector<std::string> imports;
+    std::vector<Relocation> relocations;
+};
+
+
+#endif //AGHSM_IMAGE_H
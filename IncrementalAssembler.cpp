@@ -0,0 +1,116 @@
+/// Copyright (c) 2015 Jakub Trzebiatowski
+///
+/// Licensed under the Apache License, Version 2.0 (the "License");
+/// you may not use this file except in compliance with the License.
+/// You may obtain a copy of the License at
+///
+///     http://www.apache.org/licenses/LICENSE-2.0
+///
+/// Unless required by applicable law or agreed to in writing, software
+/// distributed under the License is distributed on an "AS IS" BASIS,
+/// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+/// See the License for the specific language governing permissions and
+/// limitations under the License.
+
+
+#include "IncrementalAssembler.h"
+
+#include "Lexer.h"
+#include "Parser.h"
+
+#include <algorithm>
+#include <cstring>
+
+// Lines in [begin, end) of `text`, `begin` starting a line
+static int countLines(const char *text, size_t begin, size_t end) {
+    int lines = std::count(text + begin, text + end, '\n');
+    return end > begin && text[end - 1] != '\n' ? lines + 1 : lines;
+}
+
+void IncrementalAssembler::compileAll(std::shared_ptr<const SourceBuffer> source) {
+    _emitter.reset();
+    _symbols = std::make_shared<SymbolTable>();
+    std::unique_ptr<CodeEmitter> emitter(new CodeEmitter);
+
+    Lexer lexer(source, 0, source->size(), 0, _symbols);
+    Parser parser{lexer};
+    Ast line;
+    while(parser.parseLine(line)) {
+        emitter->emit(line);
+    }
+    emitter->finish();
+
+    _emitter = std::move(emitter);
+    _source = std::move(source);
+    _assembledLines = countLines(_source->data(), 0, _source->size());
+}
+
+// The old and the new version are compared from both ends, and the lines in
+// between are the edit. They start in the section the old lines started in and
+// are numbered like the old ones, so the new lines are emitted alone and
+// spliced in place of the old ones. If they do not fit, or the last version
+// did not assemble completely, everything is assembled again.
+
+const std::vector<Word> &IncrementalAssembler::compile(std::shared_ptr<const SourceBuffer> source) {
+    if(!_emitter) {
+        compileAll(std::move(source));
+        return _emitter->words();
+    }
+
+    const char *oldText = _source->data();
+    const char *newText = source->data();
+    const size_t oldSize = _source->size();
+    const size_t newSize = source->size();
+    const size_t common = std::min(oldSize, newSize);
+
+    size_t begin = std::mismatch(oldText, oldText + common, newText).first - oldText;
+    while(begin > 0 && oldText[begin - 1] != '\n') {
+        --begin;
+    }
+
+    size_t suffix = 0;
+    while(suffix < common - begin && oldText[oldSize - suffix - 1] == newText[newSize - suffix - 1]) {
+        ++suffix;
+    }
+    size_t oldEnd = oldSize - suffix;
+    size_t newEnd = newSize - suffix;
+    if((oldEnd > begin && oldText[oldEnd - 1] != '\n') || (newEnd > begin && newText[newEnd - 1] != '\n')) {
+        // The rest of the line the edit ends in is not part of the suffix
+        const char *newline = static_cast<const char *>(std::memchr(oldText + oldEnd, '\n', suffix));
+        size_t rest = newline ? newline + 1 - (oldText + oldEnd) : suffix;
+        oldEnd += rest;
+        newEnd += rest;
+    }
+
+    const int firstLine = std::count(oldText, oldText + begin, '\n') + 1;
+    const int oldLines = countLines(oldText, begin, oldEnd);
+    const int newLines = countLines(newText, begin, newEnd);
+
+    CodeEmitter part = CodeEmitter::part(_emitter->sectionAt(firstLine));
+    Lexer lexer(source, begin, newEnd, firstLine - 1, _symbols);
+    Parser parser{lexer};
+    Ast line;
+    while(parser.parseLine(line)) {
+        part.emit(line);
+    }
+
+    bool spliced;
+    try {
+        spliced = _emitter->splice(firstLine, firstLine + oldLines - 1, newLines - oldLines, part);
+    } catch(...) {
+        _emitter.reset();
+        throw;
+    }
+    if(!spliced) {
+        compileAll(std::move(source));
+        return _emitter->words();
+    }
+
+    _source = std::move(source);
+    _assembledLines = newLines;
+    return _emitter->words();
+}
+
+int IncrementalAssembler::assembledLines() const {
+    return _assembledLines;
+}
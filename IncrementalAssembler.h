@@ -0,0 +1,52 @@
+/// Copyright (c) 2015 Jakub Trzebiatowski
+///
+/// Licensed under the Apache License, Version 2.0 (the "License");
+/// you may not use this file except in compliance with the License.
+/// You may obtain a copy of the License at
+///
+///     http://www.apache.org/licenses/LICENSE-2.0
+///
+/// Unless required by applicable law or agreed to in writing, software
+/// distributed under the License is distributed on an "AS IS" BASIS,
+/// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+/// See the License for the specific language governing permissions and
+/// limitations under the License.
+
+
+#ifndef AGHSM_INCREMENTALASSEMBLER_H
+#define AGHSM_INCREMENTALASSEMBLER_H
+
+#include "CodeEmitter.h"
+#include "SourceBuffer.h"
+#include "SymbolTable.h"
+
+#include <memory>
+#include <vector>
+
+/// Assembles one version of a source after another, keeping the program the
+/// last one was assembled into. Only the lines from the first to the last one
+/// which changed are lexed, parsed and emitted again, and only references to
+/// labels which moved are resolved again, so reassembling takes time with the
+/// size of the edit rather than the size of the source.
+class IncrementalAssembler {
+public:
+    /// Assembles `source`, a new version of the last one which assembled.
+    /// Throws like Assembler::compile(); the next version is then compared
+    /// with the last one which assembled. The program is valid until the
+    /// next call.
+    const std::vector<Word> &compile(std::shared_ptr<const SourceBuffer> source);
+
+    /// Source lines lexed by the last compile().
+    int assembledLines() const;
+
+private:
+    void compileAll(std::shared_ptr<const SourceBuffer> source);
+
+    std::shared_ptr<const SourceBuffer> _source; // the last version which assembled
+    std::shared_ptr<SymbolTable> _symbols;
+    std::unique_ptr<CodeEmitter> _emitter; // of _source, null if the next version is assembled from scratch
+    int _assembledLines = 0;
+};
+
+
+#endif //AGHSM_INCREMENTALASSEMBLER_H
@@ -0,0 +1,763 @@
+/// Copyright (c) 2015 Jakub Trzebiatowski
+///
+/// Licensed under the Apache License, Version 2.0 (the "License");
+/// you may not use this file except in compliance with the License.
+/// You may obtain a copy of the License at
+///
+///     http://www.apache.org/licenses/LICENSE-2.0
+///
+/// Unless required by applicable law or agreed to in writing, software
+/// distributed under the License is distributed on an "AS IS" BASIS,
+/// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+/// See the License for the specific language governing permissions and
+/// limitations under the License.
+
+#include "Jit.h"
+#include "Language.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstring>
+
+#if AGHSM_JIT_SUPPORTED
+#include <sys/mman.h>
+
+#if !defined(MAP_ANONYMOUS)
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+#endif
+
+#if AGHSM_JIT_SUPPORTED
+
+namespace {
+
+enum Register {
+    RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+    R8, R9, R10, R11, R12, R13, R14, R15,
+};
+
+// Register assignment inside translated code
+const int StateRegister = RBX;
+const int LastAcRegister = RBP;
+const int TestRegister = R11; // value of the last used accumulator, tested by conditional jumps
+const int CodeMapRegister = R10;
+const int MemoryRegister = R14;
+const int MemorySizeRegister = R15;
+
+int accumulatorRegister(unsigned acu) {
+    return acu ? R13 : R12;
+}
+
+enum Condition {
+    AboveOrEqualCondition = 0x3,
+    EqualCondition = 0x4,
+    NotEqualCondition = 0x5,
+    LessCondition = 0xC,
+    GreaterOrEqualCondition = 0xD,
+    LessOrEqualCondition = 0xE,
+};
+
+const size_t codeCapacity = 32 * 1024 * 1024;
+const uint32_t maxBlockLength = 256;
+const size_t maxBlockBytes = maxBlockLength * 160;
+
+// Words whose translation was discarded this many times are left to the
+// threaded interpreter; translating them again would cost more than it saves
+const uint8_t maxInvalidations = 8;
+
+// Instructions with a translation below. Any other instruction, including
+// ones added to the ISA later, ends the block and runs in the interpreter.
+static bool isTranslated(unsigned code) {
+    switch(code) {
+        case NullInstruction:
+        case LoadInstruction:
+        case StoreInstruction:
+        case AddInstruction:
+        case SubInstruction:
+        case MultInstruction:
+        case DivInstruction:
+        case JumpInstruction:
+        case JzeroInstruction:
+        case JnzeroInstruction:
+        case JposInstruction:
+        case JnegInstruction:
+            return true;
+        default:
+            return false;
+    }
+}
+
+#define STATE_FIELD(field) static_cast<int32_t>(offsetof(Jit::State, field))
+
+/// Minimal x86-64 encoder covering the instructions the translator needs.
+class X86Assembler {
+public:
+    X86Assembler(uint8_t *begin) : _p(begin) {}
+
+    uint8_t *here() { return _p; }
+
+    void byte(uint8_t b) { *_p++ = b; }
+
+    void dword(uint32_t d) {
+        std::memcpy(_p, &d, 4);
+        _p += 4;
+    }
+
+    // op reg, rm (register direct)
+    void rr(unsigned op, bool w, int reg, int rm) {
+        rex(w, reg, 0, rm);
+        opcode(op);
+        byte(0xC0 | (reg & 7) << 3 | (rm & 7));
+    }
+
+    // op reg, [base + disp32]
+    void rm(unsigned op, bool w, int reg, int base, int32_t disp) {
+        rex(w, reg, 0, base);
+        opcode(op);
+        byte(0x80 | (reg & 7) << 3 | (base & 7));
+        if((base & 7) == RSP) {
+            byte(0x24);
+        }
+        dword(disp);
+    }
+
+    // op reg, [base + index]
+    void rmi(unsigned op, bool w, int reg, int base, int index) {
+        assert((base & 7) != RBP && (index & 7) != RSP);
+        rex(w, reg, index, base);
+        opcode(op);
+        byte(0x04 | (reg & 7) << 3);
+        byte((index & 7) << 3 | (base & 7));
+    }
+
+    void movImm(int reg, int32_t imm) {
+        rex(false, 0, 0, reg);
+        byte(0xB8 + (reg & 7));
+        dword(imm);
+    }
+
+    void movStateImm(int32_t disp, int32_t imm) {
+        rm(0xC7, false, 0, StateRegister, disp);
+        dword(imm);
+    }
+
+    void addBudget(int32_t count) {
+        rm(0x81, true, 0, StateRegister, STATE_FIELD(budget));
+        dword(count);
+    }
+
+    // Returns the location of the immediate so it can be patched later
+    uint8_t *subBudget(int32_t count) {
+        rm(0x81, true, 5, StateRegister, STATE_FIELD(budget));
+        uint8_t *imm = here();
+        dword(count);
+        return imm;
+    }
+
+    // Returns the location of the rel32 field
+    uint8_t *jcc(Condition condition) {
+        byte(0x0F);
+        byte(0x80 | condition);
+        uint8_t *rel = here();
+        dword(0);
+        return rel;
+    }
+
+    uint8_t *jmp() {
+        byte(0xE9);
+        uint8_t *rel = here();
+        dword(0);
+        return rel;
+    }
+
+    void jmp(uint8_t *target) {
+        patch(jmp(), target);
+    }
+
+    void push(int reg) {
+        rex(false, 0, 0, reg);
+        byte(0x50 + (reg & 7));
+    }
+
+    void pop(int reg) {
+        rex(false, 0, 0, reg);
+        byte(0x58 + (reg & 7));
+    }
+
+    static void patch(uint8_t *rel, const uint8_t *target) {
+        int32_t offset = static_cast<int32_t>(target - (rel + 4));
+        std::memcpy(rel, &offset, 4);
+    }
+
+private:
+    void rex(bool w, int reg, int index, int base) {
+        uint8_t prefix = 0x40 | w << 3 | (reg >> 3) << 2 | (index >> 3) << 1 | (base >> 3);
+        if(prefix != 0x40) {
+            byte(prefix);
+        }
+    }
+
+    void opcode(unsigned op) {
+        if(op > 0xFF) {
+            byte(op >> 8);
+        }
+        byte(op & 0xFF);
+    }
+
+    uint8_t *_p;
+};
+
+bool isValidAddress(int32_t address, size_t words) {
+    return !(address & 3) && static_cast<uint32_t>(address) / 4 < words;
+}
+
+}
+
+Jit::Jit() {
+    void *code = mmap(nullptr, codeCapacity, PROT_READ | PROT_WRITE | PROT_EXEC,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(code == MAP_FAILED) {
+        return;
+    }
+    _code = static_cast<uint8_t *>(code);
+    _codeCapacity = codeCapacity;
+
+    X86Assembler as(_code);
+
+    // Trampoline: void (State *state, const uint8_t *entry)
+    as.push(RBX);
+    as.push(RBP);
+    as.push(R12);
+    as.push(R13);
+    as.push(R14);
+    as.push(R15);
+    as.rr(0x89, true, RDI, StateRegister);
+    as.rm(0x8B, false, accumulatorRegister(0), StateRegister, STATE_FIELD(A));
+    as.rm(0x8B, false, accumulatorRegister(1), StateRegister, STATE_FIELD(B));
+    as.rm(0x8B, false, LastAcRegister, StateRegister, STATE_FIELD(lastAc));
+    as.rm(0x8B, false, TestRegister, StateRegister, STATE_FIELD(testValue));
+    as.rm(0x8B, true, MemoryRegister, StateRegister, STATE_FIELD(memory));
+    as.rm(0x8B, false, MemorySizeRegister, StateRegister, STATE_FIELD(memorySize));
+    as.rm(0x8B, true, CodeMapRegister, StateRegister, STATE_FIELD(codeMap));
+    as.rr(0xFF, false, 4, RSI); // jmp rsi
+
+    _epilogue = as.here();
+    as.rm(0x89, false, accumulatorRegister(0), StateRegister, STATE_FIELD(A));
+    as.rm(0x89, false, accumulatorRegister(1), StateRegister, STATE_FIELD(B));
+    as.rm(0x89, false, LastAcRegister, StateRegister, STATE_FIELD(lastAc));
+    as.pop(R15);
+    as.pop(R14);
+    as.pop(R13);
+    as.pop(R12);
+    as.pop(RBP);
+    as.pop(RBX);
+    as.byte(0xC3); // ret
+
+    _trampoline = reinterpret_cast<Trampoline>(_code);
+    _codeBase = _codeSize = as.here() - _code;
+}
+
+Jit::~Jit() {
+    if(_code) {
+        munmap(_code, _codeCapacity);
+    }
+}
+
+bool Jit::isAvailable() const {
+    return _code != nullptr;
+}
+
+void Jit::attach(Word *memory, size_t words) {
+    _memory = memory;
+    _words = words;
+    _codeMap.assign(words, 0);
+    _invalidations.assign(words, 0);
+    _blockAt.assign(words, -1);
+    flush();
+}
+
+Jit::ExitReason Jit::execute(State &state) {
+    state.codeMap = _codeMap.data();
+
+    for(;;) {
+        int block = blockAt(state.pc);
+        if(block < 0) {
+            if(isValidAddress(state.pc, _words) && _invalidations[state.pc / 4] >= maxInvalidations) {
+                return SelfModifyingExit;
+            }
+            return InterpretExit;
+        }
+
+        state.testValue = state.lastAc == 0 ? state.A : state.lastAc == 1 ? state.B : 0;
+        _trampoline(&state, _blocks[block].entry);
+
+        switch(state.reason) {
+            case ContinueExit:
+                if(state.site >= 0) {
+                    unsigned generation = _generation;
+                    int target = blockAt(state.pc);
+                    if(target >= 0 && generation == _generation) {
+                        link(state.site, target);
+                    }
+                }
+                break;
+            case InvalidateExit:
+                if(_codeMap[state.invalidatedWord] & DecodedCode) {
+                    return InvalidateExit;
+                }
+                invalidate(state.invalidatedWord);
+                break;
+            default:
+                return static_cast<ExitReason>(state.reason);
+        }
+    }
+}
+
+// Blocks are at most maxBlockLength words long, so only blocks starting in
+// the maxBlockLength words up to a word can cover it, and _blockAt has every
+// live block by its start.
+
+void Jit::invalidate(uint32_t wordIndex) {
+    if(wordIndex >= _words) {
+        return;
+    }
+    _codeMap[wordIndex] &= ~DecodedCode;
+    if(!(_codeMap[wordIndex] & TranslatedCode)) {
+        return;
+    }
+    if(_invalidations[wordIndex] < maxInvalidations) {
+        ++_invalidations[wordIndex];
+    }
+
+    uint32_t low = wordIndex, high = wordIndex + 1;
+    for(uint32_t start = wordIndex + 1 - std::min(wordIndex + 1, maxBlockLength); start <= wordIndex; ++start) {
+        int block = _blockAt[start];
+        if(block >= 0 && wordIndex < _blocks[block].end) {
+            low = std::min(low, start);
+            high = std::max(high, _blocks[block].end);
+            discard(block);
+        }
+    }
+
+    for(uint32_t i = low; i < high; ++i) {
+        _codeMap[i] &= ~TranslatedCode;
+    }
+    for(uint32_t start = low - std::min(low, maxBlockLength); start < high; ++start) {
+        int block = _blockAt[start];
+        if(block >= 0 && low < _blocks[block].end) {
+            for(uint32_t i = std::max(low, start); i < std::min(high, _blocks[block].end); ++i) {
+                _codeMap[i] |= TranslatedCode;
+            }
+        }
+    }
+}
+
+void Jit::markDecoded(uint32_t wordIndex) {
+    if(wordIndex < _words) {
+        _codeMap[wordIndex] |= DecodedCode;
+    }
+}
+
+const uint8_t *Jit::codeMap() const {
+    return _codeMap.data();
+}
+
+int Jit::blockAt(int32_t pc) {
+    if(!_code || !isValidAddress(pc, _words)) {
+        return -1;
+    }
+    uint32_t index = static_cast<uint32_t>(pc) / 4;
+    if(_blockAt[index] < 0 && _invalidations[index] < maxInvalidations) {
+        _blockAt[index] = translate(index);
+    }
+    return _blockAt[index];
+}
+
+void Jit::link(int site, int block) {
+    ExitSite &exitSite = _sites[site];
+    if(!_blocks[exitSite.source].live || exitSite.linkedTo >= 0) {
+        return;
+    }
+    X86Assembler::patch(exitSite.jump, _blocks[block].entry);
+    exitSite.linkedTo = block;
+    _blocks[block].incoming.push_back(site);
+}
+
+void Jit::unlink(int block) {
+    for(int site : _blocks[block].incoming) {
+        ExitSite &exitSite = _sites[site];
+        if(exitSite.linkedTo == block) {
+            X86Assembler::patch(exitSite.jump, exitSite.jump + 4);
+            exitSite.linkedTo = -1;
+        }
+    }
+    _blocks[block].incoming.clear();
+}
+
+// Unlinks the block from both ends, so the incoming lists of other blocks
+// only ever hold sites of live blocks.
+
+void Jit::discard(int block) {
+    Block &discarded = _blocks[block];
+    for(int site = discarded.firstSite; site < discarded.endSite; ++site) {
+        ExitSite &exitSite = _sites[site];
+        if(exitSite.linkedTo < 0) {
+            continue;
+        }
+        std::vector<int> &incoming = _blocks[exitSite.linkedTo].incoming;
+        std::vector<int>::iterator found = std::find(incoming.begin(), incoming.end(), site);
+        if(found != incoming.end()) {
+            *found = incoming.back();
+            incoming.pop_back();
+        }
+        exitSite.linkedTo = -1;
+    }
+    unlink(block);
+    discarded.live = false;
+    _blockAt[discarded.start] = -1;
+}
+
+void Jit::flush() {
+    _codeSize = _codeBase;
+    _blocks.clear();
+    _sites.clear();
+    std::fill(_blockAt.begin(), _blockAt.end(), -1);
+    for(uint8_t &code : _codeMap) {
+        code &= ~TranslatedCode;
+    }
+    ++_generation;
+}
+
+// Translates the basic block starting at word `start`. Returns the block
+// index, or -1 if the first instruction has to be interpreted.
+
+int Jit::translate(uint32_t start) {
+    if(_codeCapacity - _codeSize < maxBlockBytes) {
+        flush();
+    }
+
+    enum StubKind {
+        BudgetStub, // not enough budget to enter the block
+        FaultStub, // instruction at `position` has to be interpreted
+        StoreStub, // store at `position` hit translated code, word index in eax
+        ConstantStoreStub, // store at `position` hit translated code, word index in `value`
+        DynamicJumpStub, // jump at `position` taken, target in eax
+    };
+
+    struct Stub {
+        uint8_t *rel;
+        StubKind kind;
+        uint32_t position;
+        uint32_t value;
+    };
+
+    struct Site {
+        uint8_t *jump;
+        uint32_t target;
+    };
+
+    std::vector<Stub> stubs;
+    std::vector<Site> sites;
+
+    uint8_t *entry = _code + _codeSize;
+    X86Assembler as(entry);
+
+    uint8_t *budgetImm = as.subBudget(0);
+    stubs.push_back({as.jcc(LessCondition), BudgetStub, 0, 0});
+
+    // Chained exit to a known target. The jump initially falls through to
+    // the code returning to the runtime and is patched once the target
+    // block exists.
+    auto exitTo = [&](uint32_t target) {
+        uint8_t *jump = as.jmp();
+        as.movStateImm(STATE_FIELD(pc), target);
+        as.movStateImm(STATE_FIELD(reason), ContinueExit);
+        as.movStateImm(STATE_FIELD(site), _sites.size() + sites.size());
+        as.jmp(_epilogue);
+        sites.push_back({jump, target});
+    };
+
+    auto checkAddress = [&](uint32_t position) {
+        as.rr(0x39, false, MemorySizeRegister, RAX); // cmp eax, r15d
+        stubs.push_back({as.jcc(AboveOrEqualCondition), FaultStub, position, 0});
+        as.byte(0xA8); // test al, 3
+        as.byte(3);
+        stubs.push_back({as.jcc(NotEqualCondition), FaultStub, position, 0});
+    };
+
+    auto useAccumulator = [&](unsigned acu) {
+        as.movImm(LastAcRegister, acu);
+        as.rr(0x89, false, accumulatorRegister(acu), TestRegister);
+    };
+
+    uint32_t i = start;
+    uint32_t length = 0;
+    bool ended = false;
+    ExitReason stopReason = InterpretExit;
+
+    while(!ended && i < _words && length < maxBlockLength) {
+        Instruction inst = _memory[i].instruction;
+        uint32_t position = length;
+        int R = accumulatorRegister(inst.acu);
+
+        if(_invalidations[i] >= maxInvalidations) {
+            stopReason = SelfModifyingExit;
+            break;
+        }
+        if(!isTranslated(inst.code) || inst.mod == 3) {
+            break;
+        }
+        if(inst.mod != 0 && !isValidAddress(inst.adr, _words)) {
+            break;
+        }
+        if(inst.code == StoreInstruction && inst.mod == 0 && !isValidAddress(inst.adr, _words)) {
+            break;
+        }
+
+        // Effective address
+
+        bool constant = inst.mod == 0;
+        int32_t value = inst.adr;
+
+        if(inst.mod >= 1) {
+            as.rm(0x8B, false, RAX, MemoryRegister, inst.adr);
+        }
+        if(inst.mod == 2) {
+            checkAddress(position);
+            as.rmi(0x8B, false, RAX, MemoryRegister, RAX);
+        }
+
+        // Operation
+
+        switch(inst.code) {
+            case NullInstruction:
+                break;
+            case LoadInstruction:
+                if(constant) {
+                    as.movImm(R, value);
+                } else {
+                    as.rr(0x89, false, RAX, R);
+                }
+                useAccumulator(inst.acu);
+                break;
+            case StoreInstruction:
+                if(constant) {
+                    as.rm(0x89, false, R, MemoryRegister, value);
+                    useAccumulator(inst.acu);
+                    as.rm(0x80, false, 7, CodeMapRegister, value / 4); // cmp byte [r10 + index], 0
+                    as.byte(0);
+                    stubs.push_back({as.jcc(NotEqualCondition), ConstantStoreStub, position,
+                                     static_cast<uint32_t>(value) / 4});
+                } else {
+                    checkAddress(position);
+                    as.rmi(0x89, false, R, MemoryRegister, RAX);
+                    useAccumulator(inst.acu);
+                    as.rr(0xC1, false, 5, RAX); // shr eax, 2
+                    as.byte(2);
+                    as.rmi(0x80, false, 7, CodeMapRegister, RAX); // cmp byte [r10 + rax], 0
+                    as.byte(0);
+                    stubs.push_back({as.jcc(NotEqualCondition), StoreStub, position, 0});
+                }
+                break;
+            case AddInstruction:
+            case SubInstruction:
+            case MultInstruction:
+                if(constant) {
+                    if(inst.code == MultInstruction) {
+                        as.rr(0x69, false, R, R);
+                    } else {
+                        as.rr(0x81, false, inst.code == AddInstruction ? 0 : 5, R);
+                    }
+                    as.dword(value);
+                } else {
+                    if(inst.code == MultInstruction) {
+                        as.rr(0x0FAF, false, R, RAX);
+                    } else {
+                        as.rr(inst.code == AddInstruction ? 0x01 : 0x29, false, RAX, R);
+                    }
+                }
+                useAccumulator(inst.acu);
+                break;
+            case DivInstruction: {
+                // Division by zero and INT_MIN / -1 trap; leave them to the
+                // interpreter so they behave exactly like the reference engine
+                if(constant) {
+                    as.movImm(RCX, value);
+                } else {
+                    as.rr(0x89, false, RAX, RCX);
+                }
+                as.rr(0x85, false, RCX, RCX);
+                stubs.push_back({as.jcc(EqualCondition), FaultStub, position, 0});
+                as.rr(0x81, false, 7, RCX); // cmp ecx, -1
+                as.dword(static_cast<uint32_t>(-1));
+                as.byte(0x75); // jne +N
+                uint8_t *skip = as.here();
+                as.byte(0);
+                as.rr(0x81, false, 7, R); // cmp R, INT_MIN
+                as.dword(0x80000000u);
+                stubs.push_back({as.jcc(EqualCondition), FaultStub, position, 0});
+                *skip = static_cast<uint8_t>(as.here() - (skip + 1));
+                as.rr(0x89, false, R, RAX);
+                as.byte(0x99); // cdq
+                as.rr(0xF7, false, 7, RCX); // idiv ecx
+                as.rr(0x89, false, RAX, R);
+                useAccumulator(inst.acu);
+                break;
+            }
+            case JumpInstruction:
+            case JzeroInstruction:
+            case JnzeroInstruction:
+            case JposInstruction:
+            case JnegInstruction: {
+                // Conditional jumps skip over the taken path when the
+                // condition does not hold.
+                uint8_t *notTaken = nullptr;
+                if(inst.code != JumpInstruction) {
+                    Condition skip = NotEqualCondition;
+                    switch(inst.code) {
+                        case JzeroInstruction: skip = NotEqualCondition; break;
+                        case JnzeroInstruction: skip = EqualCondition; break;
+                        case JposInstruction: skip = LessOrEqualCondition; break;
+                        case JnegInstruction: skip = GreaterOrEqualCondition; break;
+                    }
+                    as.rr(0x85, false, TestRegister, TestRegister);
+                    notTaken = as.jcc(skip);
+                }
+
+                if(constant) {
+                    exitTo(static_cast<uint32_t>(value));
+                } else {
+                    stubs.push_back({as.jmp(), DynamicJumpStub, position, 0});
+                }
+
+                if(notTaken) {
+                    X86Assembler::patch(notTaken, as.here());
+                    exitTo((i + 1) * 4);
+                }
+                ended = true;
+                break;
+            }
+        }
+
+        ++length;
+        ++i;
+    }
+
+    if(length == 0) {
+        return -1;
+    }
+
+    if(!ended) {
+        if(i < _words && length < maxBlockLength) {
+            // Stopped in front of an instruction the translator leaves to the interpreter
+            as.movStateImm(STATE_FIELD(pc), i * 4);
+            as.movStateImm(STATE_FIELD(reason), stopReason);
+            as.jmp(_epilogue);
+        } else {
+            exitTo(i * 4);
+        }
+    }
+
+    std::memcpy(budgetImm, &length, 4);
+
+    for(const Stub &stub : stubs) {
+        X86Assembler::patch(stub.rel, as.here());
+
+        uint32_t executed = 0;
+        int32_t pc = 0;
+        ExitReason reason = InterpretExit;
+
+        switch(stub.kind) {
+            case BudgetStub:
+                executed = 0;
+                pc = start * 4;
+                reason = BudgetExit;
+                break;
+            case FaultStub:
+                executed = stub.position;
+                pc = (start + stub.position) * 4;
+                reason = InterpretExit;
+                break;
+            case StoreStub:
+                as.rm(0x89, false, RAX, StateRegister, STATE_FIELD(invalidatedWord));
+                executed = stub.position + 1;
+                pc = (start + stub.position + 1) * 4;
+                reason = InvalidateExit;
+                break;
+            case ConstantStoreStub:
+                as.movStateImm(STATE_FIELD(invalidatedWord), stub.value);
+                executed = stub.position + 1;
+                pc = (start + stub.position + 1) * 4;
+                reason = InvalidateExit;
+                break;
+            case DynamicJumpStub:
+                as.rm(0x89, false, RAX, StateRegister, STATE_FIELD(pc));
+                executed = stub.position + 1;
+                reason = ContinueExit;
+                break;
+        }
+
+        if(length - executed) {
+            as.addBudget(length - executed);
+        }
+        if(stub.kind != DynamicJumpStub) {
+            as.movStateImm(STATE_FIELD(pc), pc);
+        } else {
+            as.movStateImm(STATE_FIELD(site), -1);
+        }
+        as.movStateImm(STATE_FIELD(reason), reason);
+        as.jmp(_epilogue);
+    }
+
+    _codeSize = as.here() - _code;
+    assert(_codeSize <= _codeCapacity);
+
+    Block block;
+    block.start = start;
+    block.end = i;
+    block.entry = entry;
+    block.firstSite = _sites.size();
+    block.endSite = _sites.size() + sites.size();
+    block.live = true;
+
+    for(const Site &site : sites) {
+        _sites.push_back({site.jump, site.target, static_cast<int>(_blocks.size()), -1});
+    }
+    _blocks.push_back(block);
+
+    for(uint32_t word = start; word < i; ++word) {
+        _codeMap[word] |= TranslatedCode;
+    }
+
+    return _blocks.size() - 1;
+}
+
+#else
+
+Jit::Jit() {}
+
+Jit::~Jit() {}
+
+bool Jit::isAvailable() const {
+    return false;
+}
+
+void Jit::attach(Word *memory, size_t words) {
+    _memory = memory;
+    _words = words;
+}
+
+Jit::ExitReason Jit::execute(State &) {
+    return InterpretExit;
+}
+
+void Jit::invalidate(uint32_t) {}
+
+void Jit::markDecoded(uint32_t) {}
+
+const uint8_t *Jit::codeMap() const {
+    return nullptr;
+}
+
+#endif
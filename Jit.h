@@ -0,0 +1,147 @@
+/// Copyright (c) 2015 Jakub Trzebiatowski
+///
+/// Licensed under the Apache License, Version 2.0 (the "License");
+/// you may not use this file except in compliance with the License.
+/// You may obtain a copy of the License at
+///
+///     http://www.apache.org/licenses/LICENSE-2.0
+///
+/// Unless required by applicable law or agreed to in writing, software
+/// distributed under the License is distributed on an "AS IS" BASIS,
+/// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+/// See the License for the specific language governing permissions and
+/// limitations under the License.
+
+#ifndef AGHSM_JIT_H
+#define AGHSM_JIT_H
+
+#include "CodeEmitter.h"
+
+#include <cstdint>
+#include <vector>
+
+// The System V calling convention of the generated code is shared by x86-64
+// Linux, the BSDs and OS X
+#if defined(__x86_64__) && (defined(__unix__) || defined(__APPLE__))
+#define AGHSM_JIT_SUPPORTED 1
+#else
+#define AGHSM_JIT_SUPPORTED 0
+#endif
+
+/// Translates basic blocks of a DC2 program to x86-64 code on first execution.
+///
+/// A and B live in host registers while translated code runs. Blocks end at
+/// jumps; jump targets are chained directly once both blocks exist. Anything
+/// the translator does not handle (halt, print, dump, bad operands) leaves
+/// translated code and is executed by the VM's reference interpreter.
+class Jit {
+public:
+    enum ExitReason {
+        ContinueExit, // internal, never returned from execute()
+        InterpretExit, // instruction at pc has to be executed by the interpreter
+        InvalidateExit, // a store landed on code the VM's interpreter decoded, see markDecoded()
+        BudgetExit, // instruction budget exhausted before the block at pc
+        SelfModifyingExit, // code at pc is rewritten too often to be translated
+    };
+
+    /// Bits of the code map; a store to a word with any of them set leaves
+    /// translated code.
+    enum CodeMapBit {
+        TranslatedCode = 1,
+        DecodedCode = 2, // decoded by the VM's threaded interpreter
+    };
+
+    /// Guest state shared with translated code. Field offsets are baked into
+    /// the generated code.
+    struct State {
+        Word *memory = nullptr;
+        uint8_t *codeMap = nullptr;
+        int64_t budget = 0;
+        uint32_t memorySize = 0;
+        int32_t A = 0;
+        int32_t B = 0;
+        uint32_t lastAc = 2; // 0 - A, 1 - B, 2 - no accumulator used yet
+        int32_t testValue = 0;
+        int32_t pc = 0;
+        uint32_t reason = 0;
+        int32_t site = -1;
+        uint32_t invalidatedWord = 0;
+    };
+
+    Jit();
+
+    ~Jit();
+
+    /// False when the host cannot run generated code; the VM then falls back
+    /// to the threaded interpreter.
+    bool isAvailable() const;
+
+    /// Drops all translations and prepares the cache for a program image.
+    void attach(Word *memory, size_t words);
+
+    /// Runs translated code from state.pc until the interpreter has to step
+    /// in or the budget runs out.
+    ExitReason execute(State &state);
+
+    /// Discards every block that covers the given word, and clears its
+    /// DecodedCode bit.
+    void invalidate(uint32_t wordIndex);
+
+    /// Makes stores from translated code to the word return InvalidateExit,
+    /// so the VM can drop what its interpreter decoded from it.
+    void markDecoded(uint32_t wordIndex);
+
+    /// One byte of CodeMapBit per word, nullptr when the JIT is not available.
+    const uint8_t *codeMap() const;
+
+private:
+    struct Block {
+        uint32_t start;
+        uint32_t end;
+        uint8_t *entry;
+        std::vector<int> incoming; // sites of live blocks linked here
+        int firstSite; // exit sites of the block, [firstSite, endSite)
+        int endSite;
+        bool live;
+    };
+
+    struct ExitSite {
+        uint8_t *jump;
+        uint32_t target;
+        int source;
+        int linkedTo;
+    };
+
+    typedef void (*Trampoline)(State *state, const uint8_t *entry);
+
+    int blockAt(int32_t pc);
+
+    int translate(uint32_t start);
+
+    void link(int site, int block);
+
+    void flush();
+
+    void unlink(int block);
+
+    void discard(int block);
+
+    uint8_t *_code = nullptr;
+    size_t _codeCapacity = 0;
+    size_t _codeSize = 0;
+    size_t _codeBase = 0;
+    unsigned _generation = 0;
+    Trampoline _trampoline = nullptr;
+    uint8_t *_epilogue = nullptr;
+
+    Word *_memory = nullptr;
+    size_t _words = 0;
+    std::vector<uint8_t> _codeMap;
+    std::vector<uint8_t> _invalidations; // per word, saturating
+    std::vector<int> _blockAt;
+    std::vector<Block> _blocks;
+    std::vector<ExitSite> _sites;
+};
+
+
+#endif //AGHSM_JIT_H
@@ -12,5 +12,93 @@
 /// See the License for the specific language governing permissions and
 /// limitations under the License.
 
+
 #include "Language.h"
 
+#include <cstdint>
+
+// The hash of a keyword is h = h * keywordHashMultiplier + c over its
+// characters, modulo keywordSlots. The multiplier is picked so that no two
+// keywords share a slot, which is checked below.
+
+static constexpr uint32_t keywordHashMultiplier = 59;
+static constexpr size_t keywordSlots = 64;
+
+static constexpr size_t numDirectives = sizeof(directives) / sizeof(directives[0]);
+static constexpr size_t numKeywords = numDirectives + sizeof(instructions) / sizeof(instructions[0]);
+
+static constexpr const char *keywordAt(size_t i) {
+    return i < numDirectives ? directives[i] : instructions[i - numDirectives];
+}
+
+static constexpr size_t length(const char *s) {
+    return *s ? 1 + length(s + 1) : 0;
+}
+
+static constexpr size_t longestKeyword(size_t i = 0, size_t longest = 0) {
+    return i == numKeywords ? longest
+                            : longestKeyword(i + 1, length(keywordAt(i)) > longest ? length(keywordAt(i)) : longest);
+}
+
+static constexpr size_t maxKeywordLength = longestKeyword();
+
+static constexpr uint32_t keywordHash(const char *s, size_t n, uint32_t hash = 0) {
+    return n ? keywordHash(s + 1, n - 1, hash * keywordHashMultiplier + static_cast<unsigned char>(*s)) : hash;
+}
+
+static constexpr size_t keywordSlot(const char *s, size_t n) {
+    return keywordHash(s, n) % keywordSlots;
+}
+
+// The first keyword in `slot`, or -1
+
+static constexpr int slotKeyword(size_t slot, size_t i = 0) {
+    return i == numKeywords ? -1 : keywordSlot(keywordAt(i), length(keywordAt(i))) == slot
+                                   ? static_cast<int>(i) : slotKeyword(slot, i + 1);
+}
+
+static constexpr bool isPerfect(size_t i = 0) {
+    return i == numKeywords ||
+           (slotKeyword(keywordSlot(keywordAt(i), length(keywordAt(i)))) == static_cast<int>(i) && isPerfect(i + 1));
+}
+
+static_assert(isPerfect(), "keywords collide, pick another keywordHashMultiplier");
+
+template<size_t ...I>
+struct Indices {};
+
+template<size_t N, size_t ...I>
+struct MakeIndices : MakeIndices<N - 1, N - 1, I...> {};
+
+template<size_t ...I>
+struct MakeIndices<0, I...> {
+    typedef Indices<I...> Type;
+};
+
+struct KeywordTable {
+    int8_t slots[keywordSlots];
+};
+
+template<size_t ...I>
+static constexpr KeywordTable makeKeywordTable(Indices<I...>) {
+    return KeywordTable{{static_cast<int8_t>(slotKeyword(I))...}};
+}
+
+static constexpr KeywordTable keywordTable = makeKeywordTable(MakeIndices<keywordSlots>::Type());
+
+Keyword findKeyword(StringRef word) {
+    if(word.empty() || word.size > maxKeywordLength) {
+        return Keyword{};
+    }
+
+    int i = keywordTable.slots[keywordSlot(word.data, word.size)];
+    if(i < 0 || word != keywordAt(i)) {
+        return Keyword{};
+    }
+
+    if(static_cast<size_t>(i) < numDirectives) {
+        return Keyword{Keyword::DirectiveKeyword, i};
+    } else {
+        return Keyword{Keyword::InstructionKeyword, i - static_cast<int>(numDirectives)};
+    }
+}
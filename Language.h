@@ -15,6 +15,9 @@
 #ifndef AGHSM_LANGUAGE_H
 #define AGHSM_LANGUAGE_H
 
+#include "StringRef.h"
+
+#include <cstdint>
 
 //extern const char * const directives[];
 //
@@ -29,41 +32,142 @@ constexpr const char * directives[] = {
         ".WORD",
 };
 
+enum DirectiveCode {
+    UnitDirective,
+    CodeDirective,
+    DataDirective,
+    EndDirective,
+    WordDirective,
+};
+
+/// How the operand of an instruction is written in the source.
+enum OperandForm {
+    NoOperand, // halt
+    LabelOperand, // jump, label
+    RegisterValueOperand, // load, @A, (x)
+    RegisterOrValueOperand, // print, @A or print, (x)
+};
+
+/// What an instruction does with its accumulator (@A or @B, or the last one
+/// used for conditional jumps).
+enum AccumulatorUse {
+    NoAccumulator,
+    ReadsAccumulator,
+    WritesAccumulator,
+    TestsAccumulator,
+};
+
+/// Which part of the machine an instruction changes. The semantics of an
+/// instruction are the new accumulator for ComputeEffect, whether the jump is
+/// taken for BranchEffect, and unused otherwise.
+enum InstructionEffect {
+    NoEffect,
+    HaltEffect,
+    ComputeEffect,
+    StoreEffect,
+    BranchEffect,
+    PrintEffect,
+    DumpEffect,
+};
+
+/// The instruction set, in opcode order. Everything else about instructions
+/// (the opcodes, their names, how they are assembled, disassembled, decoded
+/// and executed) is generated from this table.
+///
+/// X(name, mnemonic, operand form, accumulator use, effect, semantics of `ac`
+/// and `operand`)
+#define AGHSM_ISA(X) \
+    X(Null,   null,   NoOperand,              NoAccumulator,     NoEffect,      0) \
+    X(Halt,   halt,   NoOperand,              NoAccumulator,     HaltEffect,    0) \
+    X(Load,   load,   RegisterValueOperand,   WritesAccumulator, ComputeEffect, operand) \
+    X(Store,  store,  RegisterValueOperand,   ReadsAccumulator,  StoreEffect,   0) \
+    X(Jump,   jump,   LabelOperand,           NoAccumulator,     BranchEffect,  true) \
+    X(Jzero,  jzero,  LabelOperand,           TestsAccumulator,  BranchEffect,  ac == 0) \
+    X(Jnzero, jnzero, LabelOperand,           TestsAccumulator,  BranchEffect,  ac != 0) \
+    X(Jpos,   jpos,   LabelOperand,           TestsAccumulator,  BranchEffect,  ac > 0) \
+    X(Jneg,   jneg,   LabelOperand,           TestsAccumulator,  BranchEffect,  ac < 0) \
+    X(Add,    add,    RegisterValueOperand,   WritesAccumulator, ComputeEffect, ac + operand) \
+    X(Sub,    sub,    RegisterValueOperand,   WritesAccumulator, ComputeEffect, ac - operand) \
+    X(Mult,   mult,   RegisterValueOperand,   WritesAccumulator, ComputeEffect, ac * operand) \
+    X(Div,    div,    RegisterValueOperand,   WritesAccumulator, ComputeEffect, ac / operand) \
+    X(Print,  print,  RegisterOrValueOperand, ReadsAccumulator,  PrintEffect,   0) \
+    X(Dump,   dump,   NoOperand,              NoAccumulator,     DumpEffect,    0)
+
 enum InstructionOpcode {
-    NullInstruction,
-    HaltInstruction,
-    LoadInstruction,
-    StoreInstruction,
-    JumpInstruction,
-    JzeroInstruction,
-    JnzeroInstruction,
-    JposInstruction,
-    JnegInstruction,
-    AddInstruction,
-    SubInstruction,
-    MultInstruction,
-    DivInstruction,
-    PrintInstruction,
-    DumpInstruction,
+#define AGHSM_ISA_OPCODE(name, mnemonic, form, accumulator, effect, semantics) name##Instruction,
+    AGHSM_ISA(AGHSM_ISA_OPCODE)
+#undef AGHSM_ISA_OPCODE
 };
 
 constexpr const char * instructions[] = {
-        "null",
-        "halt",
-        "load",
-        "store",
-        "jump",
-        "jzero",
-        "jnzero",
-        "jpos",
-        "jneg",
-        "add",
-        "sub",
-        "mult",
-        "div",
-        "print",
-        "dump",
+#define AGHSM_ISA_NAME(name, mnemonic, form, accumulator, effect, semantics) #mnemonic,
+    AGHSM_ISA(AGHSM_ISA_NAME)
+#undef AGHSM_ISA_NAME
+};
+
+constexpr int numInstructions = sizeof(instructions) / sizeof(instructions[0]);
+
+struct InstructionInfo {
+    const char *name;
+    OperandForm form;
+    AccumulatorUse accumulator;
+    InstructionEffect effect;
+};
+
+/// Indexed by opcode.
+constexpr InstructionInfo isa[] = {
+#define AGHSM_ISA_INFO(name, mnemonic, form, accumulator, effect, semantics) \
+    {#mnemonic, form, accumulator, effect},
+    AGHSM_ISA(AGHSM_ISA_INFO)
+#undef AGHSM_ISA_INFO
+};
+
+/// Semantics<opcode>::evaluate(ac, operand) is the semantics column of the
+/// instruction, so every engine computes it the same way.
+template<int Code>
+struct Semantics;
+
+#define AGHSM_ISA_SEMANTICS(name, mnemonic, form, accumulator, effect, semantics) \
+    template<> \
+    struct Semantics<name##Instruction> { \
+        static int32_t evaluate(int32_t ac, int32_t operand) { \
+            (void) ac; \
+            (void) operand; \
+            return semantics; \
+        } \
+    };
+AGHSM_ISA(AGHSM_ISA_SEMANTICS)
+#undef AGHSM_ISA_SEMANTICS
+
+/// Semantics<code>::evaluate() for an opcode known only at run time.
+inline int32_t evaluateInstruction(int code, int32_t ac, int32_t operand) {
+    switch(code) {
+#define AGHSM_ISA_EVALUATE(name, mnemonic, form, accumulator, effect, semantics) \
+        case name##Instruction: \
+            return Semantics<name##Instruction>::evaluate(ac, operand);
+        AGHSM_ISA(AGHSM_ISA_EVALUATE)
+#undef AGHSM_ISA_EVALUATE
+    }
+    return 0;
+}
+
+/// A directive or an instruction.
+struct Keyword {
+    enum Kind {
+        NoKeyword,
+        DirectiveKeyword,
+        InstructionKeyword
+    };
+
+    Keyword(Kind kind = NoKeyword, int code = 0) : kind(kind), code(code) {}
+
+    Kind kind;
+    int code; // DirectiveCode or InstructionOpcode
 };
 
+/// Recognizes directives and instructions with a perfect hash computed at
+/// compile time, so `word` is compared with at most one of them.
+Keyword findKeyword(StringRef word);
+
 
 #endif //AGHSM_LANGUAGE_H
@@ -12,10 +12,9 @@
 /// See the License for the specific language governing permissions and
 /// limitations under the License.
 
-#include "Language.h"
 #include "Lexer.h"
 
-#include <unordered_set>
+#include <cstring>
 
 static bool isDelimeter(char c) {
     switch(c) {
@@ -38,8 +37,9 @@ void Lexer::lexerError(std::string lexerError) {
 }
 
 char Lexer::readChar() {
-    if(_currentColumnNo <= _currentLine.size()) {
-        char c = _currentLine[_currentColumnNo];
+    if(_currentColumnNo <= _currentLine.size) {
+        // The line is not terminated in the source, its end reads as '\0'
+        char c = _currentColumnNo < _currentLine.size ? _currentLine[_currentColumnNo] : '\0';
         ++_currentColumnNo;
         return c;
     } else {
@@ -58,16 +58,21 @@ char Lexer::peekChar() {
 Token Lexer::readKeywordOrIdentifier() {
     Token token{Token::IdentifierToken};
 
+    int start = _currentColumnNo;
     while(std::isalnum(peekChar()) || peekChar() == '.' || peekChar() == '_') {
-        token.tokenData += readChar();
+        readChar();
     }
+    token.tokenData = StringRef(_currentLine.data + start, _currentColumnNo - start);
 
     if(!isDelimeter(peekChar())) {
         lexerError("identifier contains illegal characters");
     }
 
-    if(isKeyword(token.tokenData)) {
+    token.keyword = findKeyword(token.tokenData);
+    if(token.keyword.kind != Keyword::NoKeyword) {
         token.type = Token::KeywordToken;
+    } else {
+        token.symbol = _symbols->intern(token.tokenData);
     }
 
     return token;
@@ -76,7 +81,8 @@ Token Lexer::readKeywordOrIdentifier() {
 Token Lexer::readDelimiter() {
     Token token{Token::DelimiterToken};
 
-    token.tokenData = readChar();
+    token.tokenData = StringRef(_currentLine.data + _currentColumnNo, 1);
+    readChar();
 
     return token;
 }
@@ -84,15 +90,15 @@ Token Lexer::readDelimiter() {
 Token Lexer::readNumber() {
     Token token{Token::NumberToken};
 
-    int m = 1;
-
+    int start = _currentColumnNo;
     if(peekChar() == '-') {
-        token.tokenData = readChar();
+        readChar();
     }
 
     while(std::isdigit(peekChar())) {
-        token.tokenData += readChar();
+        readChar();
     }
+    token.tokenData = StringRef(_currentLine.data + start, _currentColumnNo - start);
 
     if(!isDelimeter(peekChar())) {
         lexerError("incorrect number");
@@ -107,9 +113,11 @@ Token Lexer::readRegister() {
     char at = readChar();
     assert(at == '@');
 
+    int start = _currentColumnNo;
     while(std::isalpha(peekChar())) {
-        token.tokenData += readChar();
+        readChar();
     }
+    token.tokenData = StringRef(_currentLine.data + start, _currentColumnNo - start);
 
     if(!isDelimeter(peekChar())) {
         throw LexerError("incorrect register name");
@@ -180,40 +188,64 @@ void Lexer::emitToken(Token token) {
     _tokenStream.insert(token);
 }
 
-void Lexer::lexLine() {
-    while(_currentColumnNo != _currentLine.size()) {
-        assert(_currentColumnNo < _currentLine.size());
-        Token token{Token::NullToken};
-        do {
-            token = readToken();
-            emitToken(token);
-        } while(token.type != Token::LineTerminatorToken);
+// Lines end with '\n', like with getline. The last line does not need one.
+// Empty lines have no tokens, other lines end with a LineTerminatorToken.
+
+Token Lexer::next() {
+    while(!_inLine) {
+        if(_nextLine == _sourceEnd) {
+            return Token{Token::NullToken};
+        }
+        if(_currentLine.data) {
+            ++_currentLineNo;
+        }
+        const char *newline = static_cast<const char *>(std::memchr(_nextLine, '\n', _sourceEnd - _nextLine));
+        const char *lineEnd = newline ? newline : _sourceEnd;
+        _currentLine = StringRef(_nextLine, lineEnd - _nextLine);
+        _currentColumnNo = 0;
+        _inLine = !_currentLine.empty();
+        _nextLine = newline ? newline + 1 : _sourceEnd;
+    }
+
+    Token token = readToken();
+    if(token.type == Token::LineTerminatorToken) {
+        _inLine = false;
     }
+    return token;
 }
 
 TokenStream Lexer::lex() {
-    for(std::string line; getline(_stream, line); ) {
-        _currentLine = line;
-        _currentColumnNo = 0;
-        lexLine();
-        ++_currentLineNo;
+    for(Token token = next(); token.type != Token::NullToken; token = next()) {
+        emitToken(token);
     }
 
-    return _tokenStream;
+    return std::move(_tokenStream);
 }
 
-Lexer::Lexer(std::istream &sourceStream) : _stream(sourceStream) {
-    for(auto directive : directives) {
-        _keywords.insert(directive);
-    }
-    for(auto instruction : instructions) {
-        _keywords.insert(instruction);
-    }
+Lexer::Lexer(std::istream &sourceStream) : Lexer(SourceBuffer::fromStream(sourceStream)) {
 }
 
-bool Lexer::isKeyword(std::string keyword) {
-    if(_keywords.find(keyword) != _keywords.end()) {
-        return true;
+Lexer::Lexer(std::shared_ptr<const SourceBuffer> source)
+        : _source(std::move(source)), _symbols(std::make_shared<SymbolTable>()), _nextLine(_source->data()),
+          _sourceEnd(_nextLine + _source->size()), _tokenStream(_source, _symbols) {
+}
+
+Lexer::Lexer(std::shared_ptr<const SourceBuffer> source, size_t begin, size_t end, int linesBefore,
+             std::shared_ptr<SymbolTable> symbols)
+        : Lexer(std::move(source)) {
+    _nextLine = _source->data() + begin;
+    _sourceEnd = _source->data() + end;
+    _currentLineNo = linesBefore;
+    if(symbols) {
+        _symbols = std::move(symbols);
+        _tokenStream = TokenStream(_source, _symbols);
     }
-    return false;
+}
+
+const std::shared_ptr<const SourceBuffer> &Lexer::source() const {
+    return _source;
+}
+
+std::shared_ptr<const SymbolTable> Lexer::symbols() const {
+    return _symbols;
 }
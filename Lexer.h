@@ -15,14 +15,19 @@
 #ifndef AGHSM_LEXER_H
 #define AGHSM_LEXER_H
 
+#include "Language.h"
+#include "SourceBuffer.h"
+#include "StringRef.h"
+#include "SymbolTable.h"
+
 #include <cassert>
 #include <cctype>
 #include <iostream>
+#include <memory>
 #include <string>
 #include <vector>
 #include <sstream>
 #include <fstream>
-#include <unordered_set>
 
 struct Token {
     enum Type {
@@ -40,15 +45,23 @@ struct Token {
     Type type;
     int lineNumber = 0;
     int columnNumber = 0;
-    std::string tokenData;
+    StringRef tokenData; // points into the source
+    Keyword keyword; // of a KeywordToken
+    uint32_t symbol = 0; // of an IdentifierToken
 };
 
 class TokenStream {
     std::vector<Token> _tokenStream;
+    std::shared_ptr<const SourceBuffer> _source; // keeps tokenData valid
+    std::shared_ptr<const SymbolTable> _symbols;
 
 public:
 
-    Token getTokenAt(size_t i) {
+    explicit TokenStream(std::shared_ptr<const SourceBuffer> source = nullptr,
+                         std::shared_ptr<const SymbolTable> symbols = nullptr)
+            : _source(std::move(source)), _symbols(std::move(symbols)) {}
+
+    const Token &getTokenAt(size_t i) const {
         return _tokenStream.at(i);
     }
 
@@ -56,12 +69,21 @@ public:
         _tokenStream.push_back(token);
     }
 
-    size_t size() {
+    size_t size() const {
         return _tokenStream.size();
     }
 
-    void print(std::ostream &os) {
-        for(Token token : _tokenStream) {
+    const std::shared_ptr<const SourceBuffer> &source() const {
+        return _source;
+    }
+
+    /// Names of the symbols of identifiers.
+    const std::shared_ptr<const SymbolTable> &symbols() const {
+        return _symbols;
+    }
+
+    void print(std::ostream &os) const {
+        for(const Token &token : _tokenStream) {
             std::string tokenType;
 
             switch (token.type) {
@@ -106,13 +128,31 @@ public:
         {}
     };
 
+    /// Reads the whole stream, then lexes it like a SourceBuffer.
     Lexer(std::istream &sourceStream);
 
+    /// Tokens point into `source` instead of copying it.
+    explicit Lexer(std::shared_ptr<const SourceBuffer> source);
+
+    /// Lexes only the lines in [begin, end) of `source`, numbering them from
+    /// the line after `linesBefore`. `begin` has to start a line. Identifiers
+    /// are interned in `symbols` if given, so that they are numbered like in
+    /// another lexer.
+    Lexer(std::shared_ptr<const SourceBuffer> source, size_t begin, size_t end, int linesBefore,
+          std::shared_ptr<SymbolTable> symbols = nullptr);
+
     TokenStream lex();
 
-private:
+    /// Lexes the next token on demand, NullToken at the end of the source.
+    /// Lexing this way never holds more than one line of tokens.
+    Token next();
+
+    const std::shared_ptr<const SourceBuffer> &source() const;
 
-    bool isKeyword(std::string keyword);
+    /// Names of the symbols of identifiers.
+    std::shared_ptr<const SymbolTable> symbols() const;
+
+private:
 
     void lexerError(std::string errorMessage);
 
@@ -136,11 +176,12 @@ private:
 
     void emitToken(Token token);
 
-    void lexLine();
-
-    std::unordered_set<std::string> _keywords;
-    std::istream &_stream;
-    std::string _currentLine;
+    std::shared_ptr<const SourceBuffer> _source;
+    std::shared_ptr<SymbolTable> _symbols;
+    const char *_nextLine;
+    const char *_sourceEnd;
+    bool _inLine = false;
+    StringRef _currentLine;
     int _currentLineNo = 0;
     int _currentColumnNo = 0;
     TokenStream _tokenStream;
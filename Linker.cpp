@@ -0,0 +1,95 @@
+/// Copyright (c) 2015 Jakub Trzebiatowski
+///
+/// Licensed under the Apache License, Version 2.0 (the "License");
+/// you may not use this file except in compliance with the License.
+/// You may obtain a copy of the License at
+///
+///     http://www.apache.org/licenses/LICENSE-2.0
+///
+/// Unless required by applicable law or agreed to in writing, software
+/// distributed under the License is distributed on an "AS IS" BASIS,
+/// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+/// See the License for the specific language governing permissions and
+/// limitations under the License.
+
+
+#include "Linker.h"
+
+#include <algorithm>
+#include <sstream>
+
+void Linker::linkerError(std::string errorMessage) {
+    std::stringstream ss;
+    ss << "Linker error: " << errorMessage;
+    throw LinkerError{ ss.str() };
+}
+
+void Linker::add(std::shared_ptr<const Object> object) {
+    _objects.push_back(std::move(object));
+}
+
+// Every unit is placed after the ones before it, then exports get their
+// addresses in the program. Addresses of labels of a unit move by where the
+// unit is placed, and imports take the address of the export of the same
+// name.
+
+std::vector<Word> Linker::link() {
+    if(_objects.empty()) {
+        linkerError("no units to link");
+    }
+
+    std::vector<size_t> bases;
+    size_t size = 1; // the entry point
+    for(const auto &object : _objects) {
+        bases.push_back(size);
+        size += object->words.size();
+    }
+
+    _labels.clear();
+    for(size_t i = 0; i < _objects.size(); ++i) {
+        for(const auto &symbol : _objects[i]->exports) {
+            if(!_labels.emplace(symbol.first, bases[i] + symbol.second).second) {
+                linkerError("symbol defined in more than one unit: " + symbol.first);
+            }
+        }
+    }
+
+    std::vector<Word> program(size);
+    _lineNumbers.assign(size, 0);
+    const Object &first = *_objects.front();
+    program[0].data = (first.codeStart >= 0 ? bases[0] + first.codeStart : 0) * 4;
+    for(size_t i = 0; i < _objects.size(); ++i) {
+        const Object &object = *_objects[i];
+        std::copy(object.words.begin(), object.words.end(), program.begin() + bases[i]);
+        std::copy(object.lineNumbers.begin(), object.lineNumbers.end(), _lineNumbers.begin() + bases[i]);
+
+        for(const Object::Relocation &relocation : object.relocations) {
+            Word &word = program[bases[i] + relocation.word];
+            int address;
+            if(relocation.import < 0) {
+                address = (relocation.data ? word.data : word.instruction.adr) + bases[i] * 4;
+            } else {
+                auto label = _labels.find(object.imports[relocation.import]);
+                if(label == _labels.end()) {
+                    linkerError("undefined symbol: " + object.imports[relocation.import]);
+                }
+                address = label->second * 4;
+            }
+            if(relocation.data) {
+                word.data = address;
+            } else {
+                word.instruction.adr = address;
+            }
+        }
+    }
+
+    return program;
+}
+
+const std::unordered_map<std::string, int> &Linker::labels() const {
+    return _labels;
+}
+
+const std::vector<int> &Linker::lineNumbers() const {
+    return _lineNumbers;
+}
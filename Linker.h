@@ -0,0 +1,62 @@
+/// Copyright (c) 2015 Jakub Trzebiatowski
+///
+/// Licensed under the Apache License, Version 2.0 (the "License");
+/// you may not use this file except in compliance with the License.
+/// You may obtain a copy of the License at
+///
+///     http://www.apache.org/licenses/LICENSE-2.0
+///
+/// Unless required by applicable law or agreed to in writing, software
+/// distributed under the License is distributed on an "AS IS" BASIS,
+/// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+/// See the License for the specific language governing permissions and
+/// limitations under the License.
+
+
+#ifndef AGHSM_LINKER_H
+#define AGHSM_LINKER_H
+
+#include "Image.h"
+
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/// Links units assembled on their own into a program. The words of the units
+/// follow the entry point one after another, in the order the units were
+/// added, and the program starts at the code of the first unit. A single
+/// unit links into the same program it assembles into.
+class Linker {
+public:
+    class LinkerError : public std::logic_error {
+    public:
+        LinkerError(std::string errorMessage)
+                : std::logic_error(errorMessage)
+        {}
+    };
+
+    void add(std::shared_ptr<const Object> object);
+
+    /// Throws LinkerError if a symbol is exported by more than one unit or
+    /// imported but exported by none.
+    std::vector<Word> link();
+
+    /// Word index of every exported label of the last linked program.
+    const std::unordered_map<std::string, int> &labels() const;
+
+    /// Source line of every word of the last linked program, in the source
+    /// of its unit.
+    const std::vector<int> &lineNumbers() const;
+
+private:
+    void linkerError(std::string errorMessage);
+
+    std::vector<std::shared_ptr<const Object>> _objects;
+    std::unordered_map<std::string, int> _labels;
+    std::vector<int> _lineNumbers;
+};
+
+
+#endif //AGHSM_LINKER_H
@@ -0,0 +1,621 @@
+/// Copyright (c) 2015 Jakub Trzebiatowski
+///
+/// Licensed under the Apache License, Version 2.0 (the "License");
+/// you may not use this file except in compliance with the License.
+/// You may obtain a copy of the License at
+///
+///     http://www.apache.org/licenses/LICENSE-2.0
+///
+/// Unless required by applicable law or agreed to in writing, software
+/// distributed under the License is distributed on an "AS IS" BASIS,
+/// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+/// See the License for the specific language governing permissions and
+/// limitations under the License.
+
+#include "LockstepVM.h"
+#include "Language.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <limits>
+#include <sstream>
+
+// Groups executed between two reads of the clock
+static const uint64_t timeCheckInterval = 1 << 16;
+
+static inline bool isValidAddress(int32_t address, size_t words) {
+    return static_cast<uint32_t>(address) / 4 < words && !(address & 3);
+}
+
+static inline const char *addressError(int32_t address) {
+    return address & 3 ? "unaligned memory access" : "out of program memory access";
+}
+
+// Two's complement arithmetic, like the host registers of the other engines
+static inline int32_t wrap(uint32_t value) {
+    return static_cast<int32_t>(value);
+}
+
+std::vector<LockstepVM::DataOverride> LockstepVM::readOverrides(
+        std::istream &is, const std::unordered_map<std::string, int> &labels) {
+    std::vector<DataOverride> overrides;
+    size_t lanes = 0;
+    int lineNumber = 0;
+
+    for(std::string line; getline(is, line); ) {
+        ++lineNumber;
+        std::istringstream fields(line);
+        std::string name;
+        if(!(fields >> name) || name[0] == '#') {
+            continue;
+        }
+
+        std::string where = "line " + std::to_string(lineNumber) + ": ";
+
+        size_t offset = 0;
+        size_t bracket = name.find('[');
+        if(bracket != std::string::npos) {
+            if(name.back() != ']' || bracket + 2 >= name.size()) {
+                throw LockstepException{where + "malformed word reference " + name};
+            }
+            std::string index = name.substr(bracket + 1, name.size() - bracket - 2);
+            if(index.find_first_not_of("0123456789") != std::string::npos) {
+                throw LockstepException{where + "malformed word reference " + name};
+            }
+            offset = std::stoul(index);
+            name.resize(bracket);
+        }
+
+        auto label = labels.find(name);
+        if(label == labels.end()) {
+            throw LockstepException{where + "unknown label " + name};
+        }
+
+        DataOverride dataOverride;
+        dataOverride.wordIndex = label->second + offset;
+        for(std::string value; fields >> value; ) {
+            char *end;
+            long long data = std::strtoll(value.c_str(), &end, 0);
+            if(*end || data < std::numeric_limits<int32_t>::min() ||
+               data > std::numeric_limits<int32_t>::max()) {
+                throw LockstepException{where + "invalid value " + value};
+            }
+            dataOverride.values.push_back(static_cast<int32_t>(data));
+        }
+
+        if(dataOverride.values.empty()) {
+            throw LockstepException{where + "no values for " + name};
+        }
+        if(lanes && dataOverride.values.size() != lanes) {
+            throw LockstepException{where + "expected " + std::to_string(lanes) + " values"};
+        }
+        lanes = dataOverride.values.size();
+
+        overrides.push_back(std::move(dataOverride));
+    }
+
+    return overrides;
+}
+
+LockstepVM::LockstepVM(const std::vector<Word> &program, size_t lanes)
+        : _lanes(lanes), _words(program.size()) {
+    if(!_lanes) {
+        throw LockstepException{"at least one lane is required"};
+    }
+
+    _memory.resize(_words * _lanes);
+    for(size_t i = 0; i < _words; ++i) {
+        std::fill_n(row(i), _lanes, program[i].data);
+    }
+    _uniformWord.assign(_words, 1);
+}
+
+size_t LockstepVM::lanes() const {
+    return _lanes;
+}
+
+void LockstepVM::setWord(size_t lane, size_t wordIndex, int32_t data) {
+    if(lane >= _lanes || wordIndex >= _words) {
+        throw LockstepException{"word " + std::to_string(wordIndex) + " of lane " +
+                                std::to_string(lane) + " is out of range"};
+    }
+    row(wordIndex)[lane] = data;
+    _uniformWord[wordIndex] = 0;
+}
+
+void LockstepVM::applyOverrides(const std::vector<DataOverride> &overrides) {
+    for(const DataOverride &dataOverride : overrides) {
+        if(dataOverride.values.size() != _lanes) {
+            throw LockstepException{"expected " + std::to_string(_lanes) + " values"};
+        }
+        for(size_t lane = 0; lane < _lanes; ++lane) {
+            setWord(lane, dataOverride.wordIndex, dataOverride.values[lane]);
+        }
+    }
+}
+
+void LockstepVM::setLimits(VM::Limits limits) {
+    if(limits.memory) {
+        throw LockstepException{"extended memory is not supported in lockstep mode"};
+    }
+    _limits = limits;
+}
+
+void LockstepVM::setOutputLimit(size_t outputLimit) {
+    _outputLimit = outputLimit;
+}
+
+void LockstepVM::run() {
+    A.assign(_lanes, 0);
+    B.assign(_lanes, 0);
+    PC.assign(_lanes, 0);
+    _lastAc.assign(_lanes, 2);
+    _operand.assign(_lanes, 0);
+    _active.assign(_lanes, 1);
+    _mask.assign(_lanes, 0);
+    _results.assign(_lanes, BatchResult{});
+    _executed.assign(_lanes, 0);
+    _steps = 0;
+    _denseSteps = 0;
+    _activeCount = _lanes;
+    auto start = std::chrono::steady_clock::now();
+
+    if(_words) {
+        std::copy_n(row(0), _lanes, PC.begin());
+    } else {
+        std::fill(_mask.begin(), _mask.end(), 1);
+        faultGroup("out of program memory access");
+    }
+    updateConvergence();
+
+    while(_activeCount) {
+        if(_limits.time.count() && _steps % timeCheckInterval == 0 &&
+           std::chrono::steady_clock::now() - start >= _limits.time) {
+            for(size_t lane = 0; lane < _lanes; ++lane) {
+                if(_active[lane]) {
+                    stop(lane, "time limit exceeded");
+                }
+            }
+            break;
+        }
+
+        size_t leader = selectGroup();
+
+        // No lane has executed more instructions than there were groups
+        if(_limits.instructions && _steps >= _limits.instructions) {
+            stopExhausted();
+            if(!_mask[leader]) {
+                updateConvergence();
+                continue;
+            }
+        }
+
+        int32_t pc = PC[leader];
+
+        if(!isValidAddress(pc, _words)) {
+            faultGroup(addressError(pc));
+            updateConvergence();
+            continue;
+        }
+
+        // Lanes which have overwritten this word differently wait for the
+        // next round, when they form a group of their own
+        size_t index = static_cast<uint32_t>(pc) / 4;
+        const int32_t *code = row(index);
+        Word word;
+        word.data = code[leader];
+        bool converged = _converged;
+        if(!_uniformWord[index]) {
+            bool uniform = true;
+            for(size_t lane = 0; lane < _lanes; ++lane) {
+                if(code[lane] != word.data) {
+                    uniform = false;
+                    if(_mask[lane]) {
+                        _mask[lane] = 0;
+                        _dense = false;
+                        converged = false;
+                    }
+                }
+            }
+            _uniformWord[index] = uniform;
+        }
+
+        int32_t *pcs = PC.data();
+        const uint8_t *mask = _mask.data();
+        for(size_t lane = 0; lane < _lanes; ++lane) {
+            pcs[lane] += mask[lane] ? 4 : 0;
+        }
+        ++_steps;
+
+        // Instructions executed by every lane are counted once
+        if(_dense) {
+            ++_denseSteps;
+        } else if(_limits.instructions) {
+            uint64_t *executed = _executed.data();
+            for(size_t lane = 0; lane < _lanes; ++lane) {
+                executed[lane] += mask[lane];
+            }
+        }
+
+        Instruction instruction = word.instruction;
+        size_t activeCount = _activeCount;
+        if(fetchOperands(instruction)) {
+            execute(instruction);
+        }
+
+        // Only jumps and lanes leaving the group can split converged lanes
+        if(!converged || activeCount != _activeCount ||
+           (instruction.code < numInstructions && isa[instruction.code].effect == BranchEffect)) {
+            updateConvergence();
+        }
+    }
+
+    for(BatchResult &result : _results) {
+        if(result.status == BatchResult::PendingStatus) {
+            result.status = BatchResult::OkStatus;
+        }
+    }
+}
+
+const std::vector<BatchResult> &LockstepVM::results() const {
+    return _results;
+}
+
+bool LockstepVM::allSucceeded() const {
+    for(const BatchResult &result : _results) {
+        if(result.status != BatchResult::OkStatus) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool LockstepVM::anyFailed() const {
+    for(const BatchResult &result : _results) {
+        if(result.status == BatchResult::FailedStatus) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void LockstepVM::printReport(std::ostream &os) const {
+    size_t failed = 0;
+    size_t stopped = 0;
+    for(size_t i = 0; i < _results.size(); ++i) {
+        const BatchResult &result = _results[i];
+        os << "=== lane " << i << ": ";
+        if(result.status == BatchResult::OkStatus) {
+            os << "ok" << std::endl;
+        } else if(result.status == BatchResult::LimitStatus) {
+            os << "stopped: " << result.error << std::endl;
+            ++stopped;
+        } else {
+            os << "error: " << result.error << std::endl;
+            ++failed;
+        }
+        os << result.output;
+        if(result.truncated) {
+            if(!result.output.empty() && result.output.back() != '\n') {
+                os << std::endl;
+            }
+            os << "[output truncated]" << std::endl;
+        }
+    }
+    os << "=== " << _results.size() - failed - stopped << " ok, " << failed << " failed";
+    if(stopped) {
+        os << ", " << stopped << " stopped";
+    }
+    os << std::endl;
+}
+
+// Picks the lanes to execute next: all active lanes while they agree on PC,
+// otherwise the lanes with the lowest PC. Returns the first lane of the group.
+
+size_t LockstepVM::selectGroup() {
+    const uint8_t *active = _active.data();
+    uint8_t *mask = _mask.data();
+
+    size_t leader = std::find(_active.begin(), _active.end(), 1) - _active.begin();
+
+    if(_converged) {
+        std::copy(_active.begin(), _active.end(), _mask.begin());
+        _dense = _activeCount == _lanes;
+        return leader;
+    }
+
+    int32_t lowest = PC[leader];
+    for(size_t lane = leader + 1; lane < _lanes; ++lane) {
+        if(active[lane] && PC[lane] < lowest) {
+            lowest = PC[lane];
+            leader = lane;
+        }
+    }
+
+    for(size_t lane = 0; lane < _lanes; ++lane) {
+        mask[lane] = active[lane] && PC[lane] == lowest;
+    }
+    _dense = false;
+    return leader;
+}
+
+// Fills _operand for the lanes of the current group, faulting lanes whose
+// operand cannot be read. Returns false if no lane is left.
+
+bool LockstepVM::fetchOperands(const Instruction &instruction) {
+    int32_t *operand = _operand.data();
+
+    switch(instruction.mod) {
+        case 0:
+            std::fill(_operand.begin(), _operand.end(), instruction.adr);
+            return true;
+        case 1:
+            if(!isValidAddress(instruction.adr, _words)) {
+                faultGroup(addressError(instruction.adr));
+                return false;
+            }
+            std::copy_n(row(instruction.adr / 4), _lanes, operand);
+            return true;
+        case 2: {
+            if(!isValidAddress(instruction.adr, _words)) {
+                faultGroup(addressError(instruction.adr));
+                return false;
+            }
+            const int32_t *pointers = row(instruction.adr / 4);
+            bool any = false;
+            for(size_t lane = 0; lane < _lanes; ++lane) {
+                if(!_mask[lane]) {
+                    continue;
+                }
+                int32_t address = pointers[lane];
+                if(!isValidAddress(address, _words)) {
+                    fault(lane, addressError(address));
+                    continue;
+                }
+                operand[lane] = row(address / 4)[lane];
+                any = true;
+            }
+            return any;
+        }
+        default:
+            faultGroup("unsupported addressing mode");
+            return false;
+    }
+}
+
+void LockstepVM::execute(const Instruction &instruction) {
+    const size_t lanes = _lanes;
+    const uint8_t *mask = _mask.data();
+    const int32_t *operand = _operand.data();
+    int32_t *ac = instruction.acu ? B.data() : A.data();
+    uint8_t *lastAc = _lastAc.data();
+    const uint8_t acu = instruction.acu;
+
+    // Accumulator updates shared by load, add, sub and mult
+#define LANE_LOOP(expression) \
+    if(_dense) { \
+        for(size_t lane = 0; lane < lanes; ++lane) { \
+            ac[lane] = (expression); \
+            lastAc[lane] = acu; \
+        } \
+    } else { \
+        for(size_t lane = 0; lane < lanes; ++lane) { \
+            ac[lane] = mask[lane] ? (expression) : ac[lane]; \
+            lastAc[lane] = mask[lane] ? acu : lastAc[lane]; \
+        } \
+    }
+
+    switch(instruction.code) {
+        case NullInstruction:
+            return;
+        case HaltInstruction:
+            for(size_t lane = 0; lane < lanes; ++lane) {
+                if(mask[lane]) {
+                    halt(lane);
+                }
+            }
+            return;
+        case LoadInstruction:
+            LANE_LOOP(operand[lane])
+            return;
+        case StoreInstruction:
+            executeStore(instruction, ac);
+            return;
+        case JumpInstruction:
+            executeJump([](int32_t value) { return Semantics<JumpInstruction>::evaluate(value, 0); });
+            return;
+        case JzeroInstruction:
+            executeJump([](int32_t value) { return Semantics<JzeroInstruction>::evaluate(value, 0); });
+            return;
+        case JnzeroInstruction:
+            executeJump([](int32_t value) { return Semantics<JnzeroInstruction>::evaluate(value, 0); });
+            return;
+        case JposInstruction:
+            executeJump([](int32_t value) { return Semantics<JposInstruction>::evaluate(value, 0); });
+            return;
+        case JnegInstruction:
+            executeJump([](int32_t value) { return Semantics<JnegInstruction>::evaluate(value, 0); });
+            return;
+        case AddInstruction:
+            LANE_LOOP(wrap(static_cast<uint32_t>(ac[lane]) + static_cast<uint32_t>(operand[lane])))
+            return;
+        case SubInstruction:
+            LANE_LOOP(wrap(static_cast<uint32_t>(ac[lane]) - static_cast<uint32_t>(operand[lane])))
+            return;
+        case MultInstruction:
+            LANE_LOOP(wrap(static_cast<uint32_t>(ac[lane]) * static_cast<uint32_t>(operand[lane])))
+            return;
+        case DivInstruction:
+            // No vector division on x86, and a zero divisor only stops its own lane
+            for(size_t lane = 0; lane < lanes; ++lane) {
+                if(!mask[lane]) {
+                    continue;
+                }
+                if(operand[lane] == 0) {
+                    fault(lane, "division by zero");
+                    continue;
+                }
+                if(operand[lane] == -1 && ac[lane] == std::numeric_limits<int32_t>::min()) {
+                    fault(lane, "division overflow");
+                    continue;
+                }
+                ac[lane] /= operand[lane];
+                lastAc[lane] = acu;
+            }
+            return;
+        case PrintInstruction:
+            for(size_t lane = 0; lane < lanes; ++lane) {
+                if(mask[lane]) {
+                    append(lane, std::to_string(instruction.usr ? operand[lane] : ac[lane]) + '\n');
+                }
+            }
+            return;
+        case DumpInstruction:
+            for(size_t lane = 0; lane < lanes; ++lane) {
+                if(mask[lane]) {
+                    dump(lane);
+                }
+            }
+            return;
+    }
+
+#undef LANE_LOOP
+
+    faultGroup("unrecognized instruction");
+}
+
+void LockstepVM::executeStore(const Instruction &instruction, const int32_t *ac) {
+    uint8_t *lastAc = _lastAc.data();
+    const uint8_t *mask = _mask.data();
+    const uint8_t acu = instruction.acu;
+
+    // Immediate address: one row, written by a single loop
+    if(instruction.mod == 0) {
+        int32_t address = instruction.adr;
+        if(!isValidAddress(address, _words)) {
+            faultGroup(addressError(address));
+            return;
+        }
+        int32_t *target = row(address / 4);
+        if(_dense) {
+            std::copy_n(ac, _lanes, target);
+        } else {
+            for(size_t lane = 0; lane < _lanes; ++lane) {
+                target[lane] = mask[lane] ? ac[lane] : target[lane];
+            }
+        }
+        _uniformWord[address / 4] = 0;
+    } else {
+        for(size_t lane = 0; lane < _lanes; ++lane) {
+            if(!mask[lane]) {
+                continue;
+            }
+            int32_t address = _operand[lane];
+            if(!isValidAddress(address, _words)) {
+                fault(lane, addressError(address));
+                continue;
+            }
+            row(address / 4)[lane] = ac[lane];
+            _uniformWord[address / 4] = 0;
+        }
+    }
+
+    for(size_t lane = 0; lane < _lanes; ++lane) {
+        lastAc[lane] = mask[lane] ? acu : lastAc[lane];
+    }
+}
+
+template<typename Condition>
+void LockstepVM::executeJump(Condition condition) {
+    const uint8_t *mask = _mask.data();
+    const uint8_t *lastAc = _lastAc.data();
+    const int32_t *a = A.data();
+    const int32_t *b = B.data();
+    const int32_t *operand = _operand.data();
+    int32_t *pcs = PC.data();
+
+    for(size_t lane = 0; lane < _lanes; ++lane) {
+        int32_t value = lastAc[lane] == 0 ? a[lane] : lastAc[lane] == 1 ? b[lane] : 0;
+        pcs[lane] = mask[lane] && condition(value) ? operand[lane] : pcs[lane];
+    }
+}
+
+void LockstepVM::updateConvergence() {
+    _converged = true;
+    size_t leader = std::find(_active.begin(), _active.end(), 1) - _active.begin();
+    for(size_t lane = leader + 1; lane < _lanes; ++lane) {
+        if(_active[lane] && PC[lane] != PC[leader]) {
+            _converged = false;
+            return;
+        }
+    }
+}
+
+void LockstepVM::halt(size_t lane) {
+    _active[lane] = 0;
+    _mask[lane] = 0;
+    _dense = false;
+    --_activeCount;
+    _results[lane].status = BatchResult::OkStatus;
+}
+
+void LockstepVM::fault(size_t lane, const char *errorMessage) {
+    halt(lane);
+    _results[lane].status = BatchResult::FailedStatus;
+    _results[lane].error = errorMessage;
+}
+
+void LockstepVM::faultGroup(const char *errorMessage) {
+    for(size_t lane = 0; lane < _lanes; ++lane) {
+        if(_mask[lane]) {
+            fault(lane, errorMessage);
+        }
+    }
+}
+
+void LockstepVM::stop(size_t lane, const char *errorMessage) {
+    halt(lane);
+    _results[lane].status = BatchResult::LimitStatus;
+    _results[lane].error = errorMessage;
+}
+
+// Stops the lanes of the current group which have used up their
+// instruction budget.
+
+void LockstepVM::stopExhausted() {
+    for(size_t lane = 0; lane < _lanes; ++lane) {
+        if(_mask[lane] && _executed[lane] + _denseSteps >= _limits.instructions) {
+            stop(lane, "instruction limit exceeded");
+        }
+    }
+}
+
+// Appends to the output of a lane, up to the output limit
+
+void LockstepVM::append(size_t lane, const std::string &text) {
+    BatchResult &result = _results[lane];
+    size_t room = _outputLimit - result.output.size();
+    if(text.size() > room) {
+        result.output.append(text, 0, room);
+        result.truncated = true;
+    } else {
+        result.output += text;
+    }
+}
+
+void LockstepVM::dump(size_t lane) {
+    std::vector<Word> program(_words);
+    for(size_t i = 0; i < _words; ++i) {
+        program[i].data = row(i)[lane];
+    }
+
+    std::ostringstream os;
+    os << "< " << "@PC = " << PC[lane] << " @A = " << A[lane] << " @B = " << B[lane] << " >" << std::endl;
+    printProgram(os, program);
+    append(lane, os.str());
+}
+
+int32_t *LockstepVM::row(size_t wordIndex) {
+    return &_memory[wordIndex * _lanes];
+}
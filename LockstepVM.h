@@ -0,0 +1,147 @@
+/// Copyright (c) 2015 Jakub Trzebiatowski
+///
+/// Licensed under the Apache License, Version 2.0 (the "License");
+/// you may not use this file except in compliance with the License.
+/// You may obtain a copy of the License at
+///
+///     http://www.apache.org/licenses/LICENSE-2.0
+///
+/// Unless required by applicable law or agreed to in writing, software
+/// distributed under the License is distributed on an "AS IS" BASIS,
+/// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+/// See the License for the specific language governing permissions and
+/// limitations under the License.
+
+#ifndef AGHSM_LOCKSTEPVM_H
+#define AGHSM_LOCKSTEPVM_H
+
+#include "BatchRunner.h"
+#include "CodeEmitter.h"
+
+#include <cstdint>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/// Runs many instances (lanes) of one program side by side, each with its
+/// own registers and memory.
+///
+/// Registers and memory are kept in structure-of-arrays form, one row of
+/// lanes per word, so an instruction shared by a group of lanes is executed
+/// by a single loop over the row. The loops have no per-lane branches and
+/// are vectorized by the compiler. When lanes take different branches, the
+/// group with the lowest PC runs first and the others wait for it, so lanes
+/// that rejoin the same path are executed together again.
+class LockstepVM {
+public:
+    class LockstepException : public std::logic_error {
+    public:
+        LockstepException(std::string errorMessage)
+                : std::logic_error(errorMessage)
+        {}
+    };
+
+    /// Per-lane values of one word of the program.
+    struct DataOverride {
+        size_t wordIndex;
+        std::vector<int32_t> values;
+    };
+
+    /// Reads a data override file. Every line names a word, `label` or
+    /// `label[i]` for the i-th word after the label, followed by one value per
+    /// lane. Blank lines and lines starting with '#' are skipped.
+    static std::vector<DataOverride> readOverrides(std::istream &is,
+                                                   const std::unordered_map<std::string, int> &labels);
+
+    LockstepVM(const std::vector<Word> &program, size_t lanes);
+
+    size_t lanes() const;
+
+    void setWord(size_t lane, size_t wordIndex, int32_t data);
+
+    void applyOverrides(const std::vector<DataOverride> &overrides);
+
+    /// Lanes which execute more than `limits.instructions` instructions, or
+    /// are still running after `limits.time`, are stopped with
+    /// BatchResult::LimitStatus. Extended memory is not supported.
+    void setLimits(VM::Limits limits);
+
+    /// Output of a lane past `outputLimit` bytes is dropped.
+    void setOutputLimit(size_t outputLimit);
+
+    /// Runs every lane from the program entry until it halts, faults or is
+    /// stopped by a limit.
+    void run();
+
+    const std::vector<BatchResult> &results() const;
+
+    bool allSucceeded() const;
+
+    /// True if a lane failed for another reason than the limits.
+    bool anyFailed() const;
+
+    void printReport(std::ostream &os) const;
+
+private:
+    size_t selectGroup();
+
+    bool fetchOperands(const Instruction &instruction);
+
+    void execute(const Instruction &instruction);
+
+    void executeStore(const Instruction &instruction, const int32_t *ac);
+
+    template<typename Condition>
+    void executeJump(Condition condition);
+
+    void updateConvergence();
+
+    void halt(size_t lane);
+
+    void fault(size_t lane, const char *errorMessage);
+
+    void faultGroup(const char *errorMessage);
+
+    void stop(size_t lane, const char *errorMessage);
+
+    void stopExhausted();
+
+    void append(size_t lane, const std::string &text);
+
+    void dump(size_t lane);
+
+    int32_t *row(size_t wordIndex);
+
+    size_t _lanes;
+    size_t _words;
+
+    // _memory[wordIndex * _lanes + lane]
+    std::vector<int32_t> _memory;
+    std::vector<uint8_t> _uniformWord;
+
+    std::vector<int32_t> A;
+    std::vector<int32_t> B;
+    std::vector<int32_t> PC;
+    std::vector<uint8_t> _lastAc; // 0 - A, 1 - B, 2 - no accumulator used yet
+    std::vector<int32_t> _operand;
+
+    std::vector<uint8_t> _active;
+    std::vector<uint8_t> _mask;
+    size_t _activeCount = 0;
+    bool _dense = false; // every lane is active and in the current group
+    bool _converged = false; // every active lane has the same PC
+
+    VM::Limits _limits;
+    size_t _outputLimit = std::numeric_limits<size_t>::max();
+    uint64_t _steps = 0; // groups executed, an upper bound of every lane's count
+    uint64_t _denseSteps = 0; // executed by every lane
+    std::vector<uint64_t> _executed; // per lane, apart from _denseSteps
+
+    std::vector<BatchResult> _results;
+};
+
+
+#endif //AGHSM_LOCKSTEPVM_H
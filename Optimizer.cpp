@@ -0,0 +1,337 @@
+/// Copyright (c) 2015 Jakub Trzebiatowski
+///
+/// Licensed under the Apache License, Version 2.0 (the "License");
+/// you may not use this file except in compliance with the License.
+/// You may obtain a copy of the License at
+///
+///     http://www.apache.org/licenses/LICENSE-2.0
+///
+/// Unless required by applicable law or agreed to in writing, software
+/// distributed under the License is distributed on an "AS IS" BASIS,
+/// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+/// See the License for the specific language governing permissions and
+/// limitations under the License.
+
+
+#include "Optimizer.h"
+#include "Language.h"
+
+#include <limits>
+
+Optimizer::Optimizer(std::vector<Word> program, std::unordered_map<std::string, int> labels,
+                     std::vector<int> lineNumbers, const std::vector<int> &dataReferences)
+        : _words(std::move(program)), _labels(std::move(labels)), _lineNumbers(std::move(lineNumbers)) {
+    _optimizable = isOptimizable(dataReferences);
+}
+
+std::vector<Word> Optimizer::optimize() {
+    if(_optimizable) {
+        threadJumps();
+        foldConstants();
+        _kept.assign(_words.size(), true);
+        removeUnreachable();
+        removeNulls();
+        removeJumpsToNext();
+        removeRedundantLoads();
+        compact();
+        _optimizable = false;
+    }
+    return _words;
+}
+
+const std::unordered_map<std::string, int> &Optimizer::labels() const {
+    return _labels;
+}
+
+const std::vector<int> &Optimizer::lineNumbers() const {
+    return _lineNumbers;
+}
+
+// The entry point is followed by the data, then the code. Every address the
+// code uses has to be known and inside the program: code is only reached by
+// mod 0 jumps, and data is read and written at addresses which are either in
+// the instructions or in pointers, .WORDs holding the address of data which
+// are never written. The code can then move without anything noticing but
+// the jumps.
+
+bool Optimizer::isOptimizable(const std::vector<int> &dataReferences) {
+    const int32_t size = _words.size();
+    if(size < 2 || _lineNumbers.size() != _words.size()) {
+        return false;
+    }
+    int32_t entry = _words[0].data;
+    if(entry % 4 || entry < 4 || entry / 4 >= size) {
+        return false;
+    }
+    _codeStart = entry / 4;
+
+    const int32_t codeStart = _codeStart * 4;
+    auto isData = [&](int32_t address) {
+        return address >= 4 && address < codeStart && !(address % 4);
+    };
+
+    _written.assign(_codeStart, false);
+    std::vector<size_t> pointers; // of mod 1 stores and mod 2
+    for(size_t i = _codeStart; i < _words.size(); ++i) {
+        Instruction inst = _words[i].instruction;
+        if(inst.code >= numInstructions || inst.mod == 3) {
+            return false;
+        }
+        InstructionEffect effect = isa[inst.code].effect;
+        if(effect == DumpEffect) {
+            return false;
+        }
+        if(effect == BranchEffect) {
+            if(inst.mod != 0 || inst.adr % 4 || inst.adr < codeStart || inst.adr > size * 4) {
+                return false;
+            }
+        } else if(effect == StoreEffect && inst.mod == 2) {
+            return false;
+        } else if(inst.mod != 0 || effect == StoreEffect) {
+            if(!isData(inst.adr)) {
+                return false;
+            }
+            if(inst.mod == 0) {
+                _written[inst.adr / 4] = true;
+            } else if(inst.mod == 2 || effect == StoreEffect) {
+                pointers.push_back(inst.adr / 4);
+            }
+        }
+    }
+
+    for(size_t pointer : pointers) {
+        if(_written[pointer] || !isData(_words[pointer].data)) {
+            return false;
+        }
+    }
+    for(size_t i = _codeStart; i < _words.size(); ++i) {
+        Instruction inst = _words[i].instruction;
+        if(inst.mod == 1 && isa[inst.code].effect == StoreEffect) {
+            _written[_words[inst.adr / 4].data / 4] = true;
+        }
+    }
+    for(size_t pointer : pointers) {
+        if(_written[pointer]) {
+            return false;
+        }
+    }
+
+    for(int index : dataReferences) {
+        if(_words[index].data >= codeStart) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool Optimizer::isUnconditionalJump(size_t index) const {
+    return index < _words.size() && _words[index].instruction.code == JumpInstruction;
+}
+
+// Index of the word a jump at `index` goes to, the size of the program for
+// the end of it
+
+size_t Optimizer::target(size_t index) const {
+    return static_cast<size_t>(_words[index].instruction.adr) / 4;
+}
+
+// Jumps on the way to a target are followed once, and every one of them
+// goes straight to the end of the chain afterwards. A chain ending in a loop
+// of jumps ends anywhere in the loop.
+
+void Optimizer::threadJumps() {
+    enum { Unvisited, OnPath, Threaded };
+    std::vector<uint8_t> state(_words.size(), Unvisited);
+    std::vector<size_t> path;
+
+    for(size_t i = _codeStart; i < _words.size(); ++i) {
+        if(isa[_words[i].instruction.code].effect != BranchEffect) {
+            continue;
+        }
+
+        path.clear();
+        size_t end = target(i);
+        while(isUnconditionalJump(end) && state[end] == Unvisited) {
+            state[end] = OnPath;
+            path.push_back(end);
+            end = target(end);
+        }
+        if(isUnconditionalJump(end) && state[end] == Threaded) {
+            end = target(end);
+        }
+
+        for(size_t jump : path) {
+            _words[jump].instruction.adr = end * 4;
+            state[jump] = Threaded;
+        }
+        _words[i].instruction.adr = end * 4;
+    }
+}
+
+// Reading a word which is never written reads its value, and following a
+// pointer reads the word it points at
+
+void Optimizer::foldConstants() {
+    auto fits = [](int32_t value) {
+        return value >= std::numeric_limits<int16_t>::min() && value <= std::numeric_limits<int16_t>::max();
+    };
+
+    for(size_t i = _codeStart; i < _words.size(); ++i) {
+        Instruction &inst = _words[i].instruction;
+        if(inst.mod == 2 || (inst.mod == 1 && isa[inst.code].effect == StoreEffect)) {
+            int32_t address = _words[inst.adr / 4].data;
+            if(fits(address)) {
+                --inst.mod;
+                inst.adr = address;
+            }
+        }
+        if(inst.mod == 1 && isa[inst.code].effect != StoreEffect && !_written[inst.adr / 4]) {
+            int32_t value = _words[inst.adr / 4].data;
+            if(fits(value)) {
+                inst.mod = 0;
+                inst.adr = value;
+            }
+        }
+    }
+}
+
+void Optimizer::removeUnreachable() {
+    std::vector<bool> reached(_words.size(), false);
+    std::vector<size_t> pending{_codeStart};
+    reached[_codeStart] = true;
+
+    auto reach = [&](size_t index) {
+        if(index < _words.size() && !reached[index]) {
+            reached[index] = true;
+            pending.push_back(index);
+        }
+    };
+
+    while(!pending.empty()) {
+        size_t i = pending.back();
+        pending.pop_back();
+        InstructionEffect effect = isa[_words[i].instruction.code].effect;
+        if(effect == BranchEffect) {
+            reach(target(i));
+        }
+        if(effect != HaltEffect && !isUnconditionalJump(i)) {
+            reach(i + 1);
+        }
+    }
+
+    for(size_t i = _codeStart; i < _words.size(); ++i) {
+        _kept[i] = reached[i];
+    }
+}
+
+// Reading data for null cannot fail, every address was checked
+
+void Optimizer::removeNulls() {
+    for(size_t i = _codeStart; i < _words.size(); ++i) {
+        if(_words[i].instruction.code == NullInstruction) {
+            _kept[i] = false;
+        }
+    }
+}
+
+// Jumps forward to the next instruction left do nothing, taken or not, and
+// whatever follows them has already been decided when they are looked at. A
+// jump backward at least reaches itself.
+
+void Optimizer::removeJumpsToNext() {
+    std::vector<size_t> next(_words.size() + 1);
+    next[_words.size()] = _words.size();
+    for(size_t i = _words.size(); i-- > _codeStart;) {
+        if(_kept[i] && isa[_words[i].instruction.code].effect == BranchEffect &&
+           target(i) > i && next[target(i)] == next[i + 1]) {
+            _kept[i] = false;
+        }
+        next[i] = _kept[i] ? i : next[i + 1];
+    }
+}
+
+// The load reads back what the store has just written from the same
+// accumulator, unless a jump gets to it from somewhere else. Only a mod 0
+// store writes the word the load reads; a store through a pointer writes
+// wherever the pointer points.
+
+void Optimizer::removeRedundantLoads() {
+    std::vector<size_t> next = nextKept();
+    std::vector<bool> targeted(_words.size() + 1, false);
+    targeted[next[_codeStart]] = true;
+    for(size_t i = _codeStart; i < _words.size(); ++i) {
+        if(_kept[i] && isa[_words[i].instruction.code].effect == BranchEffect) {
+            targeted[next[target(i)]] = true;
+        }
+    }
+
+    for(size_t i = _codeStart; i < _words.size(); ++i) {
+        Instruction store = _words[i].instruction;
+        if(!_kept[i] || store.code != StoreInstruction) {
+            continue;
+        }
+        size_t j = next[i + 1];
+        if(j == _words.size() || targeted[j]) {
+            continue;
+        }
+        Instruction load = _words[j].instruction;
+        if(load.code == LoadInstruction && load.mod == 1 && store.mod == 0 && load.acu == store.acu &&
+           load.adr == store.adr) {
+            _kept[j] = false;
+        }
+    }
+}
+
+// Index of the first word kept at or after every index, up to the size of
+// the program
+
+std::vector<size_t> Optimizer::nextKept() const {
+    std::vector<size_t> next(_words.size() + 1);
+    next[_words.size()] = _words.size();
+    for(size_t i = _words.size(); i-- > 0;) {
+        next[i] = _kept[i] ? i : next[i + 1];
+    }
+    return next;
+}
+
+// Removed words give way to the words after them, so labels and jumps which
+// pointed at them point at the next word left
+
+void Optimizer::compact() {
+    std::vector<size_t> next = nextKept();
+    std::vector<size_t> moved(_words.size() + 1);
+    size_t size = 0;
+    for(size_t i = 0; i < _words.size(); ++i) {
+        if(_kept[i]) {
+            moved[i] = size++;
+        }
+    }
+    moved[_words.size()] = size;
+    auto newIndex = [&](size_t index) {
+        return moved[next[index]];
+    };
+
+    std::vector<Word> words;
+    std::vector<int> lineNumbers;
+    words.reserve(size);
+    lineNumbers.reserve(size);
+    for(size_t i = 0; i < _words.size(); ++i) {
+        if(!_kept[i]) {
+            continue;
+        }
+        Word word = _words[i];
+        if(i >= _codeStart && isa[word.instruction.code].effect == BranchEffect) {
+            word.instruction.adr = newIndex(target(i)) * 4;
+        }
+        words.push_back(word);
+        lineNumbers.push_back(_lineNumbers[i]);
+    }
+    words[0].data = newIndex(_codeStart) * 4;
+
+    for(auto &label : _labels) {
+        label.second = newIndex(label.second);
+    }
+
+    _words = std::move(words);
+    _lineNumbers = std::move(lineNumbers);
+}
@@ -0,0 +1,84 @@
+/// Copyright (c) 2015 Jakub Trzebiatowski
+///
+/// Licensed under the Apache License, Version 2.0 (the "License");
+/// you may not use this file except in compliance with the License.
+/// You may obtain a copy of the License at
+///
+///     http://www.apache.org/licenses/LICENSE-2.0
+///
+/// Unless required by applicable law or agreed to in writing, software
+/// distributed under the License is distributed on an "AS IS" BASIS,
+/// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+/// See the License for the specific language governing permissions and
+/// limitations under the License.
+
+
+#ifndef AGHSM_OPTIMIZER_H
+#define AGHSM_OPTIMIZER_H
+
+#include "CodeEmitter.h"
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/// Rewrites an assembled program so that it executes fewer instructions:
+/// jumps to jumps go straight to the final target, unreachable code, `null`
+/// and jumps to the next instruction are removed, a `load` right after a
+/// `store` of the same accumulator to the same word is removed, and `.WORD`s
+/// which are never written are folded into the instructions reading them,
+/// or following them as pointers.
+///
+/// Programs whose behaviour could depend on where their words are or on what
+/// their code looks like are left as they are: programs which jump to
+/// computed addresses, read or write data through pointers which change,
+/// modify or read their code, address words outside of the program, keep
+/// addresses of code in data, or dump their memory.
+class Optimizer {
+public:
+    /// `dataReferences` are the words holding the address of a label.
+    Optimizer(std::vector<Word> program, std::unordered_map<std::string, int> labels,
+              std::vector<int> lineNumbers, const std::vector<int> &dataReferences);
+
+    std::vector<Word> optimize();
+
+    /// Word index of every label in the optimized program.
+    const std::unordered_map<std::string, int> &labels() const;
+
+    /// Source line of every word of the optimized program.
+    const std::vector<int> &lineNumbers() const;
+
+private:
+    bool isOptimizable(const std::vector<int> &dataReferences);
+
+    bool isUnconditionalJump(size_t index) const;
+
+    size_t target(size_t index) const;
+
+    void threadJumps();
+
+    void foldConstants();
+
+    void removeUnreachable();
+
+    void removeNulls();
+
+    void removeJumpsToNext();
+
+    void removeRedundantLoads();
+
+    std::vector<size_t> nextKept() const;
+
+    void compact();
+
+    std::vector<Word> _words;
+    std::unordered_map<std::string, int> _labels;
+    std::vector<int> _lineNumbers;
+    bool _optimizable;
+    size_t _codeStart = 0; // index of the first instruction, after the data
+    std::vector<bool> _written; // by data word
+    std::vector<bool> _kept;
+};
+
+
+#endif //AGHSM_OPTIMIZER_H
@@ -0,0 +1,173 @@
+/// Copyright (c) 2015 Jakub Trzebiatowski
+///
+/// Licensed under the Apache License, Version 2.0 (the "License");
+/// you may not use this file except in compliance with the License.
+/// You may obtain a copy of the License at
+///
+///     http://www.apache.org/licenses/LICENSE-2.0
+///
+/// Unless required by applicable law or agreed to in writing, software
+/// distributed under the License is distributed on an "AS IS" BASIS,
+/// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+/// See the License for the specific language governing permissions and
+/// limitations under the License.
+
+#include "OutputSink.h"
+
+#include <unistd.h>
+
+OutputSink::~OutputSink() {
+
+}
+
+void OutputSink::writeLine(int32_t value) {
+    char text[12];
+    char *end = text + sizeof(text);
+    char *begin = end;
+
+    *--begin = '\n';
+
+    // Negated as unsigned, so INT32_MIN does not overflow
+    uint32_t magnitude = value < 0 ? 0u - static_cast<uint32_t>(value) : value;
+    do {
+        *--begin = static_cast<char>('0' + magnitude % 10);
+        magnitude /= 10;
+    } while(magnitude);
+
+    if(value < 0) {
+        *--begin = '-';
+    }
+
+    write(begin, end - begin);
+}
+
+void OutputSink::flush() {
+    drain();
+    sync();
+}
+
+void OutputSink::sync() {
+
+}
+
+std::chrono::milliseconds OutputSink::maxDelay() const {
+    return std::chrono::milliseconds::zero();
+}
+
+void OutputSink::setLineBuffered(bool lineBuffered) {
+    _lineBuffered = lineBuffered;
+}
+
+void OutputSink::drain() {
+    if(_size) {
+        consume(_buffer, _size);
+        _size = 0;
+    }
+}
+
+StringSink::StringSink(size_t limit) : _limit(limit) {}
+
+StringSink::~StringSink() {
+    flush();
+}
+
+const std::string &StringSink::str() {
+    flush();
+    return _text;
+}
+
+bool StringSink::truncated() const {
+    return _truncated;
+}
+
+void StringSink::consume(const char *data, size_t size) {
+    size_t room = _limit - _text.size();
+    if(size > room) {
+        size = room;
+        _truncated = true;
+    }
+    _text.append(data, size);
+}
+
+StreamSink::StreamSink(std::ostream &os) : _os(os) {}
+
+StreamSink::~StreamSink() {
+    flush();
+}
+
+void StreamSink::consume(const char *data, size_t size) {
+    _os.write(data, size);
+}
+
+void StreamSink::sync() {
+    _os.flush();
+}
+
+AsyncFileSink::AsyncFileSink(std::FILE *file, size_t bufferSize)
+        : _file(file), _capacity(bufferSize) {
+    setLineBuffered(isatty(fileno(file)));
+    _front.reserve(_capacity);
+    _back.reserve(_capacity);
+    _flusher = std::thread(&AsyncFileSink::flusherLoop, this);
+}
+
+AsyncFileSink::~AsyncFileSink() {
+    flush();
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = true;
+    }
+    _backFilled.notify_one();
+    _flusher.join();
+}
+
+std::chrono::milliseconds AsyncFileSink::maxDelay() const {
+    return std::chrono::milliseconds(100);
+}
+
+void AsyncFileSink::consume(const char *data, size_t size) {
+    _front.append(data, size);
+    if(_front.size() >= _capacity) {
+        handOff();
+    }
+}
+
+void AsyncFileSink::sync() {
+    if(!_front.empty()) {
+        handOff();
+    }
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    _backWritten.wait(lock, [this] { return !_backFull; });
+    std::fflush(_file);
+}
+
+// Swaps the buffers once the flusher thread is done with the previous one.
+
+void AsyncFileSink::handOff() {
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _backWritten.wait(lock, [this] { return !_backFull; });
+        _front.swap(_back);
+        _backFull = true;
+    }
+    _backFilled.notify_one();
+}
+
+void AsyncFileSink::flusherLoop() {
+    std::unique_lock<std::mutex> lock(_mutex);
+    for(;;) {
+        _backFilled.wait(lock, [this] { return _backFull || _stopping; });
+        if(!_backFull) {
+            return;
+        }
+
+        lock.unlock();
+        std::fwrite(_back.data(), 1, _back.size(), _file);
+        _back.clear();
+        lock.lock();
+
+        _backFull = false;
+        _backWritten.notify_all();
+    }
+}
@@ -0,0 +1,169 @@
+/// Copyright (c) 2015 Jakub Trzebiatowski
+///
+/// Licensed under the Apache License, Version 2.0 (the "License");
+/// you may not use this file except in compliance with the License.
+/// You may obtain a copy of the License at
+///
+///     http://www.apache.org/licenses/LICENSE-2.0
+///
+/// Unless required by applicable law or agreed to in writing, software
+/// distributed under the License is distributed on an "AS IS" BASIS,
+/// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+/// See the License for the specific language governing permissions and
+/// limitations under the License.
+
+#ifndef AGHSM_OUTPUTSINK_H
+#define AGHSM_OUTPUTSINK_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+
+/// Destination of the output of print and dump.
+///
+/// Writes are collected in a small buffer and handed to consume() in large
+/// pieces, so a program printing in a loop costs one virtual call per few
+/// kilobytes. Nothing reaches the destination before flush(), unless the sink
+/// is line buffered; the VM flushes its sink when the program halts or
+/// fails. Classes deriving from OutputSink have to call flush() in their
+/// destructors.
+class OutputSink {
+public:
+    OutputSink() = default;
+
+    OutputSink(const OutputSink &) = delete;
+
+    OutputSink &operator=(const OutputSink &) = delete;
+
+    virtual ~OutputSink();
+
+    void write(const char *data, size_t size) {
+        if(size > bufferSize - _size) {
+            drain();
+        }
+        if(size >= bufferSize) {
+            consume(data, size);
+        } else {
+            std::memcpy(_buffer + _size, data, size);
+            _size += size;
+        }
+        if(_lineBuffered) {
+            flush();
+        }
+    }
+
+    void write(const std::string &text) {
+        write(text.data(), text.size());
+    }
+
+    /// Writes the value in decimal followed by a newline.
+    void writeLine(int32_t value);
+
+    /// Passes everything written so far to the destination.
+    void flush();
+
+    /// How long output may wait in the sink while the program keeps running;
+    /// the VM flushes the sink at least that often. Zero if it may wait until
+    /// the program halts.
+    virtual std::chrono::milliseconds maxDelay() const;
+
+protected:
+    virtual void consume(const char *data, size_t size) = 0;
+
+    virtual void sync();
+
+    /// Flushes after every write, i.e. after every printed line.
+    void setLineBuffered(bool lineBuffered);
+
+private:
+    static const size_t bufferSize = 4096;
+
+    void drain();
+
+    char _buffer[bufferSize];
+    size_t _size = 0;
+    bool _lineBuffered = false;
+};
+
+/// Captures output in memory, dropping everything past `limit` bytes, so
+/// a runaway program cannot exhaust memory.
+class StringSink : public OutputSink {
+public:
+    explicit StringSink(size_t limit = std::numeric_limits<size_t>::max());
+
+    ~StringSink();
+
+    const std::string &str();
+
+    /// True if some output was dropped.
+    bool truncated() const;
+
+protected:
+    void consume(const char *data, size_t size) override;
+
+private:
+    std::string _text;
+    size_t _limit;
+    bool _truncated = false;
+};
+
+/// Forwards output to a std::ostream.
+class StreamSink : public OutputSink {
+public:
+    explicit StreamSink(std::ostream &os);
+
+    ~StreamSink();
+
+protected:
+    void consume(const char *data, size_t size) override;
+
+    void sync() override;
+
+private:
+    std::ostream &_os;
+};
+
+/// Writes output to a file from a background thread. Output is collected in
+/// one large buffer while the other one is being written, so the VM only
+/// waits if it produces output faster than the file accepts it. Output of a
+/// long run is flushed every 100 ms while it is being produced, and terminals
+/// get every line as soon as it is printed.
+class AsyncFileSink : public OutputSink {
+public:
+    explicit AsyncFileSink(std::FILE *file, size_t bufferSize = 1 << 20);
+
+    ~AsyncFileSink();
+
+    std::chrono::milliseconds maxDelay() const override;
+
+protected:
+    void consume(const char *data, size_t size) override;
+
+    void sync() override;
+
+private:
+    void handOff();
+
+    void flusherLoop();
+
+    std::FILE *_file;
+    size_t _capacity;
+    std::string _front; // filled by the VM
+    std::string _back; // written by the flusher thread
+    bool _backFull = false;
+    bool _stopping = false;
+    std::mutex _mutex;
+    std::condition_variable _backFilled;
+    std::condition_variable _backWritten;
+    std::thread _flusher;
+};
+
+
+#endif //AGHSM_OUTPUTSINK_H
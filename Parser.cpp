@@ -12,26 +12,29 @@
 /// See the License for the specific language governing permissions and
 /// limitations under the License.
 
-#include "Language.h"
 #include "Parser.h"
 
 #include <string>
 
 static std::string indent = "    ";
 
-void AstNode::print(std::ostream &os, std::string prefix) {
-    os << prefix << this->sValue  << std::endl;
-    for(auto &child : this->children) {
-        child.print(os, prefix + indent);
-    }
+void Ast::clear() {
+    statements.clear();
+    nodes.clear();
 }
 
-Ast::Ast() : rootNode{AstNode::RootNode} {
-    rootNode.sValue = "<ast>";
+void Ast::print(std::ostream &os) const {
+    os << "<ast>" << std::endl;
+    for(const AstNode &statement : statements) {
+        printNode(os, statement, indent);
+    }
 }
 
-void Ast::print(std::ostream &os) {
-    this->rootNode.print(os, "");
+void Ast::printNode(std::ostream &os, const AstNode &node, const std::string &prefix) const {
+    os << prefix << node.sValue << std::endl;
+    for(const AstNode &child : children(node)) {
+        printNode(os, child, prefix + indent);
+    }
 }
 
 template<typename T, typename ...Args>
@@ -40,39 +43,62 @@ std::unique_ptr<T> make_unique( Args&& ...args )
     return std::unique_ptr<T>( new T( std::forward<Args>(args)... ) );
 }
 
-void Parser::parserError(std::string errorMessage, Token token) {
+void Parser::parserError(std::string errorMessage, const Token &token) {
     std::stringstream ss;
     ss << ":" << token.lineNumber << ":" << token.columnNumber << ": Parser error: " << errorMessage;
     throw ParserError{ ss.str() };
 }
 
 Token Parser::readToken() {
-    Token token = _tokenStream.getTokenAt(_currentTokenNo);
-    ++_currentTokenNo;
+    Token token = peekToken();
+    _peeked = false;
     return token;
 }
 
 Ast Parser::parse() {
     while(peekToken().type != Token::NullToken) {
-        parseLine();
+        parseLineInto(_ast);
     }
 
     return std::move(_ast);
 }
 
-Token Parser::peekToken() {
-    if(_currentTokenNo < _tokenStream.size()) {
-        Token token = _tokenStream.getTokenAt(_currentTokenNo);
-        return token;
-    } else {
-        return Token{};
+bool Parser::parseLine(Ast &line) {
+    line.clear();
+    if(peekToken().type == Token::NullToken) {
+        return false;
+    }
+    if(line.source != _ast.source) {
+        line.source = _ast.source;
+        line.symbols = _ast.symbols;
+    }
+    parseLineInto(line);
+    return true;
+}
+
+// NullToken past the last token
+
+const Token &Parser::peekToken() {
+    if(!_peeked) {
+        if(_lexer) {
+            _nextToken = _lexer->next();
+        } else if(_currentTokenNo < _tokenStream->size()) {
+            _nextToken = _tokenStream->getTokenAt(_currentTokenNo++);
+        } else {
+            _nextToken = Token{Token::NullToken};
+        }
+        _peeked = true;
     }
+    return _nextToken;
 }
 
-AstNode Parser::parseExpression() {
+// Children of the returned node are already in `ast`, the node itself is not
+
+AstNode Parser::parseExpression(Ast &ast) {
     Token firstToken = readToken();
     if(firstToken.type == Token::IdentifierToken) {
         auto referenceNode = AstNode{AstNode::ReferenceNode};
+        referenceNode.aValue = firstToken.symbol;
         referenceNode.sValue = firstToken.tokenData;
 
         return referenceNode;
@@ -86,14 +112,15 @@ AstNode Parser::parseExpression() {
             }
 
             auto multinumberNode = AstNode{AstNode::MultinumberNode};
-            multinumberNode.aValue = std::stoi(firstToken.tokenData);
-            multinumberNode.bValue = std::stoi(secondToken.tokenData);
-            multinumberNode.sValue = firstToken.tokenData + "#" + secondToken.tokenData;
+            multinumberNode.aValue = std::stoi(firstToken.tokenData.str());
+            multinumberNode.bValue = std::stoi(secondToken.tokenData.str());
+            multinumberNode.sValue = StringRef(firstToken.tokenData.data,
+                                              secondToken.tokenData.data + secondToken.tokenData.size - firstToken.tokenData.data);
 
             return multinumberNode;
         } else {
             auto numberNode = AstNode{AstNode::NumberNode};
-            numberNode.aValue = std::stoi(firstToken.tokenData);
+            numberNode.aValue = std::stoi(firstToken.tokenData.str());
             numberNode.sValue = firstToken.tokenData;
 
             return numberNode;
@@ -105,9 +132,11 @@ AstNode Parser::parseExpression() {
         return registerNode;
     } else if(firstToken.type == Token::DelimiterToken && firstToken.tokenData == "(") {
         auto parenNode = AstNode{AstNode::ParenNode};
-        parenNode.sValue = "()";
-        auto innerNode = parseExpression();
-        parenNode.children.push_back(innerNode);
+        parenNode.sValue = StringRef("()", 2);
+        auto innerNode = parseExpression(ast);
+        parenNode.firstChild = ast.nodes.size();
+        parenNode.childCount = 1;
+        ast.nodes.push_back(innerNode);
 
         Token nextToken = readToken();
         if(nextToken.type != Token::DelimiterToken || nextToken.tokenData != ")") {
@@ -120,7 +149,7 @@ AstNode Parser::parseExpression() {
     return AstNode{}; // unreachable
 }
 
-void Parser::parseLine() {
+void Parser::parseLineInto(Ast &ast) {
     Token labelToken = peekToken();
 
     // Parse label (optional)
@@ -134,8 +163,10 @@ void Parser::parseLine() {
         }
 
         auto labelNode = AstNode{AstNode::LabelNode};
+        labelNode.lineNumber = labelToken.lineNumber;
+        labelNode.aValue = labelToken.symbol;
         labelNode.sValue = labelToken.tokenData;
-        _ast.rootNode.children.push_back(std::move(labelNode));
+        ast.statements.push_back(labelNode);
     }
 
     // Parse keyword
@@ -152,30 +183,35 @@ void Parser::parseLine() {
     }
 
     AstNode instructionNode;
-    if(_directives.find(keywordToken.tokenData) != _directives.end()) {
+    if(keywordToken.keyword.kind == Keyword::DirectiveKeyword) {
         instructionNode.type = AstNode::DirectiveNode;
-    } else if(_instructions.find(keywordToken.tokenData) != _instructions.end()) {
+    } else if(keywordToken.keyword.kind == Keyword::InstructionKeyword) {
         instructionNode.type = AstNode::InstructionNode;
     } else {
         parserError("unrecognized keyword", keywordToken);
     }
 
+    instructionNode.lineNumber = keywordToken.lineNumber;
+    instructionNode.aValue = keywordToken.keyword.code;
     instructionNode.sValue = keywordToken.tokenData;
 
-    // Parse args
+    // Parse args, then keep them next to each other
 
     Token nextToken = peekToken();
 
+    _arguments.clear();
     while(nextToken.type == Token::DelimiterToken && nextToken.tokenData == ",") {
         readToken();
         if(peekToken().type != Token::LineTerminatorToken) {
-            AstNode expressionNode = parseExpression();
-            instructionNode.children.push_back(expressionNode);
+            _arguments.push_back(parseExpression(ast));
         }
         nextToken = peekToken();
     }
 
-    _ast.rootNode.children.push_back(instructionNode);
+    instructionNode.firstChild = ast.nodes.size();
+    instructionNode.childCount = _arguments.size();
+    ast.nodes.insert(ast.nodes.end(), _arguments.begin(), _arguments.end());
+    ast.statements.push_back(instructionNode);
 
     nextToken = readToken();
     if(nextToken.type != Token::LineTerminatorToken) {
@@ -184,11 +220,12 @@ void Parser::parseLine() {
 
 }
 
-Parser::Parser(const TokenStream &tokenStream) : _tokenStream{tokenStream} {
-    for(auto directive : directives) {
-        _directives.insert(directive);
-    }
-    for(auto instruction : instructions) {
-        _instructions.insert(instruction);
-    }
+Parser::Parser(const TokenStream &tokenStream) : _tokenStream(&tokenStream) {
+    _ast.source = tokenStream.source();
+    _ast.symbols = tokenStream.symbols();
+}
+
+Parser::Parser(Lexer &lexer) : _lexer(&lexer) {
+    _ast.source = lexer.source();
+    _ast.symbols = lexer.symbols();
 }
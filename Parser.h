@@ -36,21 +36,62 @@ struct AstNode {
 
     AstNode(Type type = NullNode) : type(type) {}
 
-    void print(std::ostream &os, std::string prefix);
-
     Type type;
-    int64_t aValue = 0;
+    int lineNumber = 0;
+    int64_t aValue = 0; // a number, or the symbol of a label or reference, or the code of a keyword
     int64_t bValue = 0;
-    std::string sValue;
-    std::vector<AstNode> children;
+    StringRef sValue; // points into the source or is a literal
+    uint32_t firstChild = 0; // index in Ast::nodes
+    uint32_t childCount = 0;
+};
+
+/// Consecutive nodes, the children of one node.
+struct AstNodeRange {
+    const AstNode *first;
+    const AstNode *last;
+
+    const AstNode *begin() const {
+        return first;
+    }
+
+    const AstNode *end() const {
+        return last;
+    }
+
+    size_t size() const {
+        return last - first;
+    }
+
+    const AstNode &front() const {
+        return *first;
+    }
+
+    const AstNode &back() const {
+        return last[-1];
+    }
 };
 
+/// Nodes do not own their children. Top-level nodes (labels, instructions and
+/// directives) are kept in order in `statements`, and all the other nodes in
+/// `nodes`, where the children of every node are next to each other.
 struct Ast {
-    AstNode rootNode;
+    std::vector<AstNode> statements;
+    std::vector<AstNode> nodes;
+    std::shared_ptr<const SourceBuffer> source; // keeps sValue valid
+    std::shared_ptr<const SymbolTable> symbols;
+
+    AstNodeRange children(const AstNode &node) const {
+        const AstNode *first = nodes.data() + node.firstChild;
+        return {first, first + node.childCount};
+    }
 
-    Ast();
+    /// Keeps the memory for the next use.
+    void clear();
 
-    void print(std::ostream &os);
+    void print(std::ostream &os) const;
+
+private:
+    void printNode(std::ostream &os, const AstNode &node, const std::string &prefix) const;
 };
 
 class Parser {
@@ -64,25 +105,34 @@ public:
 
     Parser(const TokenStream &tokenStream);
 
+    /// Reads tokens from `lexer` as they are needed.
+    Parser(Lexer &lexer);
+
     Ast parse();
 
+    /// Replaces the contents of `line` with the next line: a label, an
+    /// instruction or directive, or both. Returns false at the end of the
+    /// tokens.
+    bool parseLine(Ast &line);
+
 private:
 
-    void parserError(std::string errorMessage, Token token);
+    void parserError(std::string errorMessage, const Token &token);
 
     Token readToken();
 
-    Token peekToken();
-
-    AstNode parseExpression();
+    const Token &peekToken();
 
-    void parseLine();
+    AstNode parseExpression(Ast &ast);
 
-    std::unordered_set<std::string> _directives;
-    std::unordered_set<std::string> _instructions;
+    void parseLineInto(Ast &ast);
 
-    int _currentTokenNo = 0;
-    TokenStream _tokenStream;
+    size_t _currentTokenNo = 0;
+    const TokenStream *_tokenStream = nullptr; // has to outlive the parser
+    Lexer *_lexer = nullptr; // or this one
+    Token _nextToken;
+    bool _peeked = false;
+    std::vector<AstNode> _arguments; // of the line being parsed
     Ast _ast;
 };
 
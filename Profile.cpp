@@ -0,0 +1,164 @@
+/// Copyright (c) 2015 Jakub Trzebiatowski
+///
+/// Licensed under the Apache License, Version 2.0 (the "License");
+/// you may not use this file except in compliance with the License.
+/// You may obtain a copy of the License at
+///
+///     http://www.apache.org/licenses/LICENSE-2.0
+///
+/// Unless required by applicable law or agreed to in writing, software
+/// distributed under the License is distributed on an "AS IS" BASIS,
+/// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+/// See the License for the specific language governing permissions and
+/// limitations under the License.
+
+#include "Profile.h"
+#include "Language.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <map>
+#include <sstream>
+
+// Loops taking at least this share of all executed instructions are hot
+static const double hotLoopShare = 0.1;
+
+static bool isJump(Instruction instruction) {
+    return instruction.code < numInstructions && isa[instruction.code].effect == BranchEffect;
+}
+
+void Profile::reset(size_t words) {
+    instructions = 0;
+    executions.assign(words, 0);
+    taken.assign(words, 0);
+    reads.assign(words, 0);
+    writes.assign(words, 0);
+    opcodeExecutions.assign(numInstructions, 0);
+}
+
+namespace {
+
+// Words between a jump target and a jump back to it
+struct Loop {
+    size_t first;
+    size_t last;
+    uint64_t iterations;
+    uint64_t executed;
+};
+
+}
+
+static std::string percentage(uint64_t count, uint64_t total) {
+    std::ostringstream ss;
+    ss << std::fixed << std::setprecision(1) << (total ? 100.0 * count / total : 0.0) << "%";
+    return ss.str();
+}
+
+void printProfile(std::ostream &os, const Profile &profile, const std::vector<Word> &program,
+                  const std::vector<int> &lineNumbers,
+                  const std::unordered_map<std::string, int> &labels) {
+    const size_t words = std::min(program.size(), profile.executions.size());
+
+    // Ordered by name, so the listing does not depend on hash order
+    std::map<std::string, int> sortedLabels(labels.begin(), labels.end());
+    std::vector<std::string> names(words);
+    for(const auto &label : sortedLabels) {
+        if(label.second >= 0 && static_cast<size_t>(label.second) < words) {
+            std::string &name = names[label.second];
+            name += (name.empty() ? "" : " ") + label.first + ":";
+        }
+    }
+
+    std::vector<Loop> loops;
+    for(size_t i = 0; i < words; ++i) {
+        Instruction instruction = program[i].instruction;
+        if(!isJump(instruction) || instruction.mod != 0 || !profile.taken[i]) {
+            continue;
+        }
+        size_t target = static_cast<uint16_t>(instruction.adr) / 4;
+        if(instruction.adr < 0 || instruction.adr % 4 || target > i) {
+            continue;
+        }
+
+        Loop loop = {target, i, profile.taken[i], 0};
+        for(size_t j = loop.first; j <= loop.last; ++j) {
+            loop.executed += profile.executions[j];
+        }
+        if(loop.executed >= hotLoopShare * profile.instructions) {
+            loops.push_back(loop);
+        }
+    }
+    std::stable_sort(loops.begin(), loops.end(), [](const Loop &a, const Loop &b) {
+        return a.executed > b.executed;
+    });
+
+    std::vector<bool> hot(words);
+    for(const Loop &loop : loops) {
+        std::fill(hot.begin() + loop.first, hot.begin() + loop.last + 1, true);
+    }
+
+    os << "Profile: " << profile.instructions << " instructions" << std::endl;
+    os << std::endl;
+    size_t labelWidth = 8;
+    for(const std::string &name : names) {
+        labelWidth = std::max(labelWidth, name.size() + 1);
+    }
+
+    os << "  line  " << std::left << std::setw(labelWidth) << "label"
+       << std::right << std::setw(10) << "count" << std::setw(8) << "%"
+       << std::setw(14) << "taken/not" << std::setw(10) << "reads" << std::setw(10) << "writes"
+       << "  word" << std::endl;
+
+    for(size_t i = 0; i < words; ++i) {
+        std::string jumps;
+        if(isJump(program[i].instruction) && profile.executions[i]) {
+            jumps = std::to_string(profile.taken[i]) + "/" +
+                    std::to_string(profile.executions[i] - profile.taken[i]);
+        }
+
+        int lineNumber = i < lineNumbers.size() ? lineNumbers[i] : 0;
+
+        std::string word;
+        printWord(word, static_cast<int>(i * 4), program[i]);
+
+        os << (hot[i] ? '*' : ' ')
+           << std::right << std::setw(5) << (lineNumber ? std::to_string(lineNumber) : "") << "  "
+           << std::left << std::setw(labelWidth) << names[i]
+           << std::right << std::setw(10) << profile.executions[i]
+           << std::setw(8) << percentage(profile.executions[i], profile.instructions)
+           << std::setw(14) << jumps
+           << std::setw(10) << profile.reads[i]
+           << std::setw(10) << profile.writes[i] << "  "
+           << word;
+    }
+
+    os << std::endl << "Hot loops:" << std::endl;
+    if(loops.empty()) {
+        os << "  none" << std::endl;
+    }
+    for(const Loop &loop : loops) {
+        os << "  " << loop.first * 4 << "-" << loop.last * 4;
+        if(loop.last < lineNumbers.size() && lineNumbers[loop.first]) {
+            os << " (lines " << lineNumbers[loop.first] << "-" << lineNumbers[loop.last] << ")";
+        }
+        os << ": " << loop.iterations << " iterations, "
+           << percentage(loop.executed, profile.instructions) << " of instructions" << std::endl;
+    }
+
+    std::vector<int> opcodes;
+    for(int code = 0; code < static_cast<int>(profile.opcodeExecutions.size()); ++code) {
+        if(profile.opcodeExecutions[code]) {
+            opcodes.push_back(code);
+        }
+    }
+    std::stable_sort(opcodes.begin(), opcodes.end(), [&profile](int a, int b) {
+        return profile.opcodeExecutions[a] > profile.opcodeExecutions[b];
+    });
+
+    os << std::endl << "Opcodes:" << std::endl;
+    for(int code : opcodes) {
+        os << "  " << std::left << std::setw(8) << instructions[code]
+           << std::right << std::setw(10) << profile.opcodeExecutions[code]
+           << std::setw(8) << percentage(profile.opcodeExecutions[code], profile.instructions) << std::endl;
+    }
+}
@@ -0,0 +1,47 @@
+/// Copyright (c) 2015 Jakub Trzebiatowski
+///
+/// Licensed under the Apache License, Version 2.0 (the "License");
+/// you may not use this file except in compliance with the License.
+/// You may obtain a copy of the License at
+///
+///     http://www.apache.org/licenses/LICENSE-2.0
+///
+/// Unless required by applicable law or agreed to in writing, software
+/// distributed under the License is distributed on an "AS IS" BASIS,
+/// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+/// See the License for the specific language governing permissions and
+/// limitations under the License.
+
+#ifndef AGHSM_PROFILE_H
+#define AGHSM_PROFILE_H
+
+#include "CodeEmitter.h"
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/// Execution counts collected by a VM in profiling mode.
+struct Profile {
+    uint64_t instructions = 0;
+    std::vector<uint64_t> executions; // per word
+    std::vector<uint64_t> taken; // per word, jumps only
+    std::vector<uint64_t> reads; // per word, operand reads
+    std::vector<uint64_t> writes; // per word
+    std::vector<uint64_t> opcodeExecutions; // per opcode
+
+    /// Clears all counts for a program of `words` words.
+    void reset(size_t words);
+};
+
+/// Prints an annotated listing of `program`: every word with its source
+/// line, labels and counts, followed by the hot loops and a summary of
+/// executed opcodes. Words inside hot loops are marked with '*'.
+void printProfile(std::ostream &os, const Profile &profile, const std::vector<Word> &program,
+                  const std::vector<int> &lineNumbers,
+                  const std::unordered_map<std::string, int> &labels);
+
+
+#endif //AGHSM_PROFILE_H
@@ -0,0 +1,257 @@
+/// Copyright (c) 2015 Jakub Trzebiatowski
+///
+/// Licensed under the Apache License, Version 2.0 (the "License");
+/// you may not use this file except in compliance with the License.
+/// You may obtain a copy of the License at
+///
+///     http://www.apache.org/licenses/LICENSE-2.0
+///
+/// Unless required by applicable law or agreed to in writing, software
+/// distributed under the License is distributed on an "AS IS" BASIS,
+/// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+/// See the License for the specific language governing permissions and
+/// limitations under the License.
+
+#include "ProgramGenerator.h"
+
+#include <algorithm>
+#include <sstream>
+
+static const size_t maxPointers = 8;
+static const size_t maxPrints = 4;
+static const size_t flushSize = 1 << 20;
+
+// Chance of starting a loop at each statement, when nesting allows it
+static const double loopChance = 0.05;
+
+// Chance of an arithmetic instruction being a target of self-modifying stores
+static const double slotChance = 0.2;
+
+static const char *const arithmetic[] = {"add", "sub", "mult"};
+static const char *const conditionalJumps[] = {"jzero", "jnzero", "jpos", "jneg"};
+
+ProgramGenerator::ProgramGenerator(Options options)
+        : _options(options), _random(options.seed) {
+    _options.loopIterations = std::min(std::max(_options.loopIterations, 1u), 32767u);
+    _options.maxMultinumberSize = std::max<size_t>(_options.maxMultinumberSize, 1);
+}
+
+void ProgramGenerator::generate(std::ostream &os) {
+    _random.seed(_options.seed);
+    _os = &os;
+    _text.clear();
+    _dataLabels.clear();
+    _pointers.clear();
+    _slots.clear();
+    _instructions = 0;
+    _labelsLeft = _options.labels;
+    _nextLabel = 0;
+    _words = 1; // the entry point
+
+    line(".UNIT");
+    emitData();
+    line(".CODE");
+
+    emitBlock(0, _options.instructions);
+
+    while(_labelsLeft) {
+        line("", "x" + std::to_string(_nextLabel++));
+        --_labelsLeft;
+    }
+    for(size_t i = 0; i < std::min(maxPrints, _dataLabels.size()); ++i) {
+        line("print, (" + _dataLabels[i] + ")");
+    }
+    line("halt");
+    line(".END");
+    flush(true);
+    _os = nullptr;
+}
+
+std::string ProgramGenerator::generate() {
+    std::ostringstream ss;
+    generate(ss);
+    return ss.str();
+}
+
+size_t ProgramGenerator::wordCount() const {
+    return _words;
+}
+
+// Not std::uniform_int_distribution, whose results differ between standard
+// libraries. The same seed gives the same program everywhere.
+
+uint32_t ProgramGenerator::random(uint32_t bound) {
+    return bound ? _random() % bound : 0;
+}
+
+bool ProgramGenerator::chance(double probability) {
+    return _random() < probability * 4294967296.0;
+}
+
+// Writes one line. Instructions get one of the remaining extra labels at a
+// rate which spreads them over the whole program.
+
+void ProgramGenerator::line(const std::string &text, const std::string &label) {
+    bool instruction = !text.empty() && text[0] != '.';
+    if(instruction) {
+        size_t left = _options.instructions > _instructions ? _options.instructions - _instructions : 1;
+        if(_labelsLeft && random(static_cast<uint32_t>(std::min<size_t>(left, UINT32_MAX))) < _labelsLeft) {
+            --_labelsLeft;
+            std::string extra = "x" + std::to_string(_nextLabel++);
+            if(label.empty()) {
+                line(text, extra);
+                return;
+            }
+            _text += extra + ":\n";
+        }
+        ++_instructions;
+        ++_words;
+    }
+
+    if(!label.empty()) {
+        _text += label + (text.empty() ? ":" : ": ");
+    }
+    _text += text;
+    _text += '\n';
+    flush();
+}
+
+void ProgramGenerator::emitData() {
+    line(".DATA");
+
+    for(size_t i = 0; i < _options.words; ++i) {
+        std::string label = "w" + std::to_string(i);
+        line(".WORD, " + std::to_string(static_cast<int>(random(2001)) - 1000), label);
+        _dataLabels.push_back(label);
+        ++_words;
+    }
+    for(size_t i = 0; i < _options.multinumbers; ++i) {
+        std::string label = "m" + std::to_string(i);
+        size_t size = random(static_cast<uint32_t>(_options.maxMultinumberSize)) + 1;
+        line(".WORD, " + std::to_string(size) + "#" + std::to_string(static_cast<int>(random(2001)) - 1000), label);
+        _dataLabels.push_back(label);
+        _words += size;
+    }
+
+    // Pointers and loop counters are never written by the program
+    for(size_t i = 0; i < std::min(maxPointers, _dataLabels.size()); ++i) {
+        std::string label = "p" + std::to_string(i);
+        line(".WORD, " + dataLabel(), label);
+        _pointers.push_back(label);
+        ++_words;
+    }
+    for(unsigned i = 0; i < _options.loopDepth; ++i) {
+        line(".WORD, 0", "c" + std::to_string(i));
+        ++_words;
+    }
+}
+
+size_t ProgramGenerator::emitBlock(unsigned depth, size_t budget) {
+    size_t emitted = 0;
+    while(emitted < budget) {
+        // A loop takes 6 instructions on top of its body
+        if(depth < _options.loopDepth && budget - emitted > 8 && chance(loopChance)) {
+            size_t body = 2 + random(static_cast<uint32_t>(std::min(budget - emitted - 6, budget / 2)));
+            emitted += emitLoop(depth, body);
+        } else if(budget - emitted > 2 && chance(_options.branchDensity)) {
+            emitted += emitBranch();
+        } else {
+            emitted += emitStatement();
+        }
+    }
+    return emitted;
+}
+
+size_t ProgramGenerator::emitLoop(unsigned depth, size_t budget) {
+    std::string counter = "c" + std::to_string(depth);
+    std::string label = "l" + std::to_string(_nextLabel++);
+
+    line("load, @A, " + std::to_string(random(_options.loopIterations) + 1));
+    line("store, @A, " + counter);
+    line("", label);
+    size_t emitted = emitBlock(depth + 1, budget);
+    line("load, @A, (" + counter + ")");
+    line("sub, @A, 1");
+    line("store, @A, " + counter);
+    line("jpos, " + label);
+    return emitted + 6;
+}
+
+// A conditional jump over a few statements
+
+size_t ProgramGenerator::emitBranch() {
+    std::string label = "f" + std::to_string(_nextLabel++);
+    line(std::string(conditionalJumps[random(4)]) + ", " + label);
+    size_t emitted = 1;
+    for(uint32_t i = random(3) + 1; i > 0; --i) {
+        emitted += emitStatement();
+    }
+    line("", label);
+    return emitted;
+}
+
+size_t ProgramGenerator::emitStatement() {
+    uint32_t kind = random(20);
+
+    if(kind < 4) {
+        line("load, " + accumulator() + ", " + operand());
+        return 1;
+    }
+
+    if(kind < 9 && !_dataLabels.empty()) {
+        if(_slots.size() >= 2 && chance(_options.selfModifying)) {
+            std::string acu = accumulator();
+            line("load, " + acu + ", (" + _slots[random(static_cast<uint32_t>(_slots.size()))] + ")");
+            line("store, " + acu + ", " + _slots[random(static_cast<uint32_t>(_slots.size()))]);
+            return 2;
+        }
+        line("store, " + accumulator() + ", " + dataLabel());
+        return 1;
+    }
+
+    // Division only by positive constants, so it can neither fail nor overflow
+    if(kind < 11) {
+        line("div, " + accumulator() + ", " + std::to_string(random(9) + 2));
+        return 1;
+    }
+
+    std::string instruction = std::string(arithmetic[random(3)]) + ", " + accumulator() + ", ";
+    if(chance(0.5)) {
+        line(instruction + operand());
+    } else if(_options.selfModifying > 0 && chance(slotChance)) {
+        std::string label = "s" + std::to_string(_nextLabel++);
+        line(instruction + std::to_string(random(21) + 1), label);
+        _slots.push_back(label);
+    } else {
+        line(instruction + std::to_string(random(21) + 1));
+    }
+    return 1;
+}
+
+std::string ProgramGenerator::accumulator() {
+    return random(2) ? "@A" : "@B";
+}
+
+// An immediate, direct or indirect operand
+
+std::string ProgramGenerator::operand() {
+    uint32_t mode = _dataLabels.empty() ? 0 : random(4);
+    if(mode == 0) {
+        return std::to_string(static_cast<int>(random(201)) - 100);
+    } else if(mode == 3) {
+        return "((" + _pointers[random(static_cast<uint32_t>(_pointers.size()))] + "))";
+    } else {
+        return "(" + dataLabel() + ")";
+    }
+}
+
+std::string ProgramGenerator::dataLabel() {
+    return _dataLabels[random(static_cast<uint32_t>(_dataLabels.size()))];
+}
+
+void ProgramGenerator::flush(bool force) {
+    if(_text.size() >= flushSize || (force && !_text.empty())) {
+        _os->write(_text.data(), _text.size());
+        _text.clear();
+    }
+}
@@ -0,0 +1,97 @@
+/// Copyright (c) 2015 Jakub Trzebiatowski
+///
+/// Licensed under the Apache License, Version 2.0 (the "License");
+/// you may not use this file except in compliance with the License.
+/// You may obtain a copy of the License at
+///
+///     http://www.apache.org/licenses/LICENSE-2.0
+///
+/// Unless required by applicable law or agreed to in writing, software
+/// distributed under the License is distributed on an "AS IS" BASIS,
+/// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+/// See the License for the specific language governing permissions and
+/// limitations under the License.
+
+#ifndef AGHSM_PROGRAMGENERATOR_H
+#define AGHSM_PROGRAMGENERATOR_H
+
+#include <cstdint>
+#include <ostream>
+#include <random>
+#include <string>
+#include <vector>
+
+/// Writes random, valid DC2 sources of a given size and shape.
+///
+/// Generated programs always halt: loops count down a counter nothing else
+/// writes, all other jumps go forward, and self-modifying stores only copy
+/// one arithmetic instruction with an immediate operand over another. Only
+/// programs of at most maxRunnableWords words can be executed, because
+/// instructions address at most 32 KB; larger ones still assemble.
+class ProgramGenerator {
+public:
+    static const size_t maxRunnableWords = 8192;
+
+    struct Options {
+        size_t words = 16; // .WORD entries with a single number
+        size_t multinumbers = 4; // .WORD entries with N#V
+        size_t maxMultinumberSize = 8;
+        size_t labels = 0; // besides those used by jumps and loops
+        size_t instructions = 200; // approximate
+        double branchDensity = 0.1; // share of conditional forward jumps
+        unsigned loopDepth = 2; // of nested loops, 0 for no loops
+        unsigned loopIterations = 10; // at most, every time a loop is entered
+        double selfModifying = 0; // share of stores overwriting instructions
+        uint32_t seed = 1;
+    };
+
+    explicit ProgramGenerator(Options options);
+
+    void generate(std::ostream &os);
+
+    std::string generate();
+
+    /// Number of words of the last generated program.
+    size_t wordCount() const;
+
+private:
+    uint32_t random(uint32_t bound);
+
+    bool chance(double probability);
+
+    void line(const std::string &text, const std::string &label = "");
+
+    void emitData();
+
+    size_t emitBlock(unsigned depth, size_t budget);
+
+    size_t emitLoop(unsigned depth, size_t budget);
+
+    size_t emitBranch();
+
+    size_t emitStatement();
+
+    std::string accumulator();
+
+    std::string operand();
+
+    std::string dataLabel();
+
+    void flush(bool force = false);
+
+    Options _options;
+    std::mt19937 _random;
+    std::ostream *_os = nullptr;
+    std::string _text;
+
+    std::vector<std::string> _dataLabels; // words that may be read and written
+    std::vector<std::string> _pointers;
+    std::vector<std::string> _slots; // instructions that may be overwritten
+    size_t _instructions = 0;
+    size_t _labelsLeft = 0;
+    size_t _nextLabel = 0;
+    size_t _words = 0;
+};
+
+
+#endif //AGHSM_PROGRAMGENERATOR_H
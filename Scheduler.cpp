@@ -0,0 +1,40 @@
+/// Copyright (c) 2015 Jakub Trzebiatowski
+///
+/// Licensed under the Apache License, Version 2.0 (the "License");
+/// you may not use this file except in compliance with the License.
+/// You may obtain a copy of the License at
+///
+///     http://www.apache.org/licenses/LICENSE-2.0
+///
+/// Unless required by applicable law or agreed to in writing, software
+/// distributed under the License is distributed on an "AS IS" BASIS,
+/// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+/// See the License for the specific language governing permissions and
+/// limitations under the License.
+
+#include "Scheduler.h"
+
+const uint64_t Scheduler::defaultQuantum;
+
+Scheduler::Scheduler(ThreadPool &pool, uint64_t quantum) : _pool(pool), _quantum(quantum ? quantum : 1) {}
+
+void Scheduler::spawn(std::shared_ptr<VM> vm, Completion completion) {
+    _pool.submit([this, vm, completion] { slice(vm, completion); });
+}
+
+void Scheduler::wait() {
+    _pool.wait();
+}
+
+void Scheduler::slice(std::shared_ptr<VM> vm, Completion completion) {
+    try {
+        if(vm->runFor(_quantum)) {
+            _pool.yield([this, vm, completion] { slice(vm, completion); });
+            return;
+        }
+    } catch(...) {
+        completion(std::current_exception());
+        return;
+    }
+    completion(nullptr);
+}
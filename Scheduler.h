@@ -0,0 +1,50 @@
+/// Copyright (c) 2015 Jakub Trzebiatowski
+///
+/// Licensed under the Apache License, Version 2.0 (the "License");
+/// you may not use this file except in compliance with the License.
+/// You may obtain a copy of the License at
+///
+///     http://www.apache.org/licenses/LICENSE-2.0
+///
+/// Unless required by applicable law or agreed to in writing, software
+/// distributed under the License is distributed on an "AS IS" BASIS,
+/// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+/// See the License for the specific language governing permissions and
+/// limitations under the License.
+
+#ifndef AGHSM_SCHEDULER_H
+#define AGHSM_SCHEDULER_H
+
+#include "ThreadPool.h"
+#include "VM.h"
+
+#include <exception>
+#include <functional>
+#include <memory>
+
+/// Multiplexes many VMs over the threads of a pool. Each VM runs for a fixed
+/// instruction quantum and then goes to the back of its worker's queue, so a
+/// program that never halts only ever holds a thread for one quantum.
+class Scheduler {
+public:
+    /// Called once the VM halts (error is null) or throws.
+    typedef std::function<void(std::exception_ptr error)> Completion;
+
+    static const uint64_t defaultQuantum = 1000000;
+
+    Scheduler(ThreadPool &pool, uint64_t quantum = defaultQuantum);
+
+    /// Schedules a VM that has been loaded and reset().
+    void spawn(std::shared_ptr<VM> vm, Completion completion);
+
+    void wait();
+
+private:
+    void slice(std::shared_ptr<VM> vm, Completion completion);
+
+    ThreadPool &_pool;
+    uint64_t _quantum;
+};
+
+
+#endif //AGHSM_SCHEDULER_H
@@ -0,0 +1,106 @@
+/// Copyright (c) 2015 Jakub Trzebiatowski
+///
+/// Licensed under the Apache License, Version 2.0 (the "License");
+/// you may not use this file except in compliance with the License.
+/// You may obtain a copy of the License at
+///
+///     http://www.apache.org/licenses/LICENSE-2.0
+///
+/// Unless required by applicable law or agreed to in writing, software
+/// distributed under the License is distributed on an "AS IS" BASIS,
+/// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+/// See the License for the specific language governing permissions and
+/// limitations under the License.
+
+#include "SourceBuffer.h"
+
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define AGHSM_SOURCE_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#define AGHSM_SOURCE_MMAP 0
+#endif
+
+std::shared_ptr<const SourceBuffer> SourceBuffer::fromFile(const std::string &path) {
+#if AGHSM_SOURCE_MMAP
+    int fd = open(path.c_str(), O_RDONLY);
+    if(fd < 0) {
+        throw std::runtime_error{"Unable to open file"};
+    }
+
+    std::shared_ptr<SourceBuffer> source(new SourceBuffer);
+    struct stat status = {};
+    if(fstat(fd, &status) == 0 && S_ISREG(status.st_mode) && status.st_size > 0) {
+        void *mapping = mmap(nullptr, static_cast<size_t>(status.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        if(mapping != MAP_FAILED) {
+            source->_mapping = mapping;
+            source->_mappingSize = static_cast<size_t>(status.st_size);
+        }
+    }
+    close(fd);
+    if(source->_mapping || (S_ISREG(status.st_mode) && status.st_size == 0)) {
+        return source;
+    }
+#endif
+
+    // Not a regular file, or it cannot be mapped
+    std::ifstream ifs(path, std::ios::binary);
+    if(!ifs.good()) {
+        throw std::runtime_error{"Unable to open file"};
+    }
+    return fromStream(ifs);
+}
+
+std::shared_ptr<const SourceBuffer> SourceBuffer::fromStream(std::istream &is) {
+    return fromString(std::string{std::istreambuf_iterator<char>(is), std::istreambuf_iterator<char>()});
+}
+
+std::shared_ptr<const SourceBuffer> SourceBuffer::fromString(std::string text) {
+    std::shared_ptr<SourceBuffer> source(new SourceBuffer);
+    source->_text = std::move(text);
+    return source;
+}
+
+uint64_t SourceBuffer::version(const std::string &path) {
+#if AGHSM_SOURCE_MMAP
+    struct stat status = {};
+    if(stat(path.c_str(), &status) != 0) {
+        return 0;
+    }
+#if defined(__APPLE__)
+    uint64_t version = status.st_mtimespec.tv_sec * 1000000000ull + status.st_mtimespec.tv_nsec;
+#else
+    uint64_t version = status.st_mtim.tv_sec * 1000000000ull + status.st_mtim.tv_nsec;
+#endif
+    version ^= static_cast<uint64_t>(status.st_size) * 0x9e3779b97f4a7c15ull;
+    version ^= static_cast<uint64_t>(status.st_ino) * 0xc2b2ae3d27d4eb4full;
+    return version ? version : 1;
+#else
+    // Only the size can be told without reading the file
+    std::ifstream ifs(path, std::ios::binary | std::ios::ate);
+    return ifs.good() ? static_cast<uint64_t>(ifs.tellg()) + 1 : 0;
+#endif
+}
+
+SourceBuffer::~SourceBuffer() {
+#if AGHSM_SOURCE_MMAP
+    if(_mapping) {
+        munmap(_mapping, _mappingSize);
+    }
+#endif
+}
+
+const char *SourceBuffer::data() const {
+    return _mapping ? static_cast<const char *>(_mapping) : _text.data();
+}
+
+size_t SourceBuffer::size() const {
+    return _mapping ? _mappingSize : _text.size();
+}
@@ -0,0 +1,60 @@
+/// Copyright (c) 2015 Jakub Trzebiatowski
+///
+/// Licensed under the Apache License, Version 2.0 (the "License");
+/// you may not use this file except in compliance with the License.
+/// You may obtain a copy of the License at
+///
+///     http://www.apache.org/licenses/LICENSE-2.0
+///
+/// Unless required by applicable law or agreed to in writing, software
+/// distributed under the License is distributed on an "AS IS" BASIS,
+/// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+/// See the License for the specific language governing permissions and
+/// limitations under the License.
+
+#ifndef AGHSM_SOURCEBUFFER_H
+#define AGHSM_SOURCEBUFFER_H
+
+#include "StringRef.h"
+
+#include <cstdint>
+#include <istream>
+#include <memory>
+#include <string>
+
+/// The whole text of a source. Tokens point into it, so it is shared by
+/// everything holding tokens.
+class SourceBuffer {
+public:
+    /// Maps the file into memory where possible, reads it otherwise. Throws
+    /// std::runtime_error if the file cannot be opened.
+    static std::shared_ptr<const SourceBuffer> fromFile(const std::string &path);
+
+    static std::shared_ptr<const SourceBuffer> fromStream(std::istream &is);
+
+    static std::shared_ptr<const SourceBuffer> fromString(std::string text);
+
+    /// Changes whenever the file at `path` is written or replaced, 0 if it
+    /// cannot be found.
+    static uint64_t version(const std::string &path);
+
+    SourceBuffer(const SourceBuffer &) = delete;
+
+    SourceBuffer &operator=(const SourceBuffer &) = delete;
+
+    ~SourceBuffer();
+
+    const char *data() const;
+
+    size_t size() const;
+
+private:
+    SourceBuffer() = default;
+
+    void *_mapping = nullptr;
+    size_t _mappingSize = 0;
+    std::string _text; // where the source is not mapped
+};
+
+
+#endif //AGHSM_SOURCEBUFFER_H
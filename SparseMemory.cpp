@@ -0,0 +1,67 @@
+/// Copyright (c) 2015 Jakub Trzebiatowski
+///
+/// Licensed under the Apache License, Version 2.0 (the "License");
+/// you may not use this file except in compliance with the License.
+/// You may obtain a copy of the License at
+///
+///     http://www.apache.org/licenses/LICENSE-2.0
+///
+/// Unless required by applicable law or agreed to in writing, software
+/// distributed under the License is distributed on an "AS IS" BASIS,
+/// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+/// See the License for the specific language governing permissions and
+/// limitations under the License.
+
+
+#include "SparseMemory.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define AGHSM_SPARSE_MMAP 1
+#include <sys/mman.h>
+#else
+#define AGHSM_SPARSE_MMAP 0
+#endif
+
+#if AGHSM_SPARSE_MMAP && !defined(MAP_NORESERVE)
+#define MAP_NORESERVE 0
+#endif
+
+SparseMemory::SparseMemory(size_t words) : _size(words) {
+#if AGHSM_SPARSE_MMAP
+    // Without swap space reserved for it, so that a large area which is
+    // mostly untouched does not count against overcommit limits
+    if(words) {
+        void *mapping = mmap(nullptr, words * sizeof(Word), PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if(mapping != MAP_FAILED) {
+            _mapping = mapping;
+            _mappingSize = words * sizeof(Word);
+            return;
+        }
+    }
+#endif
+    _pages.resize((words + pageWords - 1) / pageWords);
+}
+
+SparseMemory::~SparseMemory() {
+#if AGHSM_SPARSE_MMAP
+    if(_mapping) {
+        munmap(_mapping, _mappingSize);
+    }
+#endif
+}
+
+size_t SparseMemory::size() const {
+    return _size;
+}
+
+Word &SparseMemory::at(size_t index) {
+    if(_mapping) {
+        return static_cast<Word *>(_mapping)[index];
+    }
+    std::unique_ptr<Word[]> &page = _pages[index / pageWords];
+    if(!page) {
+        page.reset(new Word[pageWords]());
+    }
+    return page[index % pageWords];
+}
@@ -0,0 +1,53 @@
+/// Copyright (c) 2015 Jakub Trzebiatowski
+///
+/// Licensed under the Apache License, Version 2.0 (the "License");
+/// you may not use this file except in compliance with the License.
+/// You may obtain a copy of the License at
+///
+///     http://www.apache.org/licenses/LICENSE-2.0
+///
+/// Unless required by applicable law or agreed to in writing, software
+/// distributed under the License is distributed on an "AS IS" BASIS,
+/// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+/// See the License for the specific language governing permissions and
+/// limitations under the License.
+
+
+#ifndef AGHSM_SPARSEMEMORY_H
+#define AGHSM_SPARSEMEMORY_H
+
+#include "CodeEmitter.h"
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+/// Zeroed words which only take memory once they are touched. The words are
+/// reserved as one anonymous mapping, whose pages the OS allocates on first
+/// touch, or else allocated a page at a time.
+class SparseMemory {
+public:
+    explicit SparseMemory(size_t words);
+
+    SparseMemory(const SparseMemory &) = delete;
+
+    SparseMemory &operator=(const SparseMemory &) = delete;
+
+    ~SparseMemory();
+
+    size_t size() const;
+
+    /// `index` has to be below size().
+    Word &at(size_t index);
+
+private:
+    static const size_t pageWords = 16 * 1024;
+
+    size_t _size;
+    void *_mapping = nullptr;
+    size_t _mappingSize = 0;
+    std::vector<std::unique_ptr<Word[]>> _pages; // where not mapped
+};
+
+
+#endif //AGHSM_SPARSEMEMORY_H
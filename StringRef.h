@@ -0,0 +1,65 @@
+/// Copyright (c) 2015 Jakub Trzebiatowski
+///
+/// Licensed under the Apache License, Version 2.0 (the "License");
+/// you may not use this file except in compliance with the License.
+/// You may obtain a copy of the License at
+///
+///     http://www.apache.org/licenses/LICENSE-2.0
+///
+/// Unless required by applicable law or agreed to in writing, software
+/// distributed under the License is distributed on an "AS IS" BASIS,
+/// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+/// See the License for the specific language governing permissions and
+/// limitations under the License.
+
+#ifndef AGHSM_STRINGREF_H
+#define AGHSM_STRINGREF_H
+
+#include <cstring>
+#include <ostream>
+#include <string>
+
+/// Characters owned by someone else, like std::string_view.
+struct StringRef {
+    const char *data = nullptr;
+    size_t size = 0;
+
+    StringRef() = default;
+
+    StringRef(const char *data, size_t size) : data(data), size(size) {}
+
+    bool empty() const {
+        return !size;
+    }
+
+    char operator[](size_t i) const {
+        return data[i];
+    }
+
+    std::string str() const {
+        return std::string(data, size);
+    }
+};
+
+inline bool operator==(StringRef a, StringRef b) {
+    return a.size == b.size && !std::memcmp(a.data, b.data, a.size);
+}
+
+inline bool operator==(StringRef a, const char *b) {
+    return a == StringRef(b, std::strlen(b));
+}
+
+inline bool operator!=(StringRef a, StringRef b) {
+    return !(a == b);
+}
+
+inline bool operator!=(StringRef a, const char *b) {
+    return !(a == b);
+}
+
+inline std::ostream &operator<<(std::ostream &os, StringRef s) {
+    return os.write(s.data, s.size);
+}
+
+
+#endif //AGHSM_STRINGREF_H
@@ -0,0 +1,79 @@
+/// Copyright (c) 2015 Jakub Trzebiatowski
+///
+/// Licensed under the Apache License, Version 2.0 (the "License");
+/// you may not use this file except in compliance with the License.
+/// You may obtain a copy of the License at
+///
+///     http://www.apache.org/licenses/LICENSE-2.0
+///
+/// Unless required by applicable law or agreed to in writing, software
+/// distributed under the License is distributed on an "AS IS" BASIS,
+/// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+/// See the License for the specific language governing permissions and
+/// limitations under the License.
+
+
+#include "SymbolTable.h"
+
+#include <cstring>
+
+static const size_t initialSlots = 64;
+
+// FNV-1a
+
+static uint32_t hashName(StringRef name) {
+    uint32_t hash = 2166136261u;
+    for(size_t i = 0; i < name.size; ++i) {
+        hash = (hash ^ static_cast<unsigned char>(name[i])) * 16777619u;
+    }
+    return hash;
+}
+
+uint32_t SymbolTable::intern(StringRef name) {
+    if(_slots.empty()) {
+        _slots.resize(initialSlots);
+    }
+
+    uint32_t hash = hashName(name);
+    size_t mask = _slots.size() - 1;
+    for(size_t slot = hash & mask; _slots[slot]; slot = (slot + 1) & mask) {
+        const Name &candidate = _names[_slots[slot] - 1];
+        if(candidate.hash == hash && candidate.size == name.size &&
+           !std::memcmp(_characters.data() + candidate.offset, name.data, name.size)) {
+            return _slots[slot] - 1;
+        }
+    }
+
+    uint32_t symbol = _names.size();
+    _names.push_back({static_cast<uint32_t>(_characters.size()), static_cast<uint32_t>(name.size), hash});
+    _characters.append(name.data, name.size);
+
+    // At most half of the slots are used
+    if(_names.size() * 2 > _slots.size()) {
+        _slots.assign(_slots.size() * 2, 0);
+        for(uint32_t i = 0; i < _names.size(); ++i) {
+            insert(_names[i].hash, i);
+        }
+    } else {
+        insert(hash, symbol);
+    }
+    return symbol;
+}
+
+StringRef SymbolTable::name(uint32_t symbol) const {
+    const Name &name = _names[symbol];
+    return StringRef(_characters.data() + name.offset, name.size);
+}
+
+size_t SymbolTable::size() const {
+    return _names.size();
+}
+
+void SymbolTable::insert(uint32_t hash, uint32_t symbol) {
+    size_t mask = _slots.size() - 1;
+    size_t slot = hash & mask;
+    while(_slots[slot]) {
+        slot = (slot + 1) & mask;
+    }
+    _slots[slot] = symbol + 1;
+}
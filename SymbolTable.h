@@ -0,0 +1,52 @@
+/// Copyright (c) 2015 Jakub Trzebiatowski
+///
+/// Licensed under the Apache License, Version 2.0 (the "License");
+/// you may not use this file except in compliance with the License.
+/// You may obtain a copy of the License at
+///
+///     http://www.apache.org/licenses/LICENSE-2.0
+///
+/// Unless required by applicable law or agreed to in writing, software
+/// distributed under the License is distributed on an "AS IS" BASIS,
+/// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+/// See the License for the specific language governing permissions and
+/// limitations under the License.
+
+#ifndef AGHSM_SYMBOLTABLE_H
+#define AGHSM_SYMBOLTABLE_H
+
+#include "StringRef.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/// Interns names of labels and references, so that the rest of the assembler
+/// compares and looks them up as integers. Symbols are numbered from 0 in the
+/// order in which their names are first seen.
+class SymbolTable {
+public:
+    /// The symbol of `name`, added if it is new.
+    uint32_t intern(StringRef name);
+
+    /// Valid until the next intern().
+    StringRef name(uint32_t symbol) const;
+
+    size_t size() const;
+
+private:
+    struct Name {
+        uint32_t offset; // in _characters
+        uint32_t size;
+        uint32_t hash;
+    };
+
+    void insert(uint32_t hash, uint32_t symbol);
+
+    std::string _characters; // of all the names, one after another
+    std::vector<Name> _names;
+    std::vector<uint32_t> _slots; // symbol + 1 or 0, open addressing
+};
+
+
+#endif //AGHSM_SYMBOLTABLE_H
@@ -0,0 +1,459 @@
+/// Copyright (c) 2015 Jakub Trzebiatowski
+///
+/// Licensed under the Apache License, Version 2.0 (the "License");
+/// you may not use this file except in compliance with the License.
+/// You may obtain a copy of the License at
+///
+///     http://www.apache.org/licenses/LICENSE-2.0
+///
+/// Unless required by applicable law or agreed to in writing, software
+/// distributed under the License is distributed on an "AS IS" BASIS,
+/// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+/// See the License for the specific language governing permissions and
+/// limitations under the License.
+
+#include "Assembler.h"
+#include "BatchRunner.h"
+#include "IncrementalAssembler.h"
+#include "Language.h"
+#include "LockstepVM.h"
+#include "OutputSink.h"
+#include "ProgramGenerator.h"
+#include "ThreadPool.h"
+#include "VM.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+// Minimal test runner: every test is a function, CHECK records a failure
+// and lets the test go on
+
+static int failures = 0;
+
+#define CHECK(condition) \
+	do { \
+		if (!(condition)) { \
+			std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #condition << std::endl; \
+			++failures; \
+		} \
+	} while (0)
+
+static const VM::Engine engines[] = {VM::ReferenceEngine, VM::ThreadedEngine, VM::JitEngine};
+
+static const char *engineName(VM::Engine engine) {
+	switch (engine) {
+		case VM::ReferenceEngine:
+			return "reference";
+		case VM::ThreadedEngine:
+			return "threaded";
+		default:
+			return "jit";
+	}
+}
+
+struct RunResult {
+	std::string output;
+	std::string error; // empty if the program halted
+	uint64_t instructionCount = 0;
+};
+
+static RunResult run(const std::string &source, VM::Engine engine, VM::Limits limits = VM::Limits(),
+                     bool optimizing = false) {
+	RunResult result;
+	StringSink output;
+	VM vm;
+	vm.setEngine(engine);
+	vm.setOutputSink(output);
+	vm.setLimits(limits);
+
+	Assembler assembler(SourceBuffer::fromString(source));
+	assembler.setOptimization(optimizing);
+	vm.load(assembler.compile());
+	vm.reset();
+	try {
+		vm.run();
+	} catch (VM::VMException &e) {
+		result.error = e.what();
+	}
+	result.output = output.str();
+	result.instructionCount = vm.instructionCount();
+	return result;
+}
+
+// Source files of a batch, removed with the directory holding them
+class TemporaryDirectory {
+public:
+	TemporaryDirectory() {
+		char path[] = "/tmp/aghsm_test.XXXXXX";
+		if (!mkdtemp(path)) {
+			std::perror("mkdtemp");
+			std::exit(1);
+		}
+		_path = path;
+	}
+
+	~TemporaryDirectory() {
+		for (const std::string &file : _files) {
+			unlink(file.c_str());
+		}
+		rmdir(_path.c_str());
+	}
+
+	std::string write(const std::string &name, const std::string &text) {
+		std::string file = _path + "/" + name;
+		std::ofstream(file) << text;
+		_files.push_back(file);
+		return file;
+	}
+
+private:
+	std::string _path;
+	std::vector<std::string> _files;
+};
+
+static void testDivisionFaults() {
+	const std::string byZero = ".UNIT\n.DATA\n.CODE\nload, @A, 7\ndiv, @A, 0\nhalt\n.END\n";
+	const std::string overflow = ".UNIT\n.DATA\nmin: .WORD, -2147483648\n.CODE\n"
+	                             "load, @A, (min)\ndiv, @A, -1\nhalt\n.END\n";
+
+	for (VM::Engine engine : engines) {
+		std::cerr << "  " << engineName(engine) << std::endl;
+		CHECK(run(byZero, engine).error == "division by zero");
+		CHECK(run(overflow, engine).error == "division overflow");
+	}
+}
+
+static void testBatchDivisionByZero() {
+	TemporaryDirectory directory;
+	std::vector<std::string> paths = {
+			directory.write("ok.asm", ".UNIT\n.DATA\n.CODE\nload, @A, 1\nprint, @A\nhalt\n.END\n"),
+			directory.write("zero.asm", ".UNIT\n.DATA\n.CODE\nload, @A, 2\nprint, @A\ndiv, @A, 0\nhalt\n.END\n"),
+			directory.write("after.asm", ".UNIT\n.DATA\n.CODE\nload, @A, 3\nprint, @A\nhalt\n.END\n"),
+	};
+
+	for (VM::Engine engine : engines) {
+		std::cerr << "  " << engineName(engine) << std::endl;
+		BatchRunner runner(paths, engine);
+		ThreadPool pool(2);
+		runner.run(pool);
+
+		const std::vector<BatchResult> &results = runner.results();
+		CHECK(results[0].status == BatchResult::OkStatus);
+		CHECK(results[0].output == "1\n");
+		CHECK(results[1].status == BatchResult::FailedStatus);
+		CHECK(results[1].error == "division by zero");
+		CHECK(results[1].output == "2\n");
+		CHECK(results[2].status == BatchResult::OkStatus);
+		CHECK(results[2].output == "3\n");
+		CHECK(runner.anyFailed());
+	}
+}
+
+static void testBudgetBeforeJumpFault() {
+	// `e` is past the last word, so only fetching from it faults
+	const std::string source = ".UNIT\n.DATA\n.CODE\nload, @A, 1\njump, e\ne:\n.END\n";
+	VM::Limits limits;
+
+	for (VM::Engine engine : engines) {
+		std::cerr << "  " << engineName(engine) << std::endl;
+		limits.instructions = 2;
+		RunResult result = run(source, engine, limits);
+		CHECK(result.error == "instruction limit exceeded");
+		CHECK(result.instructionCount == 2);
+
+		limits.instructions = 3;
+		CHECK(run(source, engine, limits).error == "out of program memory access");
+	}
+}
+
+static void testFaultInstructionCount() {
+	// Each program runs a loop first, so the fault happens in a decoded
+	// program, then faults on its last instruction
+	const std::string loop = "load, @A, 3\nloop: sub, @A, 1\njnzero, loop\n";
+	const std::string sources[] = {
+			// Memory access through a pointer
+			".UNIT\n.DATA\np: .WORD, 4000\n.CODE\n" + loop + "load, @B, ((p))\nhalt\n.END\n",
+			// Store through a pointer
+			".UNIT\n.DATA\np: .WORD, 4002\n.CODE\n" + loop + "store, @B, (p)\nhalt\n.END\n",
+			// Division by zero
+			".UNIT\n.DATA\n.CODE\n" + loop + "div, @B, 0\nhalt\n.END\n",
+			// Past the last instruction
+			".UNIT\n.DATA\n.CODE\n" + loop + "load, @B, 1\n.END\n",
+			// Jump past the last instruction
+			".UNIT\n.DATA\n.CODE\n" + loop + "jump, e\ne:\n.END\n",
+			// Static address past the last instruction
+			".UNIT\n.DATA\n.CODE\n" + loop + "load, @B, (e)\ne:\n.END\n",
+	};
+
+	for (const std::string &source : sources) {
+		RunResult expected = run(source, VM::ReferenceEngine);
+		CHECK(!expected.error.empty());
+		for (VM::Engine engine : engines) {
+			RunResult result = run(source, engine);
+			std::cerr << "  " << engineName(engine) << ": " << result.error << " after "
+			          << result.instructionCount << " instructions" << std::endl;
+			CHECK(result.error == expected.error);
+			CHECK(result.instructionCount == expected.instructionCount);
+		}
+	}
+}
+
+static void testOptimizedPointerStore() {
+	// `x` is too far for the optimizer to turn the store through `p` into a
+	// direct one, and the load reads `p` itself, not what was stored
+	const std::string source = ".UNIT\n.DATA\np: .WORD, x\nbig: .WORD, 9000#0\nx: .WORD, 7\n.CODE\n"
+	                           "load, @A, 5\nstore, @A, (p)\nload, @A, (p)\nprint, @A\nhalt\n.END\n";
+
+	for (VM::Engine engine : engines) {
+		std::cerr << "  " << engineName(engine) << std::endl;
+		RunResult plain = run(source, engine);
+		RunResult optimized = run(source, engine, VM::Limits(), true);
+		CHECK(plain.output == "36008\n");
+		CHECK(optimized.output == plain.output);
+		CHECK(optimized.error.empty());
+	}
+}
+
+static void testOptimizedLabels() {
+	// A chain of jumps, unreachable code, a jump to the next instruction and
+	// a `null`, all of them labelled
+	const std::string source = ".UNIT\n.DATA\nx: .WORD, 4\n.CODE\n"
+	                           "start: jump, a\nskip: print, (x)\na: jump, b\nb: null\nc: load, @A, (x)\n"
+	                           "loop: print, @A\nsub, @A, 1\njnzero, hop\nhop: jnzero, loop\n"
+	                           "n: null\nout: halt\n.END\n";
+
+	Assembler plain(SourceBuffer::fromString(source));
+	std::vector<Word> plainProgram = plain.compile();
+	Assembler optimized(SourceBuffer::fromString(source));
+	optimized.setOptimization(true);
+	std::vector<Word> program = optimized.compile();
+	CHECK(program.size() < plainProgram.size());
+
+	// Every label is kept, and removed words give way to the next word left
+	const std::unordered_map<std::string, int> &labels = optimized.labels();
+	for (const auto &label : plain.labels()) {
+		CHECK(labels.count(label.first) && labels.at(label.first) < static_cast<int>(program.size()));
+	}
+	CHECK(labels.at("a") == labels.at("c") && labels.at("b") == labels.at("c"));
+	CHECK(labels.at("n") == labels.at("out"));
+	CHECK(program[labels.at("c")].instruction.code == LoadInstruction);
+	CHECK(program[labels.at("loop")].instruction.code == PrintInstruction);
+	CHECK(program[labels.at("hop")].instruction.code == JnzeroInstruction);
+	CHECK(program[labels.at("hop")].instruction.adr == labels.at("loop") * 4);
+	CHECK(program[labels.at("out")].instruction.code == HaltInstruction);
+
+	for (VM::Engine engine : engines) {
+		std::cerr << "  " << engineName(engine) << std::endl;
+		RunResult before = run(source, engine);
+		RunResult after = run(source, engine, VM::Limits(), true);
+		CHECK(before.output == "4\n3\n2\n1\n");
+		CHECK(after.output == before.output);
+		CHECK(after.error.empty());
+		CHECK(after.instructionCount < before.instructionCount);
+	}
+}
+
+static ProgramGenerator::Options selfModifyingProgram(uint32_t seed, unsigned loopIterations) {
+	ProgramGenerator::Options options;
+	options.instructions = 3000;
+	options.selfModifying = 0.3;
+	options.loopIterations = loopIterations;
+	options.seed = seed;
+	return options;
+}
+
+static void testJitSelfModifyingCode() {
+	// Flips the instruction at `op` between an add and a sub on every
+	// iteration, so the JIT ends up leaving it to the interpreter
+	const std::string flip = ".UNIT\n.DATA\nn: .WORD, 50\n.CODE\n"
+	                         "op: add, @B, 3\nprint, @B\nload, @A, (op)\nsub, @A, (addop)\njzero, toSub\n"
+	                         "load, @A, (addop)\njump, put\ntoSub: load, @A, (subop)\nput: store, @A, op\n"
+	                         "load, @A, (n)\nsub, @A, 1\nstore, @A, n\njnzero, op\nhalt\n"
+	                         "addop: add, @B, 3\nsubop: sub, @B, 5\n.END\n";
+	const std::string start = "3\n-2\n1\n-4\n";
+	CHECK(run(flip, VM::ReferenceEngine).output.compare(0, start.size(), start) == 0);
+	std::vector<std::string> sources = {flip};
+	for (uint32_t seed = 1; seed <= 6; ++seed) {
+		sources.push_back(ProgramGenerator(selfModifyingProgram(seed, 20)).generate());
+	}
+
+	VM::Limits limits;
+	limits.instructions = 20000000;
+	for (const std::string &source : sources) {
+		RunResult expected = run(source, VM::ReferenceEngine, limits);
+		RunResult result = run(source, VM::JitEngine, limits);
+		CHECK(result.output == expected.output);
+		CHECK(result.error == expected.error);
+		CHECK(result.instructionCount == expected.instructionCount);
+	}
+}
+
+static void testJitInvalidationCost() {
+	// Code rewritten on every iteration used to be retranslated, and its
+	// blocks relinked, each time; the JIT ran 100 times slower than the
+	// threaded interpreter
+	std::string source = ProgramGenerator(selfModifyingProgram(5, 200)).generate();
+	double seconds[2];
+	RunResult results[2];
+	const VM::Engine compared[] = {VM::ThreadedEngine, VM::JitEngine};
+	for (int i = 0; i < 2; ++i) {
+		auto start = std::chrono::steady_clock::now();
+		results[i] = run(source, compared[i]);
+		seconds[i] = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		std::cerr << "  " << engineName(compared[i]) << ": " << seconds[i] << " s" << std::endl;
+	}
+	CHECK(results[1].output == results[0].output);
+	CHECK(seconds[1] < 4 * seconds[0] + 0.25);
+}
+
+// Lane 1 never halts, so only the limits can end the run
+static LockstepVM lockstepLoop(VM::Limits limits) {
+	Assembler assembler(SourceBuffer::fromString(".UNIT\n.DATA\nn: .WORD, 0\n.CODE\n"
+	                                             "loop: load, @A, (n)\njzero, done\nprint, @A\njump, loop\n"
+	                                             "done: halt\n.END\n"));
+	LockstepVM vm(assembler.compile(), 2);
+	vm.setWord(1, assembler.labels().at("n"), 7);
+	vm.setLimits(limits);
+	vm.setOutputLimit(10);
+	vm.run();
+	return vm;
+}
+
+static void testLockstepLimits() {
+	VM::Limits limits;
+	limits.instructions = 1000;
+	LockstepVM vm = lockstepLoop(limits);
+	const std::vector<BatchResult> &results = vm.results();
+	CHECK(results[0].status == BatchResult::OkStatus);
+	CHECK(results[0].output.empty());
+	CHECK(results[1].status == BatchResult::LimitStatus);
+	CHECK(results[1].error == "instruction limit exceeded");
+	CHECK(results[1].output == "7\n7\n7\n7\n7\n");
+	CHECK(results[1].truncated);
+	CHECK(!vm.allSucceeded() && !vm.anyFailed());
+
+	limits = VM::Limits();
+	limits.time = std::chrono::milliseconds(50);
+	LockstepVM timed = lockstepLoop(limits);
+	CHECK(timed.results()[1].status == BatchResult::LimitStatus);
+	CHECK(timed.results()[1].error == "time limit exceeded");
+}
+
+static bool sameProgram(const std::vector<Word> &a, const std::vector<Word> &b) {
+	if (a.size() != b.size()) {
+		return false;
+	}
+	for (size_t i = 0; i < a.size(); ++i) {
+		if (a[i].data != b[i].data) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// Source of a unit with a word per counter and a loop over each of them,
+// so labels are referenced from both sides of every edit
+static std::vector<std::string> counterLines(int counters) {
+	std::vector<std::string> lines = {".UNIT", ".DATA", "pad: .WORD, 5"};
+	for (int i = 0; i < counters; ++i) {
+		lines.push_back("c" + std::to_string(i) + ": .WORD, " + std::to_string(i + 1));
+	}
+	lines.push_back(".CODE");
+	for (int i = 0; i < counters; ++i) {
+		std::string n = std::to_string(i);
+		lines.push_back("l" + n + ": load, @A, (c" + n + ")");
+		lines.push_back("sub, @A, 1");
+		lines.push_back("store, @A, c" + n);
+		lines.push_back("jnzero, l" + n);
+		lines.push_back("jump, " + (i + 1 < counters ? "l" + std::to_string(i + 1) : std::string("end")));
+	}
+	lines.push_back("end: halt");
+	lines.push_back(".END");
+	return lines;
+}
+
+static std::string join(const std::vector<std::string> &lines) {
+	std::string text;
+	for (const std::string &line : lines) {
+		text += line + '\n';
+	}
+	return text;
+}
+
+static void testIncrementalReassembly() {
+	std::vector<std::string> lines = counterLines(50);
+	const size_t code = std::find(lines.begin(), lines.end(), ".CODE") - lines.begin();
+	IncrementalAssembler incremental;
+
+	auto check = [&](const char *edit, int maxLines) {
+		std::cerr << "  " << edit << std::endl;
+		std::string text = join(lines);
+		const std::vector<Word> &program = incremental.compile(SourceBuffer::fromString(text));
+		Assembler assembler(SourceBuffer::fromString(text));
+		CHECK(sameProgram(program, assembler.compile()));
+		CHECK(incremental.assembledLines() <= maxLines);
+	};
+
+	check("first version", static_cast<int>(lines.size()));
+
+	lines.insert(lines.begin() + code + 100, "print, @A");
+	check("inserted instruction", 2);
+
+	lines.erase(lines.begin() + 2);
+	check("deleted word", 2);
+
+	lines[code + 3] = "sub, @A, 2";
+	check("edited instruction", 2);
+
+	lines.insert(lines.begin() + code + 1, "loop: add, @B, 1");
+	lines[lines.size() - 3] = "jump, loop";
+	check("new label", static_cast<int>(lines.size()));
+
+	lines[code + 20] = "sub, @A,";
+	try {
+		incremental.compile(SourceBuffer::fromString(join(lines)));
+		CHECK(false);
+	} catch (std::exception &) {
+		// The next version is compared with the last one which assembled
+	}
+	lines[code + 20] = "sub, @A, 3";
+	check("after an error", static_cast<int>(lines.size()));
+}
+
+int main() {
+	const struct {
+		const char *name;
+		void (*function)();
+	} tests[] = {
+			{"division faults", testDivisionFaults},
+			{"batch with a division by zero", testBatchDivisionByZero},
+			{"instruction limit before a jump fault", testBudgetBeforeJumpFault},
+			{"instruction count at a fault", testFaultInstructionCount},
+			{"optimized store through a pointer", testOptimizedPointerStore},
+			{"optimized jumps and labels", testOptimizedLabels},
+			{"JIT on self-modifying code", testJitSelfModifyingCode},
+			{"JIT invalidation cost", testJitInvalidationCost},
+			{"lockstep limits", testLockstepLimits},
+			{"incremental reassembly", testIncrementalReassembly},
+	};
+
+	for (const auto &test : tests) {
+		std::cerr << test.name << std::endl;
+		test.function();
+	}
+
+	if (failures) {
+		std::cerr << failures << " checks failed" << std::endl;
+		return 1;
+	}
+	std::cerr << "all tests passed" << std::endl;
+	return 0;
+}
@@ -0,0 +1,138 @@
+/// Copyright (c) 2015 Jakub Trzebiatowski
+///
+/// Licensed under the Apache License, Version 2.0 (the "License");
+/// you may not use this file except in compliance with the License.
+/// You may obtain a copy of the License at
+///
+///     http://www.apache.org/licenses/LICENSE-2.0
+///
+/// Unless required by applicable law or agreed to in writing, software
+/// distributed under the License is distributed on an "AS IS" BASIS,
+/// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+/// See the License for the specific language governing permissions and
+/// limitations under the License.
+
+#include "ThreadPool.h"
+
+// Pool and worker index of the current thread, if it is a worker
+static thread_local ThreadPool *currentPool = nullptr;
+static thread_local unsigned currentWorker = 0;
+
+ThreadPool::ThreadPool(unsigned threads) : _queued(0), _pending(0), _nextWorker(0) {
+    if(threads == 0) {
+        threads = std::thread::hardware_concurrency();
+    }
+    if(threads == 0) {
+        threads = 1;
+    }
+
+    for(unsigned i = 0; i < threads; ++i) {
+        _workers.emplace_back(new Worker);
+    }
+    for(unsigned i = 0; i < threads; ++i) {
+        _threads.emplace_back(&ThreadPool::workerLoop, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = true;
+    }
+    _wakeUp.notify_all();
+    for(std::thread &thread : _threads) {
+        thread.join();
+    }
+}
+
+void ThreadPool::submit(Task task) {
+    enqueue(std::move(task), false);
+}
+
+void ThreadPool::yield(Task task) {
+    enqueue(std::move(task), true);
+}
+
+void ThreadPool::enqueue(Task task, bool last) {
+    unsigned index = currentPool == this ? currentWorker : _nextWorker++ % _workers.size();
+
+    ++_pending;
+    {
+        // Counted before any worker can take the task, so the worker's
+        // decrement never runs ahead of it
+        std::lock_guard<std::mutex> lock(_mutex);
+        ++_queued;
+    }
+    {
+        // Workers take their own tasks from the back
+        Worker &worker = *_workers[index];
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        if(last) {
+            worker.tasks.push_front(std::move(task));
+        } else {
+            worker.tasks.push_back(std::move(task));
+        }
+    }
+    _wakeUp.notify_one();
+}
+
+void ThreadPool::wait() {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _idle.wait(lock, [this] { return _pending == 0; });
+}
+
+unsigned ThreadPool::size() const {
+    return _workers.size();
+}
+
+void ThreadPool::workerLoop(unsigned index) {
+    currentPool = this;
+    currentWorker = index;
+
+    for(;;) {
+        Task task;
+        if(popLocal(index, task) || steal(index, task)) {
+            --_queued;
+            try {
+                task();
+            } catch(...) {
+                // Tasks report their own errors
+            }
+            if(--_pending == 0) {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _idle.notify_all();
+            }
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(_mutex);
+        _wakeUp.wait(lock, [this] { return _stopping || _queued > 0; });
+        if(_stopping && _queued == 0) {
+            return;
+        }
+    }
+}
+
+bool ThreadPool::popLocal(unsigned index, Task &task) {
+    Worker &worker = *_workers[index];
+    std::lock_guard<std::mutex> lock(worker.mutex);
+    if(worker.tasks.empty()) {
+        return false;
+    }
+    task = std::move(worker.tasks.back());
+    worker.tasks.pop_back();
+    return true;
+}
+
+bool ThreadPool::steal(unsigned thief, Task &task) {
+    for(unsigned i = 1; i < _workers.size(); ++i) {
+        Worker &victim = *_workers[(thief + i) % _workers.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if(!victim.tasks.empty()) {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
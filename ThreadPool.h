@@ -0,0 +1,78 @@
+/// Copyright (c) 2015 Jakub Trzebiatowski
+///
+/// Licensed under the Apache License, Version 2.0 (the "License");
+/// you may not use this file except in compliance with the License.
+/// You may obtain a copy of the License at
+///
+///     http://www.apache.org/licenses/LICENSE-2.0
+///
+/// Unless required by applicable law or agreed to in writing, software
+/// distributed under the License is distributed on an "AS IS" BASIS,
+/// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+/// See the License for the specific language governing permissions and
+/// limitations under the License.
+
+#ifndef AGHSM_THREADPOOL_H
+#define AGHSM_THREADPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/// Fixed set of worker threads, each with its own task deque. A worker runs
+/// its own tasks newest first and steals the oldest tasks of other workers
+/// when it runs dry.
+class ThreadPool {
+public:
+    typedef std::function<void()> Task;
+
+    explicit ThreadPool(unsigned threads = 0);
+
+    ~ThreadPool();
+
+    /// Queues a task. Called from a worker, the task goes to that worker's
+    /// own deque; otherwise deques are filled round-robin.
+    void submit(Task task);
+
+    /// Queues a task behind every task already queued on the current
+    /// worker, so tasks that resubmit themselves take turns.
+    void yield(Task task);
+
+    /// Blocks until every submitted task, including tasks submitted by other
+    /// tasks, has finished.
+    void wait();
+
+    unsigned size() const;
+
+private:
+    struct Worker {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    void enqueue(Task task, bool last);
+
+    void workerLoop(unsigned index);
+
+    bool popLocal(unsigned index, Task &task);
+
+    bool steal(unsigned thief, Task &task);
+
+    std::vector<std::unique_ptr<Worker>> _workers;
+    std::vector<std::thread> _threads;
+    std::atomic<size_t> _queued;
+    std::atomic<size_t> _pending;
+    std::atomic<unsigned> _nextWorker;
+    std::mutex _mutex;
+    std::condition_variable _wakeUp;
+    std::condition_variable _idle;
+    bool _stopping = false;
+};
+
+
+#endif //AGHSM_THREADPOOL_H
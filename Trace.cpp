@@ -0,0 +1,176 @@
+/// Copyright (c) 2015 Jakub Trzebiatowski
+///
+/// Licensed under the Apache License, Version 2.0 (the "License");
+/// you may not use this file except in compliance with the License.
+/// You may obtain a copy of the License at
+///
+///     http://www.apache.org/licenses/LICENSE-2.0
+///
+/// Unless required by applicable law or agreed to in writing, software
+/// distributed under the License is distributed on an "AS IS" BASIS,
+/// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+/// See the License for the specific language governing permissions and
+/// limitations under the License.
+
+#include "Trace.h"
+
+#include <algorithm>
+#include <cstring>
+
+static const char traceMagic[8] = {'A', 'G', 'H', 'S', 'M', 'T', 'R', '1'};
+static const size_t chunkHeaderSize = 16;
+
+static void putUint(uint8_t *out, uint64_t value, int bytes) {
+    for(int i = 0; i < bytes; ++i) {
+        out[i] = static_cast<uint8_t>(value >> (8 * i));
+    }
+}
+
+static uint64_t getUint(const uint8_t *in, int bytes) {
+    uint64_t value = 0;
+    for(int i = 0; i < bytes; ++i) {
+        value |= static_cast<uint64_t>(in[i]) << (8 * i);
+    }
+    return value;
+}
+
+TraceRecorder::TraceRecorder(const std::string &path, size_t ringChunks)
+        : _file(path, std::ios::binary), _ringChunks(ringChunks), _chunk(chunkSize),
+          _operands(historySize), _values(historySize) {
+    if(!_file.good()) {
+        throw TraceException{"Unable to open trace file " + path};
+    }
+    _file.write(traceMagic, sizeof(traceMagic));
+}
+
+TraceRecorder::~TraceRecorder() {
+    close();
+}
+
+void TraceRecorder::close() {
+    if(!_file.is_open()) {
+        return;
+    }
+
+    flushChunk();
+    for(const std::vector<uint8_t> &chunk : _ring) {
+        _file.write(reinterpret_cast<const char *>(chunk.data()), chunk.size());
+    }
+    _ring.clear();
+    _file.close();
+}
+
+void TraceRecorder::flushChunk() {
+    if(_records == _firstRecord) {
+        return;
+    }
+
+    std::vector<uint8_t> chunk(chunkHeaderSize + _size);
+    putUint(&chunk[0], _size, 4);
+    putUint(&chunk[4], _records - _firstRecord, 4);
+    putUint(&chunk[8], _firstRecord, 8);
+    std::memcpy(&chunk[chunkHeaderSize], _chunk.data(), _size);
+
+    if(_ringChunks) {
+        _ring.push_back(std::move(chunk));
+        if(_ring.size() > _ringChunks) {
+            _ring.pop_front();
+        }
+    } else {
+        _file.write(reinterpret_cast<const char *>(chunk.data()), chunk.size());
+    }
+
+    _size = 0;
+    _firstRecord = _records;
+    resetState();
+}
+
+// Every chunk starts from the same state, so it can be decoded on its own
+
+void TraceRecorder::resetState() {
+    _nextPc = 0;
+    std::fill(_operands.begin(), _operands.end(), 0);
+    std::fill(_values.begin(), _values.end(), 0);
+}
+
+TraceReader::TraceReader(std::istream &is)
+        : _is(is), _operands(TraceRecorder::historySize), _values(TraceRecorder::historySize) {
+    char magic[sizeof(traceMagic)];
+    if(!_is.read(magic, sizeof(magic)) || std::memcmp(magic, traceMagic, sizeof(magic))) {
+        throw TraceException{"not a trace file"};
+    }
+}
+
+bool TraceReader::next(TraceRecord &record) {
+    while(!_remaining) {
+        if(!readChunk()) {
+            return false;
+        }
+    }
+
+    if(_position >= _chunk.size()) {
+        throw TraceException{"truncated trace chunk"};
+    }
+    uint8_t tag = _chunk[_position++];
+
+    record.index = _index++;
+    record.code = tag >> 4;
+    record.acu = tag >> 3 & 1;
+    record.written = tag >> 2 & 1;
+    record.pc = tag & 1 ? getDelta(_nextPc) : _nextPc;
+
+    size_t slot = static_cast<uint32_t>(record.pc) / 4 % TraceRecorder::historySize;
+    if(tag & 2) {
+        _operands[slot] = getDelta(_operands[slot]);
+    }
+    record.operand = _operands[slot];
+    if(record.written) {
+        _values[slot] = getDelta(_values[slot]);
+        record.value = _values[slot];
+    } else {
+        record.value = 0;
+    }
+
+    _nextPc = static_cast<int32_t>(static_cast<uint32_t>(record.pc) + 4);
+    --_remaining;
+    return true;
+}
+
+bool TraceReader::readChunk() {
+    uint8_t header[chunkHeaderSize];
+    if(!_is.read(reinterpret_cast<char *>(header), sizeof(header))) {
+        if(_is.gcount()) {
+            throw TraceException{"truncated trace chunk header"};
+        }
+        return false;
+    }
+
+    _chunk.resize(getUint(&header[0], 4));
+    _remaining = getUint(&header[4], 4);
+    _index = getUint(&header[8], 8);
+    if(!_is.read(reinterpret_cast<char *>(_chunk.data()), _chunk.size())) {
+        throw TraceException{"truncated trace chunk"};
+    }
+
+    _position = 0;
+    _nextPc = 0;
+    std::fill(_operands.begin(), _operands.end(), 0);
+    std::fill(_values.begin(), _values.end(), 0);
+    return true;
+}
+
+int32_t TraceReader::getDelta(int32_t previous) {
+    uint32_t zigzag = 0;
+    for(int shift = 0; ; shift += 7) {
+        if(_position >= _chunk.size() || shift > 28) {
+            throw TraceException{"malformed trace record"};
+        }
+        uint8_t byte = _chunk[_position++];
+        zigzag |= static_cast<uint32_t>(byte & 0x7f) << shift;
+        if(!(byte & 0x80)) {
+            break;
+        }
+    }
+    uint32_t delta = zigzag >> 1 ^ (0u - (zigzag & 1));
+    return static_cast<int32_t>(static_cast<uint32_t>(previous) + delta);
+}
@@ -0,0 +1,165 @@
+/// Copyright (c) 2015 Jakub Trzebiatowski
+///
+/// Licensed under the Apache License, Version 2.0 (the "License");
+/// you may not use this file except in compliance with the License.
+/// You may obtain a copy of the License at
+///
+///     http://www.apache.org/licenses/LICENSE-2.0
+///
+/// Unless required by applicable law or agreed to in writing, software
+/// distributed under the License is distributed on an "AS IS" BASIS,
+/// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+/// See the License for the specific language governing permissions and
+/// limitations under the License.
+
+#ifndef AGHSM_TRACE_H
+#define AGHSM_TRACE_H
+
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <istream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Trace file layout: the magic string, then chunks of records. Each chunk
+// starts with a 16-byte header (payload size, record count and index of the
+// first record, little-endian) and can be decoded on its own, so a ring of
+// the most recent chunks is still a valid trace.
+//
+// A record starts with a tag byte: opcode in the high nibble, then the
+// accumulator, "accumulator written", "operand changed" and "PC is not the
+// previous PC + 4" bits. The PC, the operand and the accumulator value follow
+// as zigzag varints, only when they are not implied by the tag. The PC is
+// stored relative to the previous PC + 4, the operand and the value relative
+// to the ones last recorded at the same PC, which in a loop are usually equal
+// or close. A record in a loop is usually 1-2 bytes long.
+
+class TraceException : public std::logic_error {
+public:
+    TraceException(std::string errorMessage)
+            : std::logic_error(errorMessage)
+    {}
+};
+
+struct TraceRecord {
+    uint64_t index;
+    int32_t pc;
+    unsigned code;
+    unsigned acu;
+    int32_t operand; // effective operand, OR
+    bool written; // the instruction wrote `value` to the accumulator
+    int32_t value;
+};
+
+/// Records executed instructions into a trace file.
+class TraceRecorder {
+public:
+    static const size_t chunkSize = 64 * 1024;
+
+    /// Number of PCs whose last operand and value are remembered.
+    static const size_t historySize = 4096;
+
+    /// Streams every chunk to `path`. With `ringChunks` > 0 only the last
+    /// `ringChunks` chunks are kept in memory and written by close().
+    explicit TraceRecorder(const std::string &path, size_t ringChunks = 0);
+
+    ~TraceRecorder();
+
+    void record(int32_t pc, unsigned code, unsigned acu, int32_t operand, bool written, int32_t value) {
+        if(_size > chunkSize - maxRecordSize) {
+            flushChunk();
+        }
+
+        uint8_t *out = &_chunk[_size];
+        uint8_t *tag = out++;
+        *tag = static_cast<uint8_t>(code << 4 | acu << 3 | written << 2);
+
+        if(pc != _nextPc) {
+            *tag |= pcFlag;
+            out = putDelta(out, pc, _nextPc);
+        }
+        size_t slot = historySlot(pc);
+        if(operand != _operands[slot]) {
+            *tag |= operandFlag;
+            out = putDelta(out, operand, _operands[slot]);
+            _operands[slot] = operand;
+        }
+        if(written) {
+            out = putDelta(out, value, _values[slot]);
+            _values[slot] = value;
+        }
+
+        _nextPc = pc + 4;
+        _size = out - _chunk.data();
+        ++_records;
+    }
+
+    /// Writes out everything recorded so far and closes the file.
+    void close();
+
+private:
+    static const size_t maxRecordSize = 16;
+    static const uint8_t pcFlag = 1;
+    static const uint8_t operandFlag = 2;
+
+    static size_t historySlot(int32_t pc) {
+        return static_cast<uint32_t>(pc) / 4 % historySize;
+    }
+
+    static uint8_t *putDelta(uint8_t *out, int32_t value, int32_t previous) {
+        uint32_t delta = static_cast<uint32_t>(value) - static_cast<uint32_t>(previous);
+        uint32_t zigzag = delta << 1 ^ (0u - (delta >> 31));
+        while(zigzag >= 0x80) {
+            *out++ = static_cast<uint8_t>(zigzag | 0x80);
+            zigzag >>= 7;
+        }
+        *out++ = static_cast<uint8_t>(zigzag);
+        return out;
+    }
+
+    void flushChunk();
+
+    void resetState();
+
+    std::ofstream _file;
+    size_t _ringChunks;
+    std::deque<std::vector<uint8_t>> _ring;
+
+    std::vector<uint8_t> _chunk;
+    size_t _size = 0;
+    uint64_t _records = 0;
+    uint64_t _firstRecord = 0;
+
+    int32_t _nextPc = 0;
+    std::vector<int32_t> _operands; // last operand and value at each PC
+    std::vector<int32_t> _values;
+};
+
+/// Decodes a trace file written by TraceRecorder.
+class TraceReader {
+public:
+    explicit TraceReader(std::istream &is);
+
+    /// Reads the next record, returns false at the end of the trace.
+    bool next(TraceRecord &record);
+
+private:
+    bool readChunk();
+
+    int32_t getDelta(int32_t previous);
+
+    std::istream &_is;
+    std::vector<uint8_t> _chunk;
+    size_t _position = 0;
+    uint64_t _remaining = 0;
+    uint64_t _index = 0;
+
+    int32_t _nextPc = 0;
+    std::vector<int32_t> _operands;
+    std::vector<int32_t> _values;
+};
+
+
+#endif //AGHSM_TRACE_H
@@ -0,0 +1,208 @@
+/// Copyright (c) 2015 Jakub Trzebiatowski
+///
+/// Licensed under the Apache License, Version 2.0 (the "License");
+/// you may not use this file except in compliance with the License.
+/// You may obtain a copy of the License at
+///
+///     http://www.apache.org/licenses/LICENSE-2.0
+///
+/// Unless required by applicable law or agreed to in writing, software
+/// distributed under the License is distributed on an "AS IS" BASIS,
+/// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+/// See the License for the specific language governing permissions and
+/// limitations under the License.
+
+#include "Language.h"
+#include "Trace.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <vector>
+
+static void usage() {
+	std::cerr << "Usage: aghsm_trace summary trace" << std::endl;
+	std::cerr << "       aghsm_trace dump [--pc=ADDRESS] [--op=NAME] [--from=N] [--to=N] trace" << std::endl;
+	std::cerr << "       aghsm_trace diff trace1 trace2" << std::endl;
+}
+
+static void printRecord(std::ostream &os, const TraceRecord &record) {
+	os << "#" << record.index << "  " << record.pc << ": "
+	   << (record.code < numInstructions ? instructions[record.code] : "----")
+	   << " @" << (record.acu ? 'B' : 'A') << "  OR = " << record.operand;
+	if (record.written) {
+		os << "  @" << (record.acu ? 'B' : 'A') << " = " << record.value;
+	}
+	os << std::endl;
+}
+
+static bool sameRecord(const TraceRecord &a, const TraceRecord &b) {
+	return a.pc == b.pc && a.code == b.code && a.acu == b.acu && a.operand == b.operand &&
+	       a.written == b.written && a.value == b.value;
+}
+
+static int summary(std::istream &is) {
+	TraceReader reader(is);
+	TraceRecord record;
+	uint64_t records = 0;
+	uint64_t first = 0;
+	uint64_t last = 0;
+	uint64_t branches = 0;
+	int32_t nextPc = 0;
+	std::vector<uint64_t> opcodes(16);
+	std::map<int32_t, uint64_t> pcs;
+
+	while (reader.next(record)) {
+		if (!records) {
+			first = record.index;
+		} else if (record.pc != nextPc) {
+			++branches;
+		}
+		last = record.index;
+		nextPc = record.pc + 4;
+		++records;
+		++opcodes[record.code];
+		++pcs[record.pc];
+	}
+
+	std::cout << "Records: " << records;
+	if (records) {
+		std::cout << " (#" << first << " - #" << last << ")";
+	}
+	std::cout << std::endl;
+	std::cout << "Taken jumps: " << branches << std::endl;
+
+	std::cout << std::endl << "Opcodes:" << std::endl;
+	for (int code = 0; code < 16; ++code) {
+		if (opcodes[code]) {
+			std::cout << "  " << (code < numInstructions ? instructions[code] : "----") << ": "
+			          << opcodes[code] << std::endl;
+		}
+	}
+
+	std::vector<std::pair<int32_t, uint64_t>> hottest(pcs.begin(), pcs.end());
+	std::stable_sort(hottest.begin(), hottest.end(),
+	                 [](const std::pair<int32_t, uint64_t> &a, const std::pair<int32_t, uint64_t> &b) {
+		                 return a.second > b.second;
+	                 });
+	if (hottest.size() > 10) {
+		hottest.resize(10);
+	}
+
+	std::cout << std::endl << "Most executed addresses:" << std::endl;
+	for (const auto &pc : hottest) {
+		std::cout << "  " << pc.first << ": " << pc.second << std::endl;
+	}
+	return 0;
+}
+
+static int dump(std::istream &is, int argc, char **argv) {
+	bool filterPc = false;
+	int32_t pc = 0;
+	int code = -1;
+	uint64_t from = 0;
+	uint64_t to = UINT64_MAX;
+
+	for (int i = 0; i < argc; ++i) {
+		if (!std::strncmp(argv[i], "--pc=", 5)) {
+			filterPc = true;
+			pc = std::atoi(argv[i] + 5);
+		} else if (!std::strncmp(argv[i], "--op=", 5)) {
+			for (int c = 0; c < numInstructions; ++c) {
+				if (!std::strcmp(argv[i] + 5, instructions[c])) {
+					code = c;
+				}
+			}
+			if (code < 0) {
+				std::cerr << "Unknown instruction " << argv[i] + 5 << std::endl;
+				return 1;
+			}
+		} else if (!std::strncmp(argv[i], "--from=", 7)) {
+			from = std::strtoull(argv[i] + 7, nullptr, 10);
+		} else if (!std::strncmp(argv[i], "--to=", 5)) {
+			to = std::strtoull(argv[i] + 5, nullptr, 10);
+		} else {
+			usage();
+			return 1;
+		}
+	}
+
+	TraceReader reader(is);
+	TraceRecord record;
+	while (reader.next(record)) {
+		if (record.index < from || record.index > to) {
+			continue;
+		}
+		if ((filterPc && record.pc != pc) || (code >= 0 && record.code != static_cast<unsigned>(code))) {
+			continue;
+		}
+		printRecord(std::cout, record);
+	}
+	return 0;
+}
+
+static int diff(std::istream &is1, std::istream &is2) {
+	TraceReader reader1(is1);
+	TraceReader reader2(is2);
+	TraceRecord record1;
+	TraceRecord record2;
+	uint64_t records = 0;
+
+	for (;;) {
+		bool more1 = reader1.next(record1);
+		bool more2 = reader2.next(record2);
+
+		if (!more1 && !more2) {
+			std::cout << "Traces are identical (" << records << " records)" << std::endl;
+			return 0;
+		}
+		if (!more1 || !more2) {
+			std::cout << "Trace " << (more1 ? 2 : 1) << " ends after " << records << " records" << std::endl;
+			printRecord(std::cout, more1 ? record1 : record2);
+			return 1;
+		}
+		if (!sameRecord(record1, record2)) {
+			std::cout << "Traces diverge after " << records << " records" << std::endl;
+			printRecord(std::cout, record1);
+			printRecord(std::cout, record2);
+			return 1;
+		}
+		++records;
+	}
+}
+
+int main(int argc, char **argv) {
+	if (argc < 3) {
+		usage();
+		return 1;
+	}
+
+	std::ifstream ifs(argv[argc - 1], std::ios::binary);
+	if (!ifs.good()) {
+		std::cerr << "Unable to open file" << std::endl;
+		return 1;
+	}
+
+	try {
+		if (!std::strcmp(argv[1], "summary") && argc == 3) {
+			return summary(ifs);
+		} else if (!std::strcmp(argv[1], "dump")) {
+			return dump(ifs, argc - 3, argv + 2);
+		} else if (!std::strcmp(argv[1], "diff") && argc == 4) {
+			std::ifstream first(argv[2], std::ios::binary);
+			if (!first.good()) {
+				std::cerr << "Unable to open file" << std::endl;
+				return 1;
+			}
+			return diff(first, ifs);
+		}
+	} catch (std::exception &e) {
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
+
+	usage();
+	return 1;
+}
@@ -13,47 +13,415 @@
 /// limitations under the License.
 
 #include "VM.h"
+#include "Jit.h"
 #include "Language.h"
 
+#include <algorithm>
+#include <limits>
+
+#if defined(__GNUC__)
+#define AGHSM_COMPUTED_GOTO 1
+#define AGHSM_LIKELY(x) __builtin_expect(!!(x), 1)
+#define AGHSM_UNLIKELY(x) __builtin_expect(!!(x), 0)
+#else
+#define AGHSM_COMPUTED_GOTO 0
+#define AGHSM_LIKELY(x) (x)
+#define AGHSM_UNLIKELY(x) (x)
+#endif
+
+// Decoded handler indices. Every (opcode, addressing mode) pair gets its own
+// handler, so the effective address computation is resolved at decode time.
+
+static constexpr int decodedHandler(int code, int mod) {
+    return code * 3 + mod;
+}
+
+// Superinstructions: common instruction sequences executed by a single
+// handler. (opcode, addressing mode) for each instruction of the sequence.
+
+#define FUSED_INSTRUCTIONS(X3, X2) \
+    X3(Load, 0, Add, 0, Store, 0) \
+    X3(Load, 0, Add, 1, Store, 0) \
+    X3(Load, 1, Add, 0, Store, 0) \
+    X3(Load, 1, Add, 1, Store, 0) \
+    X3(Load, 0, Sub, 0, Store, 0) \
+    X3(Load, 0, Sub, 1, Store, 0) \
+    X3(Load, 1, Sub, 0, Store, 0) \
+    X3(Load, 1, Sub, 1, Store, 0) \
+    X3(Load, 1, Sub, 0, Jzero, 0) \
+    X3(Load, 1, Sub, 1, Jzero, 0) \
+    X3(Load, 1, Sub, 0, Jnzero, 0) \
+    X3(Load, 1, Sub, 1, Jnzero, 0) \
+    X3(Load, 1, Sub, 0, Jpos, 0) \
+    X3(Load, 1, Sub, 1, Jpos, 0) \
+    X3(Load, 1, Sub, 0, Jneg, 0) \
+    X3(Load, 1, Sub, 1, Jneg, 0) \
+    X2(Load, 0, Jzero, 0) \
+    X2(Load, 1, Jzero, 0) \
+    X2(Load, 0, Jnzero, 0) \
+    X2(Load, 1, Jnzero, 0) \
+    X2(Load, 0, Jpos, 0) \
+    X2(Load, 1, Jpos, 0) \
+    X2(Load, 0, Jneg, 0) \
+    X2(Load, 1, Jneg, 0)
+
+#define FUSED_NAME3(a, am, b, bm, c, cm, suffix) a##am##b##bm##c##cm##suffix
+#define FUSED_NAME2(a, am, b, bm, suffix) a##am##b##bm##suffix
+
+enum {
+    DecodeHandler = numInstructions * 3, // slot invalidated by a store, decode on next dispatch
+    FaultHandler, // instruction the reference engine would reject
+    UnverifiedHandler, // instruction whose static address is not a word of the program
+    EndHandler, // sentinel past the last word of the program
+    FirstFusedHandler,
+    FusedHandlerBase = FirstFusedHandler - 1,
+#define FUSED_ENUM3(a, am, b, bm, c, cm) FUSED_NAME3(a, am, b, bm, c, cm, Handler),
+#define FUSED_ENUM2(a, am, b, bm) FUSED_NAME2(a, am, b, bm, Handler),
+    FUSED_INSTRUCTIONS(FUSED_ENUM3, FUSED_ENUM2)
+#undef FUSED_ENUM3
+#undef FUSED_ENUM2
+    HandlerCount
+};
+
+struct FusedInstruction {
+    int length;
+    int code[3];
+    int mod[3];
+    int handler;
+};
+
+static const FusedInstruction fusedInstructions[] = {
+#define FUSED_ENTRY3(a, am, b, bm, c, cm) \
+    {3, {a##Instruction, b##Instruction, c##Instruction}, {am, bm, cm}, FUSED_NAME3(a, am, b, bm, c, cm, Handler)},
+#define FUSED_ENTRY2(a, am, b, bm) \
+    {2, {a##Instruction, b##Instruction, 0}, {am, bm, 0}, FUSED_NAME2(a, am, b, bm, Handler)},
+    FUSED_INSTRUCTIONS(FUSED_ENTRY3, FUSED_ENTRY2)
+#undef FUSED_ENTRY3
+#undef FUSED_ENTRY2
+};
+
+// Instructions executed between checks of the time limit and of the output
+// delay, a few milliseconds
+static const uint64_t timeCheckInterval = 1 << 20;
+
+// Instructions the threaded interpreter runs for the JIT before handing back
+static const uint64_t interpretedSlice = 1 << 14;
+
+// Addresses are signed, so the address space ends at 2 GiB
+static const uint64_t maxAddressSpace = uint64_t(1) << 31;
+
+// Decoded slots in front of the first word, so a store can look back at the
+// heads of superinstructions covering it without bounds checks
+static const size_t guardSlots = 2;
+
+static inline bool isValidAddress(int32_t address, uint32_t memorySize) {
+    return static_cast<uint32_t>(address) < memorySize && !(address & 3);
+}
+
+// Whether the address an instruction uses, if it is known before the
+// instruction runs, is a word of the program: the operand of mod 1 and 2,
+// and the target of mod 0 stores and jumps. The threaded engine then skips
+// checking it.
+static inline bool hasVerifiedAddress(Instruction inst, uint32_t memorySize) {
+    InstructionEffect effect = isa[inst.code].effect;
+    if(inst.mod == 0 && effect != StoreEffect && effect != BranchEffect) {
+        return true;
+    }
+    return isValidAddress(inst.adr, memorySize);
+}
+
+// Division by zero and INT_MIN / -1 trap on x86, every engine rejects them
+static inline bool isValidDivision(int32_t dividend, int32_t divisor) {
+    return divisor != 0 && !(divisor == -1 && dividend == std::numeric_limits<int32_t>::min());
+}
+
+// Traces record these instructions after they execute, together with the
+// new accumulator value, and every other instruction before it executes
+static inline constexpr bool writesAccumulator(unsigned code) {
+    return code < numInstructions && isa[code].accumulator == WritesAccumulator;
+}
+
 VM::VM() {
 
 }
 
+VM::~VM() {
+
+}
+
+void VM::setEngine(Engine engine) {
+    _engine = engine;
+}
+
+void VM::setOutputSink(OutputSink &sink) {
+    _output = &sink;
+}
+
+void VM::setProfile(Profile *profile) {
+    _profile = profile;
+}
+
+void VM::setTrace(TraceRecorder *trace) {
+    _trace = trace;
+}
+
+void VM::setLimits(Limits limits) {
+    _limits = limits;
+}
+
 void VM::load(std::vector<Word> program) {
-    _program = program;
+    _program = std::move(program);
+    load(_program.data(), _program.size());
+}
+
+void VM::load(Word *memory, size_t words) {
+    _memory = memory;
+    _memorySize = words;
+    _decoded.clear();
+    _jitAttached = false;
 }
 
 void VM::run() {
+    reset();
+    while(runFor(std::numeric_limits<uint64_t>::max())) {
+    }
+}
+
+void VM::reset() {
     RR.run = 1;
     IR = {0};
     OR = 0;
     PC = 0;
     A = 0;
     B = 0;
+    _AC = nullptr;
+    _instructionCount = 0;
+    _elapsed = std::chrono::steady_clock::duration::zero();
+    _flushedAt = _elapsed;
+
+    // Self-modifying code may have changed the decoded program
+    _decoded.clear();
+    _jitAttached = false;
+
+    if(_profile) {
+        _profile->reset(_memorySize);
+    }
+
+    // Memory past the program starts zeroed on every run, and untouched
+    // pages of it cost nothing
+    _sparse.reset();
+    uint64_t addressSpace = std::min(_limits.memory, maxAddressSpace) / 4;
+    if(addressSpace > _memorySize) {
+        _sparse.reset(new SparseMemory(addressSpace - _memorySize));
+    }
 
     PC = word(0).data;
+}
+
+// Limits are checked, and output which must not wait is flushed, between
+// slices of the budget, so the engines only see a smaller budget. They check
+// it per dispatch or per basic block anyway.
+
+bool VM::runFor(uint64_t instructions) {
+    const std::chrono::milliseconds maxDelay = _output->maxDelay();
+    while(RR.run && instructions) {
+        uint64_t slice = instructions;
+        if(_limits.instructions) {
+            if(_instructionCount >= _limits.instructions) {
+                limitExceeded("instruction limit exceeded");
+            }
+            slice = std::min(slice, _limits.instructions - _instructionCount);
+        }
+        if(_limits.time.count() || maxDelay.count()) {
+            slice = std::min(slice, timeCheckInterval);
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        runEngine(slice);
+        _elapsed += std::chrono::steady_clock::now() - start;
+        instructions -= slice;
 
-    while(RR.run) {
-        //print(std::cout);
-        loadNextInstruction();
-        computeEffectiveAddress();
-        executeNextInstruction();
+        if(RR.run && _limits.time.count() && _elapsed >= _limits.time) {
+            limitExceeded("time limit exceeded");
+        }
+        if(RR.run && maxDelay.count() && _elapsed - _flushedAt >= maxDelay) {
+            _output->flush();
+            _flushedAt = _elapsed;
+        }
+    }
+
+    return RR.run;
+}
+
+void VM::runEngine(uint64_t instructions) {
+    try {
+        switch(_profile ? ReferenceEngine : _engine) {
+            case ThreadedEngine:
+                if(_trace) {
+                    runThreaded<true>(instructions);
+                } else {
+                    runThreaded<false>(instructions);
+                }
+                break;
+            case JitEngine:
+                if(_trace) {
+                    runThreaded<true>(instructions);
+                } else {
+                    runJit(instructions);
+                }
+                break;
+            default:
+                runReference(instructions);
+                break;
+        }
+    } catch(...) {
+        _output->flush();
+        throw;
+    }
+
+    if(!RR.run) {
+        _output->flush();
+    }
+}
+
+void VM::limitExceeded(const char *errorMessage) {
+    _output->flush();
+    throw LimitException{errorMessage};
+}
+
+bool VM::step() {
+    if(RR.run) {
+        referenceStep();
+    }
+    return RR.run;
+}
+
+bool VM::isRunning() const {
+    return RR.run;
+}
+
+uint64_t VM::instructionCount() const {
+    return _instructionCount;
+}
+
+void VM::runReference(uint64_t instructions) {
+    for(uint64_t i = 0; i < instructions && RR.run; ++i) {
+        referenceStep();
+    }
+}
+
+void VM::referenceStep() {
+    int32_t pc = PC;
+
+    loadNextInstruction();
+    computeEffectiveAddress();
+    if(_profile) {
+        profileStep(pc);
+    }
+    if(_trace && IR.code <= DumpInstruction && !writesAccumulator(IR.code)) {
+        _trace->record(pc, IR.code, IR.acu, OR, false, 0);
+    }
+    executeNextInstruction();
+    ++_instructionCount;
+    if(_trace && writesAccumulator(IR.code)) {
+        _trace->record(pc, IR.code, IR.acu, OR, true, IR.acu ? B : A);
+    }
+
+    if(IR.code == StoreInstruction) {
+        invalidate(static_cast<uint32_t>(OR) / 4);
+    }
+}
+
+// Counts the instruction fetched from `pc`, before it is executed, so that
+// its operands and the accumulator it tests are still the ones it sees.
+
+void VM::profileStep(int32_t pc) {
+    Profile &profile = *_profile;
+    size_t index = static_cast<uint32_t>(pc) / 4;
+
+    ++profile.instructions;
+    ++profile.executions[index];
+    if(IR.code < profile.opcodeExecutions.size()) {
+        ++profile.opcodeExecutions[IR.code];
+    }
+
+    // Reads of memory past the program are not counted
+    if(IR.mod >= 1 && static_cast<uint32_t>(IR.adr) / 4 < _memorySize) {
+        ++profile.reads[IR.adr / 4];
+    }
+    if(IR.mod == 2) {
+        uint32_t index = static_cast<uint32_t>(Mem(IR.adr)) / 4;
+        if(index < _memorySize) {
+            ++profile.reads[index];
+        }
+    }
+
+    if(IR.code >= numInstructions) {
+        return;
+    }
+    if(isa[IR.code].effect == StoreEffect && isValidAddress(OR, _memorySize * 4)) {
+        ++profile.writes[OR / 4];
+    }
+    if(isa[IR.code].effect == BranchEffect) {
+        int32_t AC = _AC ? *_AC : 0;
+        profile.taken[index] += evaluateInstruction(IR.code, AC, OR) != 0;
+    }
+}
+
+// Drops whatever the threaded engine and the JIT derived from a word that
+// has just been overwritten.
+
+void VM::invalidate(uint32_t wordIndex) {
+    if(wordIndex >= _memorySize) {
+        return;
+    }
+    if(!_decoded.empty()) {
+        DecodedInstruction *stored = &_decoded[guardSlots + wordIndex];
+        stored[0].handler = DecodeHandler;
+        if(stored[-1].handler >= FirstFusedHandler) stored[-1].handler = DecodeHandler;
+        if(stored[-2].handler >= FirstFusedHandler) stored[-2].handler = DecodeHandler;
+    }
+    if(_jit && _jitAttached) {
+        _jit->invalidate(wordIndex);
     }
 }
 
 void VM::print(std::ostream &os) {
-    os << "< " << "@PC = " << PC << " @A = " << A << " @B = " << B << " >" << std::endl;
-    printProgram(os, _program);
+    std::string text;
+    printState(text);
+    os << text << std::flush;
+}
+
+void VM::printState(std::string &text) {
+    text += "< @PC = " + std::to_string(PC) + " @A = " + std::to_string(A) +
+            " @B = " + std::to_string(B) + " >\n";
+    printProgram(text, _memory, _memorySize);
+}
+
+void VM::dump() {
+    std::string text;
+    printState(text);
+    _output->write(text);
 }
 
 Word &VM::word(unsigned address) {
     if(address % 4) {
         throw VMException{"unaligned memory access"};
     }
-    if(address / 4 >= _program.size()) {
+    if(address / 4 >= _memorySize) {
+        if(_sparse && address / 4 - _memorySize < _sparse->size()) {
+            return _sparse->at(address / 4 - _memorySize);
+        }
+        throw VMException{"out of program memory access"};
+    }
+    return _memory[address / 4];
+}
+
+Word &VM::codeWord(unsigned address) {
+    if(address % 4 == 0 && address / 4 >= _memorySize) {
         throw VMException{"out of program memory access"};
     }
-    return _program[address / 4];
+    return word(address);
 }
 
 int32_t &VM::Mem(unsigned address) {
@@ -61,7 +429,7 @@ int32_t &VM::Mem(unsigned address) {
 }
 
 void VM::loadNextInstruction() {
-    IR = word(PC).instruction;
+    IR = codeWord(PC).instruction;
     PC += 4;
 }
 
@@ -82,75 +450,473 @@ void VM::computeEffectiveAddress() {
 }
 
 void VM::executeNextInstruction() {
-    std::string name = instructions[IR.code];
+    switch(IR.code) {
+#define EXECUTE(name, mnemonic, form, accumulator, effect, semantics) \
+        case name##Instruction: \
+            execute<name##Instruction>(); \
+            return;
+        AGHSM_ISA(EXECUTE)
+#undef EXECUTE
+    }
+
+    throw VMException{"unrecognized instruction"};
+}
+
+// The effect of the instruction selects the branch at compile time, the rest
+// are dead code
 
-    {
+template<int Code>
+void VM::execute() {
+    const InstructionEffect effect = isa[Code].effect;
+
+    if(effect == BranchEffect) {
         int32_t AC = _AC ? *_AC : 0;
+        if(Semantics<Code>::evaluate(AC, OR)) {
+            PC = OR;
+        }
+        return;
+    }
 
-        switch(IR.code) {
-            case JumpInstruction:
-                PC = OR;
-                return;
-            case JzeroInstruction:
-                if (AC == 0) PC = OR;
-                return;
-            case JnzeroInstruction:
-                if (AC != 0) PC = OR;
-                return;
-            case JposInstruction:
-                if (AC > 0) PC = OR;
-                return;
-            case JnegInstruction:
-                if (AC < 0) PC = OR;
-                return;
+    int32_t &AC = IR.acu == 0 ? A : B;
+
+    switch(effect) {
+        case HaltEffect:
+            RR.run = 0;
+            return;
+        case ComputeEffect:
+            if(Code == DivInstruction && !isValidDivision(AC, OR)) {
+                throw VMException{OR == 0 ? "division by zero" : "division overflow"};
+            }
+            AC = Semantics<Code>::evaluate(AC, OR);
+            _AC = &AC;
+            return;
+        case StoreEffect:
+            Mem(OR) = AC;
+            _AC = &AC;
+            return;
+        case PrintEffect:
+            _output->writeLine(IR.usr ? OR : AC);
+            return;
+        case DumpEffect:
+            dump();
+            return;
+        default:
+            return;
+    }
+}
+
+// Next to the JIT only the code actually run is decoded, since the JIT has
+// to report stores to every decoded word.
+
+void VM::decodeProgram() {
+    _decoded.resize(guardSlots + _memorySize + 1);
+    for(size_t i = 0; i < guardSlots; ++i) {
+        _decoded[i] = DecodedInstruction{EndHandler, 0, 0, 0};
+    }
+    for(size_t i = 0; i < _memorySize; ++i) {
+        if(_jitAttached) {
+            _decoded[guardSlots + i] = DecodedInstruction{DecodeHandler, 0, 0, 0};
+        } else {
+            decodeInstruction(i);
         }
     }
+    _decoded.back() = DecodedInstruction{EndHandler, 0, 0, 0};
+}
 
-    {
-        int32_t &AC = IR.acu == 0 ? A : B;
+// Decodes the word at `index` and, if it starts a known sequence, turns the
+// slot into the head of a superinstruction. The following slots keep their
+// own handlers so that jumps into the middle of the sequence still work.
 
-        switch(IR.code) {
-            case NullInstruction:
-                return;
-            case HaltInstruction:
-                RR.run = 0;
-                return;
-            case LoadInstruction:
-                AC = OR;
-                _AC = &AC;
-                return;
-            case StoreInstruction:
-                Mem(OR) = AC;
-                _AC = &AC;
-                return;
-            case AddInstruction:
-                AC = AC + OR;
-                _AC = &AC;
-                return;
-            case SubInstruction:
-                AC = AC - OR;
-                _AC = &AC;
-                return;
-            case MultInstruction:
-                AC = AC * OR;
-                _AC = &AC;
-                return;
-            case DivInstruction:
-                AC = AC / OR;
-                _AC = &AC;
-                return;
-            case PrintInstruction:
-                if(IR.usr) {
-                    std::cout << OR << std::endl;
-                } else {
-                    std::cout << AC << std::endl;
+void VM::decodeInstruction(size_t index) {
+    DecodedInstruction *decoded = &_decoded[guardSlots + index];
+    Instruction inst = _memory[index].instruction;
+
+    if(_jitAttached) {
+        _jit->markDecoded(index);
+    }
+
+    if(inst.code >= numInstructions || inst.mod == 3) {
+        decoded->handler = FaultHandler;
+    } else if(!hasVerifiedAddress(inst, _memorySize * 4)) {
+        decoded->handler = UnverifiedHandler;
+    } else {
+        decoded->handler = decodedHandler(inst.code, inst.mod);
+    }
+    decoded->acu = inst.acu;
+    decoded->usr = inst.usr;
+    decoded->operand = inst.adr;
+
+    for(const FusedInstruction &fused : fusedInstructions) {
+        if(index + fused.length > _memorySize) {
+            continue;
+        }
+
+        bool matches = true;
+        for(int i = 0; i < fused.length && matches; ++i) {
+            Instruction next = _memory[index + i].instruction;
+            matches = next.code == fused.code[i] && next.mod == fused.mod[i] &&
+                      hasVerifiedAddress(next, _memorySize * 4);
+        }
+
+        if(matches) {
+            // The superinstruction reads the operands of the following slots
+            for(int i = 1; i < fused.length; ++i) {
+                Instruction next = _memory[index + i].instruction;
+                if(_jitAttached) {
+                    _jit->markDecoded(index + i);
                 }
+                decoded[i].acu = next.acu;
+                decoded[i].usr = next.usr;
+                decoded[i].operand = next.adr;
+            }
+            decoded->handler = fused.handler;
+            return;
+        }
+    }
+}
+
+// Direct-threaded interpreter over the decoded program. Registers live in
+// locals and are written back to the VM only when something outside the loop
+// can observe them (dump, halt, exceptions, running out of instructions). A store invalidates the decoded
+// slot it lands on, and any superinstruction covering it, so self-modifying
+// code is re-decoded on its next dispatch. Addresses verified by the decoder
+// are used without checks; only addresses computed at run time are checked.
+
+template<bool Traced>
+void VM::runThreaded(uint64_t instructions) {
+    if(_decoded.empty()) {
+        decodeProgram();
+    }
+
+    Word *memory = _memory;
+    const uint32_t memorySize = _memorySize * 4;
+    DecodedInstruction *decoded = _decoded.data() + guardSlots;
+    const DecodedInstruction *slot;
+
+    // Code the JIT translated, or has to report stores to, while both run
+    const uint8_t *jitCode = _jitAttached ? _jit->codeMap() : nullptr;
+
+    // ac[2] stands in for the null accumulator and always reads as zero
+    int32_t ac[3] = {A, B, 0};
+    unsigned lastAc = _AC == &A ? 0 : _AC == &B ? 1 : 2;
+    uint32_t pc;
+    int32_t operand;
+    int32_t *cell;
+
+    // Every dispatch consumes one unit of fuel
+    const int64_t initialFuel = static_cast<int64_t>(
+            std::min<uint64_t>(instructions, std::numeric_limits<int64_t>::max()));
+    const uint64_t initialCount = _instructionCount;
+    int64_t fuel = initialFuel;
+
+#define SYNC_STATE(nextPc) \
+    do { \
+        _instructionCount = initialCount + (initialFuel - fuel); \
+        PC = (nextPc) * 4; \
+        A = ac[0]; \
+        B = ac[1]; \
+        _AC = lastAc == 0 ? &A : lastAc == 1 ? &B : nullptr; \
+    } while(0)
+
+    // State at an instruction which may fault. Its dispatch already paid for
+    // it, but like in the reference engine it only counts once it completes.
+#define SYNC_FAULT(nextPc) \
+    do { \
+        ++fuel; \
+        SYNC_STATE(nextPc); \
+        --fuel; \
+    } while(0)
+
+#define MEMORY_CELL(address) \
+    do { \
+        int32_t address_ = (address); \
+        if(AGHSM_UNLIKELY(!isValidAddress(address_, memorySize))) { \
+            SYNC_FAULT(pc + 1); \
+            cell = &Mem(address_); \
+        } else { \
+            cell = &memory[static_cast<uint32_t>(address_) >> 2].data; \
+        } \
+    } while(0)
+
+#define VERIFIED_CELL(address) cell = &memory[static_cast<uint32_t>(address) >> 2].data
+
+#define OPERAND_0 operand = slot->operand;
+#define OPERAND_1 VERIFIED_CELL(slot->operand); operand = *cell;
+#define OPERAND_2 VERIFIED_CELL(slot->operand); MEMORY_CELL(*cell); operand = *cell;
+
+#if AGHSM_COMPUTED_GOTO
+#define REDISPATCH() \
+    do { \
+        slot = &decoded[pc]; \
+        goto *dispatchTable[slot->handler]; \
+    } while(0)
+#else
+#define REDISPATCH() goto dispatch
+#endif
+
+#define DISPATCH() \
+    do { \
+        if(AGHSM_UNLIKELY(--fuel < 0)) goto outOfFuel; \
+        REDISPATCH(); \
+    } while(0)
+
+#define NEXT() \
+    do { \
+        ++pc; \
+        DISPATCH(); \
+    } while(0)
+
+// Fetching from an invalid jump target faults, but only if the budget allows
+// one more instruction; otherwise the limit is reported first
+
+#define JUMP(target) \
+    do { \
+        int32_t target_ = (target); \
+        if(AGHSM_UNLIKELY(!isValidAddress(target_, memorySize))) { \
+            SYNC_STATE(pc + 1); \
+            PC = target_; \
+            if(fuel == 0) return; \
+            codeWord(PC); \
+        } \
+        pc = static_cast<uint32_t>(target_) >> 2; \
+        DISPATCH(); \
+    } while(0)
+
+#define VERIFIED_JUMP(target) \
+    do { \
+        pc = static_cast<uint32_t>(target) >> 2; \
+        DISPATCH(); \
+    } while(0)
+
+    // Same as VM::invalidate() for the decoded program
+#define INVALIDATE(index) \
+    do { \
+        uint32_t index_ = (index); \
+        DecodedInstruction *stored_ = &decoded[index_]; \
+        stored_[0].handler = DecodeHandler; \
+        if(stored_[-1].handler >= FirstFusedHandler) stored_[-1].handler = DecodeHandler; \
+        if(stored_[-2].handler >= FirstFusedHandler) stored_[-2].handler = DecodeHandler; \
+        if(AGHSM_UNLIKELY(jitCode && jitCode[index_])) _jit->invalidate(index_); \
+    } while(0)
+
+    // Instruction semantics, shared by plain handlers and superinstructions.
+    // The effect of `op` is a constant, so only its own branch is compiled in.
+
+#define BODY(op, mod) { \
+        const InstructionEffect effect_ = isa[op##Instruction].effect; \
+        if(effect_ == HaltEffect) { \
+            SYNC_STATE(pc + 1); \
+            RR.run = 0; \
+            return; \
+        } else if(effect_ == ComputeEffect) { \
+            if(op##Instruction == DivInstruction && \
+               AGHSM_UNLIKELY(!isValidDivision(ac[slot->acu], operand))) goto FaultTarget; \
+            ac[slot->acu] = Semantics<op##Instruction>::evaluate(ac[slot->acu], operand); \
+            lastAc = slot->acu; \
+        } else if(effect_ == StoreEffect) { \
+            if(mod == 0) VERIFIED_CELL(operand); else MEMORY_CELL(operand); \
+            *cell = ac[slot->acu]; \
+            lastAc = slot->acu; \
+            if(AGHSM_LIKELY(static_cast<uint32_t>(operand) < memorySize)) INVALIDATE(static_cast<uint32_t>(operand) >> 2); \
+        } else if(effect_ == BranchEffect) { \
+            if(Semantics<op##Instruction>::evaluate(ac[lastAc], operand)) { \
+                if(mod == 0) VERIFIED_JUMP(operand); else JUMP(operand); \
+            } \
+        } else if(effect_ == PrintEffect) { \
+            _output->writeLine(slot->usr ? operand : ac[slot->acu]); \
+        } else if(effect_ == DumpEffect) { \
+            SYNC_STATE(pc + 1); \
+            dump(); \
+        } \
+    }
+
+#define TRACE(op, written) \
+    _trace->record(pc * 4, op##Instruction, slot->acu, operand, written, ac[slot->acu])
+
+#define STEP(op, mod) { \
+        OPERAND_##mod \
+        if(Traced && !writesAccumulator(op##Instruction)) TRACE(op, false); \
+        BODY(op, mod) \
+        if(Traced && writesAccumulator(op##Instruction)) TRACE(op, true); \
+    }
+
+#define ADVANCE() \
+    do { \
+        ++pc; \
+        slot = &decoded[pc]; \
+    } while(0)
+
+#define TARGET(op, mod) case decodedHandler(op##Instruction, mod): op##mod##Target
+
+#define HANDLER(op, mnemonic, form, accumulator, effect, semantics) \
+    TARGET(op, 0): STEP(op, 0) NEXT(); \
+    TARGET(op, 1): STEP(op, 1) NEXT(); \
+    TARGET(op, 2): STEP(op, 2) NEXT();
+
+// Superinstructions fall back to the plain handler of their first
+// instruction when there is not enough fuel left for the whole sequence, and
+// always while tracing, so that every instruction gets its own record
+
+#define FUSED_HANDLER3(a, am, b, bm, c, cm) \
+    case FUSED_NAME3(a, am, b, bm, c, cm, Handler): \
+    FUSED_NAME3(a, am, b, bm, c, cm, Target): \
+        if(Traced || AGHSM_UNLIKELY(fuel < 2)) goto a##am##Target; \
+        fuel -= 2; \
+        STEP(a, am) ADVANCE(); STEP(b, bm) ADVANCE(); STEP(c, cm) NEXT();
+
+#define FUSED_HANDLER2(a, am, b, bm) \
+    case FUSED_NAME2(a, am, b, bm, Handler): \
+    FUSED_NAME2(a, am, b, bm, Target): \
+        if(Traced || AGHSM_UNLIKELY(fuel < 1)) goto a##am##Target; \
+        fuel -= 1; \
+        STEP(a, am) ADVANCE(); STEP(b, bm) NEXT();
+
+#define HANDLER_ADDRESSES(op, mnemonic, form, accumulator, effect, semantics) \
+    &&op##0##Target, &&op##1##Target, &&op##2##Target,
+#define FUSED_ADDRESS3(a, am, b, bm, c, cm) &&FUSED_NAME3(a, am, b, bm, c, cm, Target),
+#define FUSED_ADDRESS2(a, am, b, bm) &&FUSED_NAME2(a, am, b, bm, Target),
+
+#if AGHSM_COMPUTED_GOTO
+    static const void *const dispatchTable[] = {
+            AGHSM_ISA(HANDLER_ADDRESSES)
+            &&DecodeTarget,
+            &&FaultTarget,
+            &&UnverifiedTarget,
+            &&EndTarget,
+            FUSED_INSTRUCTIONS(FUSED_ADDRESS3, FUSED_ADDRESS2)
+    };
+    static_assert(sizeof(dispatchTable) / sizeof(dispatchTable[0]) == HandlerCount,
+                  "dispatch table does not cover every instruction");
+#endif
+
+    pc = 0;
+    JUMP(PC);
+
+#if !AGHSM_COMPUTED_GOTO
+dispatch:
+    slot = &decoded[pc];
+#endif
+    switch(slot->handler) {
+        AGHSM_ISA(HANDLER)
+        FUSED_INSTRUCTIONS(FUSED_HANDLER3, FUSED_HANDLER2)
+        case DecodeHandler:
+        DecodeTarget: {
+            decodeInstruction(pc);
+            REDISPATCH();
+        }
+        case FaultHandler:
+        FaultTarget: {
+            // Let the reference engine report the error
+            SYNC_FAULT(pc);
+            loadNextInstruction();
+            computeEffectiveAddress();
+            executeNextInstruction();
+            throw VMException{"unrecognized instruction"};
+        }
+        case UnverifiedHandler:
+        UnverifiedTarget: {
+            // Its address may still be in memory past the program; the
+            // reference engine either executes it or reports the error, and
+            // counts it.
+            SYNC_FAULT(pc);
+            referenceStep();
+            ac[0] = A;
+            ac[1] = B;
+            lastAc = _AC == &A ? 0 : _AC == &B ? 1 : 2;
+            if(!RR.run) {
                 return;
-            case DumpInstruction:
-                this->print(std::cout);
-                return;
+            }
+            JUMP(PC);
+        }
+        case EndHandler:
+        EndTarget: {
+            SYNC_FAULT(pc);
+            codeWord(PC);
+            throw VMException{"out of program memory access"};
         }
     }
 
     throw VMException{"unrecognized instruction"};
+
+outOfFuel:
+    fuel = 0;
+    SYNC_STATE(pc);
+
+#undef SYNC_STATE
+#undef SYNC_FAULT
+#undef MEMORY_CELL
+#undef VERIFIED_CELL
+#undef OPERAND_0
+#undef OPERAND_1
+#undef OPERAND_2
+#undef REDISPATCH
+#undef DISPATCH
+#undef NEXT
+#undef JUMP
+#undef VERIFIED_JUMP
+#undef INVALIDATE
+#undef BODY
+#undef TRACE
+#undef STEP
+#undef ADVANCE
+#undef TARGET
+#undef HANDLER
+#undef FUSED_HANDLER3
+#undef FUSED_HANDLER2
+#undef HANDLER_ADDRESSES
+#undef FUSED_ADDRESS3
+#undef FUSED_ADDRESS2
+}
+
+// Runs translated code and drops into the reference interpreter for one
+// instruction whenever the JIT gives up (halt, print, dump, faults) or the
+// remaining budget does not cover the next block. Code rewritten too often to
+// be worth translating runs on the threaded interpreter, a slice at a time.
+
+void VM::runJit(uint64_t instructions) {
+    if(!_jit) {
+        _jit.reset(new Jit);
+    }
+    if(!_jit->isAvailable()) {
+        runThreaded<false>(instructions);
+        return;
+    }
+
+    if(!_jitAttached) {
+        _jit->attach(_memory, _memorySize);
+        _jitAttached = true;
+    }
+
+    Jit::State state;
+    state.memory = _memory;
+    state.memorySize = _memorySize * 4;
+    state.budget = static_cast<int64_t>(
+            std::min<uint64_t>(instructions, std::numeric_limits<int64_t>::max()));
+
+    while(RR.run && state.budget > 0) {
+        state.pc = PC;
+        state.A = A;
+        state.B = B;
+        state.lastAc = _AC == &A ? 0 : _AC == &B ? 1 : 2;
+
+        int64_t budget = state.budget;
+        Jit::ExitReason reason = _jit->execute(state);
+        _instructionCount += budget - state.budget;
+
+        PC = state.pc;
+        A = state.A;
+        B = state.B;
+        _AC = state.lastAc == 0 ? &A : state.lastAc == 1 ? &B : nullptr;
+
+        if(reason == Jit::InvalidateExit) {
+            invalidate(state.invalidatedWord);
+        } else if(reason == Jit::SelfModifyingExit && state.budget > 0) {
+            uint64_t count = _instructionCount;
+            runThreaded<false>(std::min<uint64_t>(state.budget, interpretedSlice));
+            state.budget -= _instructionCount - count;
+        } else if(state.budget > 0) {
+            referenceStep();
+            --state.budget;
+        }
+    }
 }
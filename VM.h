@@ -16,6 +16,16 @@
 #define AGHSM_VM_H
 
 #include "CodeEmitter.h"
+#include "OutputSink.h"
+#include "Profile.h"
+#include "SparseMemory.h"
+#include "Trace.h"
+
+#include <chrono>
+#include <iostream>
+#include <memory>
+
+class Jit;
 
 class VM {
 public:
@@ -26,18 +36,86 @@ public:
         {}
     };
 
+    /// Thrown when a program runs past one of its limits. Output produced
+    /// until then has been flushed and the VM can be inspected.
+    class LimitException : public VMException {
+    public:
+        LimitException(std::string errorMessage)
+                : VMException(errorMessage)
+        {}
+    };
+
+    enum Engine {
+        ReferenceEngine,
+        ThreadedEngine,
+        JitEngine,
+    };
+
+    /// Zero means no limit.
+    struct Limits {
+        uint64_t instructions = 0;
+        std::chrono::milliseconds time{0}; // spent executing, since reset()
+        uint64_t memory = 0; // bytes of address space, the program is followed by zeroed words up to it
+    };
+
     VM();
 
+    ~VM();
+
+    void setEngine(Engine engine);
+
+    /// Sink receiving the output of print and dump. By default every VM has
+    /// its own sink writing to std::cout. It is flushed whenever the program
+    /// halts or fails.
+    void setOutputSink(OutputSink &sink);
+
+    /// Collects execution counts into `profile` from the next reset() on,
+    /// nullptr turns profiling off. Profiled programs always run on the
+    /// reference interpreter.
+    void setProfile(Profile *profile);
+
+    /// Records every executed instruction into `trace`, nullptr turns
+    /// tracing off. The JIT engine falls back to the threaded interpreter
+    /// while tracing.
+    void setTrace(TraceRecorder *trace);
+
+    void setLimits(Limits limits);
+
     void load(std::vector<Word> program);
 
+    /// Runs the program in `memory` in place, without copying it. Stores
+    /// modify `memory`, which has to outlive the VM.
+    void load(Word *memory, size_t words);
+
+    /// Executes the loaded program until it halts.
     void run();
 
+    /// Prepares the loaded program for execution: clears the registers and
+    /// jumps to the entry point. run() does this implicitly.
+    void reset();
+
+    /// Executes at most `instructions` instructions of the program prepared
+    /// by reset(). Returns false once the program has halted. Throws
+    /// LimitException when the program needs more than its limits allow.
+    bool runFor(uint64_t instructions);
+
+    /// Executes a single instruction with the reference interpreter.
+    bool step();
+
+    bool isRunning() const;
+
+    /// Number of instructions executed since the last reset().
+    uint64_t instructionCount() const;
+
     void print(std::ostream &os);
 
 private:
 
     Word &word(unsigned address);
 
+    /// Like word(), for instructions, which only the program itself holds.
+    Word &codeWord(unsigned address);
+
     int32_t &Mem(unsigned addres);
 
     void loadNextInstruction();
@@ -46,6 +124,46 @@ private:
 
     void executeNextInstruction();
 
+    template<int Code>
+    void execute();
+
+    /// Appends the registers and a listing of memory, as printed by dump.
+    void printState(std::string &text);
+
+    void dump();
+
+    void runEngine(uint64_t instructions);
+
+    void limitExceeded(const char *errorMessage);
+
+    void runReference(uint64_t instructions);
+
+    void referenceStep();
+
+    void profileStep(int32_t pc);
+
+    void invalidate(uint32_t wordIndex);
+
+    // Threaded engine
+
+    struct DecodedInstruction {
+        uint8_t handler;
+        uint8_t acu;
+        uint8_t usr;
+        int32_t operand;
+    };
+
+    void decodeProgram();
+
+    void decodeInstruction(size_t index);
+
+    template<bool Traced>
+    void runThreaded(uint64_t instructions);
+
+    // JIT engine
+
+    void runJit(uint64_t instructions);
+
     struct {
         unsigned run : 1;
     } RR;
@@ -57,7 +175,25 @@ private:
 
     int32_t *_AC = nullptr;
 
-    std::vector<Word> _program;
+    uint64_t _instructionCount = 0;
+
+    Limits _limits;
+    std::chrono::steady_clock::duration _elapsed{0};
+    std::chrono::steady_clock::duration _flushedAt{0}; // _elapsed when the output was last flushed
+
+    std::vector<Word> _program; // memory of programs loaded by copy
+    Word *_memory = nullptr;
+    size_t _memorySize = 0; // in words
+    std::unique_ptr<SparseMemory> _sparse; // words after the program, from Limits::memory
+
+    Engine _engine = ThreadedEngine;
+    StreamSink _standardOutput{std::cout};
+    OutputSink *_output = &_standardOutput;
+    Profile *_profile = nullptr;
+    TraceRecorder *_trace = nullptr;
+    std::vector<DecodedInstruction> _decoded;
+    std::unique_ptr<Jit> _jit;
+    bool _jitAttached = false;
 
 };
 
@@ -1,25 +1,309 @@
 #include "Assembler.h"
+#include "BatchRunner.h"
+#include "Image.h"
+#include "IncrementalAssembler.h"
+#include "Linker.h"
+#include "LockstepVM.h"
 #include "VM.h"
 
 #include <cassert>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
 #include <fstream>
+#include <limits>
+#include <memory>
+#include <thread>
+
+// Exit status of a program stopped by --max-instructions or --time-limit
+static const int limitExitStatus = 2;
+
+// Large sources are assembled on all cores, or on --jobs=N threads
+static std::unique_ptr<ThreadPool> assemblyPool(const SourceBuffer &source, unsigned jobs) {
+	std::unique_ptr<ThreadPool> pool;
+	if (jobs != 1 && source.size() >= Assembler::parallelSourceSize) {
+		pool.reset(new ThreadPool(jobs));
+	}
+	return pool;
+}
+
+// Errors in a unit name its file, as there is more than one
+static std::runtime_error unitError(const char *path, const std::exception &e) {
+	std::string what = e.what();
+	return std::runtime_error{std::string(path) + (what[0] == ':' ? "" : ": ") + what};
+}
+
+// Assembles the sources among `paths` into objects on --jobs=N threads, reads
+// the objects among them, and links them all in the order given
+static std::vector<Word> linkUnits(const std::vector<const char *> &paths, CompileCache *cache, unsigned jobs,
+                                   Linker &linker) {
+	std::vector<std::shared_ptr<const Object>> objects(paths.size());
+	std::vector<std::exception_ptr> errors(paths.size());
+	{
+		ThreadPool pool(jobs);
+		for (size_t i = 0; i < paths.size(); ++i) {
+			pool.submit([&, i] {
+				try {
+					if (Object::isObject(paths[i])) {
+						objects[i] = std::make_shared<Object>(Object::read(paths[i]));
+					} else if (cache) {
+						objects[i] = cache->compileObject(SourceBuffer::fromFile(paths[i]));
+					} else {
+						Assembler assembler(SourceBuffer::fromFile(paths[i]));
+						objects[i] = std::make_shared<Object>(assembler.compileObject());
+					}
+				} catch (std::exception &e) {
+					errors[i] = std::make_exception_ptr(unitError(paths[i], e));
+				}
+			});
+		}
+		pool.wait();
+	}
+
+	for (size_t i = 0; i < paths.size(); ++i) {
+		if (errors[i]) {
+			std::rethrow_exception(errors[i]);
+		}
+		linker.add(objects[i]);
+	}
+	return linker.link();
+}
+
+// Assembles and runs the source again whenever it changes, until interrupted.
+// The source is read rather than mapped, since editors may write it in place.
+static void watch(const char *sourcePath, VM::Engine engine, VM::Limits limits) {
+	IncrementalAssembler assembler;
+	uint64_t version = 0;
+	for (;;) {
+		uint64_t current = SourceBuffer::version(sourcePath);
+		if (current == version) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(100));
+			continue;
+		}
+		version = current;
+
+		try {
+			std::ifstream ifs(sourcePath, std::ios::binary);
+			if (!ifs.good()) {
+				throw std::runtime_error{"Unable to open file"};
+			}
+			auto start = std::chrono::steady_clock::now();
+			const std::vector<Word> &program = assembler.compile(SourceBuffer::fromStream(ifs));
+			std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+			std::cerr << "Assembled " << assembler.assembledLines() << " lines in " << elapsed.count() << " ms" << std::endl;
+
+			AsyncFileSink output(stdout);
+			VM vm;
+			vm.setEngine(engine);
+			vm.setOutputSink(output);
+			vm.setLimits(limits);
+			vm.load(program);
+			vm.run();
+		} catch (std::exception &e) {
+			std::cerr << e.what() << std::endl;
+		}
+	}
+}
+
+static void usage() {
+	std::cerr << "Usage: aghsm [-O] [--engine=threaded|jit|reference] [--max-instructions=N] [--time-limit=MS] [--memory=BYTES]" << std::endl;
+	std::cerr << "             [--profile] [--trace=file [--trace-ring=N]] [--cache[=DIR] [--cache-size=BYTES]] [--jobs=N] [source|image|unit...]" << std::endl;
+	std::cerr << "       aghsm [-O] --emit=image [--strip] [--cache[=DIR]] [--jobs=N] source|unit..." << std::endl;
+	std::cerr << "       aghsm --emit-object=object source" << std::endl;
+	std::cerr << "       aghsm [--engine=...] [--max-instructions=N] [--time-limit=MS] [--memory=BYTES] --watch source" << std::endl;
+	std::cerr << "       aghsm [--engine=...] [--jobs=N] [--quantum=N] [--output-limit=BYTES] [--cache[=DIR]] --batch=manifest" << std::endl;
+	std::cerr << "       aghsm [--max-instructions=N] [--time-limit=MS] [--output-limit=BYTES] --lockstep=overrides source" << std::endl;
+}
 
 int main(int argc, char **argv) {
 	std::ifstream ifs;
+	const char *sourcePath = nullptr;
+	std::vector<const char *> unitPaths;
+	const char *manifestPath = nullptr;
+	const char *overridesPath = nullptr;
+	unsigned jobs = 0;
+	uint64_t quantum = Scheduler::defaultQuantum;
+	size_t outputLimit = std::numeric_limits<size_t>::max();
+	VM::Engine engine = VM::ThreadedEngine;
+	bool profiling = false;
+	const char *tracePath = nullptr;
+	size_t traceRing = 0;
+	VM::Limits limits;
+	const char *imagePath = nullptr;
+	const char *objectPath = nullptr;
+	bool strip = false;
+	bool optimizing = false;
+	bool watching = false;
+	std::string cacheDirectory;
+	uint64_t cacheSize = CompileCache::defaultMaxSize;
 
-	if (argc == 1) {
-		ifs.open("1.asm");
-		assert(ifs.good());
+	for (int i = 1; i < argc; ++i) {
+		if (!std::strcmp(argv[i], "--engine=threaded")) {
+			engine = VM::ThreadedEngine;
+		} else if (!std::strcmp(argv[i], "--engine=jit")) {
+			engine = VM::JitEngine;
+		} else if (!std::strcmp(argv[i], "--engine=reference")) {
+			engine = VM::ReferenceEngine;
+		} else if (!std::strcmp(argv[i], "--profile")) {
+			profiling = true;
+		} else if (!std::strncmp(argv[i], "--trace=", 8)) {
+			tracePath = argv[i] + 8;
+		} else if (!std::strncmp(argv[i], "--trace-ring=", 13)) {
+			traceRing = std::strtoull(argv[i] + 13, nullptr, 10);
+		} else if (!std::strncmp(argv[i], "--max-instructions=", 19)) {
+			limits.instructions = std::strtoull(argv[i] + 19, nullptr, 10);
+		} else if (!std::strncmp(argv[i], "--time-limit=", 13)) {
+			limits.time = std::chrono::milliseconds(std::strtoull(argv[i] + 13, nullptr, 10));
+		} else if (!std::strncmp(argv[i], "--memory=", 9)) {
+			limits.memory = std::strtoull(argv[i] + 9, nullptr, 10);
+		} else if (!std::strncmp(argv[i], "--emit-object=", 14)) {
+			objectPath = argv[i] + 14;
+		} else if (!std::strncmp(argv[i], "--emit=", 7)) {
+			imagePath = argv[i] + 7;
+		} else if (!std::strcmp(argv[i], "-O")) {
+			optimizing = true;
+		} else if (!std::strcmp(argv[i], "--strip")) {
+			strip = true;
+		} else if (!std::strcmp(argv[i], "--watch")) {
+			watching = true;
+		} else if (!std::strcmp(argv[i], "--cache")) {
+			cacheDirectory = CompileCache::defaultDirectory();
+		} else if (!std::strncmp(argv[i], "--cache=", 8)) {
+			cacheDirectory = argv[i] + 8;
+		} else if (!std::strncmp(argv[i], "--cache-size=", 13)) {
+			cacheSize = std::strtoull(argv[i] + 13, nullptr, 10);
+		} else if (!std::strncmp(argv[i], "--batch=", 8)) {
+			manifestPath = argv[i] + 8;
+		} else if (!std::strncmp(argv[i], "--lockstep=", 11)) {
+			overridesPath = argv[i] + 11;
+		} else if (!std::strncmp(argv[i], "--jobs=", 7)) {
+			jobs = std::atoi(argv[i] + 7);
+		} else if (!std::strncmp(argv[i], "--quantum=", 10)) {
+			quantum = std::strtoull(argv[i] + 10, nullptr, 10);
+		} else if (!std::strncmp(argv[i], "--output-limit=", 15)) {
+			outputLimit = std::strtoull(argv[i] + 15, nullptr, 10);
+		} else if (argv[i][0] == '-') {
+			usage();
+			return 1;
+		} else {
+			unitPaths.push_back(argv[i]);
+		}
+	}
+	if (!unitPaths.empty()) {
+		sourcePath = unitPaths.front();
+	}
+	// More than one unit, or objects, are linked
+	bool linking = unitPaths.size() > 1 || (sourcePath && Object::isObject(sourcePath));
+	if (unitPaths.size() > 1 && (watching || overridesPath || objectPath)) {
+		usage();
+		return 1;
+	}
+
+	std::unique_ptr<CompileCache> cache;
+	if (!cacheDirectory.empty()) {
+		cache.reset(new CompileCache(cacheDirectory, cacheSize));
+	}
+
+	if (manifestPath) {
+		ifs.open(manifestPath);
 
-		Assembler assembler(ifs);
-		auto program = assembler.compile();
-		VM vm;
-		vm.load(program);
-		vm.run();
-	} else if (argc == 2) {
-		ifs.open(argv[1]);
-		
 		if (!ifs.good()) {
+			std::cerr << "Unable to open manifest" << std::endl;
+			return 1;
+		}
+
+		BatchRunner runner(BatchRunner::readManifest(ifs), engine, quantum, outputLimit);
+		runner.setLimits(limits);
+		runner.setCache(cache.get());
+		ThreadPool pool(jobs);
+		runner.run(pool);
+		runner.printReport(std::cout);
+		return runner.allSucceeded() ? 0 : runner.anyFailed() ? 1 : limitExitStatus;
+	}
+
+	// Batch mode, above, assembles its programs without -O
+	if (cache) {
+		cache->setOptimization(optimizing);
+	}
+
+	if (objectPath) {
+		if (!sourcePath) {
+			usage();
+			return 1;
+		}
+
+		try {
+			Assembler assembler(SourceBuffer::fromFile(sourcePath));
+			assembler.compileObject().write(objectPath);
+		} catch (std::exception &e) {
+			std::cerr << e.what() << std::endl;
+			return 1;
+		}
+		return 0;
+	}
+
+	if (imagePath && linking) {
+		try {
+			Linker linker;
+			auto program = linkUnits(unitPaths, cache.get(), jobs, linker);
+			if (strip) {
+				Image::write(imagePath, program, {});
+			} else {
+				Image::write(imagePath, program, linker.labels(), linker.lineNumbers());
+			}
+		} catch (std::exception &e) {
+			std::cerr << e.what() << std::endl;
+			return 1;
+		}
+		return 0;
+	}
+
+	if (imagePath) {
+		if (!sourcePath) {
+			usage();
+			return 1;
+		}
+
+		try {
+			auto source = SourceBuffer::fromFile(sourcePath);
+			auto pool = assemblyPool(*source, jobs);
+			Assembler assembler(source);
+			assembler.setThreadPool(pool.get());
+			assembler.setOptimization(optimizing);
+			auto program = assembler.compile();
+			if (strip) {
+				Image::write(imagePath, program, {});
+			} else {
+				Image::write(imagePath, program, assembler.labels(), assembler.lineNumbers());
+			}
+		} catch (std::exception &e) {
+			std::cerr << e.what() << std::endl;
+			return 1;
+		}
+		return 0;
+	}
+
+	if (watching) {
+		if (!sourcePath) {
+			usage();
+			return 1;
+		}
+
+		watch(sourcePath, engine, limits);
+		return 0;
+	}
+
+	if (overridesPath) {
+		if (!sourcePath) {
+			usage();
+			return 1;
+		}
+
+		ifs.open(sourcePath);
+		std::ifstream overridesStream(overridesPath);
+
+		if (!ifs.good() || !overridesStream.good()) {
 			std::cerr << "Unable to open file" << std::endl;
 			return 1;
 		}
@@ -27,9 +311,92 @@ int main(int argc, char **argv) {
 		try {
 			Assembler assembler(ifs);
 			auto program = assembler.compile();
+			auto overrides = LockstepVM::readOverrides(overridesStream, assembler.labels());
+			LockstepVM vm(program, overrides.empty() ? 1 : overrides.front().values.size());
+			vm.setLimits(limits);
+			vm.setOutputLimit(outputLimit);
+			vm.applyOverrides(overrides);
+			vm.run();
+			vm.printReport(std::cout);
+			return vm.allSucceeded() ? 0 : vm.anyFailed() ? 1 : limitExitStatus;
+		} catch (std::exception &e) {
+			std::cerr << e.what() << std::endl;
+			return 1;
+		}
+	}
+
+	if (!sourcePath) {
+		ifs.open("1.asm");
+		assert(ifs.good());
+
+		Assembler assembler(ifs);
+		auto program = assembler.compile();
+		AsyncFileSink output(stdout);
+		VM vm;
+		vm.setEngine(engine);
+		vm.setOutputSink(output);
+		vm.setLimits(limits);
+		vm.load(program);
+		vm.run();
+	} else {
+		try {
+			std::unique_ptr<Image> image;
+			std::unique_ptr<Assembler> assembler;
+			std::unique_ptr<Linker> linker;
+			std::vector<Word> program;
+			if (linking) {
+				linker.reset(new Linker);
+				program = linkUnits(unitPaths, cache.get(), jobs, *linker);
+			} else if (Image::isImage(sourcePath)) {
+				image.reset(new Image(sourcePath));
+			} else if (cache) {
+				image = cache->compile(SourceBuffer::fromFile(sourcePath));
+			} else {
+				auto source = SourceBuffer::fromFile(sourcePath);
+				auto pool = assemblyPool(*source, jobs);
+				assembler.reset(new Assembler(source));
+				assembler->setThreadPool(pool.get());
+				assembler->setOptimization(optimizing);
+				program = assembler->compile();
+				assembler->setThreadPool(nullptr);
+			}
+			if (image && profiling) {
+				// Images run in place, the listing of a profile needs a copy
+				program.assign(image->words(), image->words() + image->size());
+			}
+
+			AsyncFileSink output(stdout);
+			Profile profile;
 			VM vm;
-			vm.load(program);
+			vm.setEngine(engine);
+			vm.setOutputSink(output);
+			vm.setLimits(limits);
+			if (profiling) {
+				vm.setProfile(&profile);
+			}
+			std::unique_ptr<TraceRecorder> trace;
+			if (tracePath) {
+				trace.reset(new TraceRecorder(tracePath, traceRing));
+				vm.setTrace(trace.get());
+			}
+			if (image) {
+				vm.load(image->words(), image->size());
+			} else {
+				vm.load(program);
+			}
 			vm.run();
+
+			if (profiling) {
+				if (linker) {
+					printProfile(std::cerr, profile, program, linker->lineNumbers(), linker->labels());
+				} else {
+					printProfile(std::cerr, profile, program, image ? image->lineNumbers() : assembler->lineNumbers(),
+					             image ? image->labels() : assembler->labels());
+				}
+			}
+		} catch (VM::LimitException &e) {
+			std::cerr << e.what() << std::endl;
+			return limitExitStatus;
 		} catch (std::exception &e) {
 			std::cerr << e.what() << std::endl;
 			return 1;
@@ -37,4 +404,4 @@ int main(int argc, char **argv) {
 	}
 
     return 0;
-}
\ No newline at end of file
+}